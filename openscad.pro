@@ -252,6 +252,8 @@ HEADERS += src/AST.h \
            src/Assignment.h \
            src/expression.h \
            src/function.h \
+           src/FunctionProgram.h \
+           src/ExpressionOptimizer.h \
            src/module.h \           
            src/UserModule.h \
 
@@ -260,6 +262,8 @@ SOURCES += src/AST.cc \
            src/Assignment.cc \
            src/expr.cc \
            src/function.cc \
+           src/FunctionProgram.cc \
+           src/ExpressionOptimizer.cc \
            src/module.cc \
            src/UserModule.cc \
            src/annotation.cc
@@ -310,6 +314,7 @@ HEADERS += src/version_check.h \
            src/stackcheck.h \
            src/exceptions.h \
            src/grid.h \
+           src/parallel.h \
            src/hash.h \
            src/highlighter.h \
            src/localscope.h \
@@ -346,6 +351,7 @@ HEADERS += src/version_check.h \
            src/nodecache.h \
            src/nodedumper.h \
            src/ModuleCache.h \
+           src/ASTCache.h \
            src/GeometryCache.h \
            src/GeometryEvaluator.h \
            src/Tree.h \
@@ -361,6 +367,7 @@ HEADERS += src/version_check.h \
            src/svg.h \
            \
            src/OffscreenView.h \
+           src/SoftwareRasterizer.h \
            src/OffscreenContext.h \
            src/OffscreenContextAll.hpp \
            src/fbo.h \
@@ -471,6 +478,7 @@ SOURCES += \
            src/NodeVisitor.cc \
            src/GeometryEvaluator.cc \
            src/ModuleCache.cc \
+           src/ASTCache.cc \
            src/GeometryCache.cc \
            src/Tree.cc \
 	       src/DrawingCallback.cc \
@@ -504,6 +512,7 @@ SOURCES += \
            src/export_svg.cc \
            src/export_nef.cc \
            src/export_png.cc \
+           src/SoftwareRasterizer.cc \
            src/import.cc \
            src/import_stl.cc \
            src/import_off.cc \
@@ -657,6 +666,7 @@ SOURCES += src/cgalutils.cc \
            src/cgalutils-project.cc \
            src/cgalutils-tess.cc \
            src/cgalutils-polyhedron.cc \
+           src/cgalutils-corefine.cc \
            src/CGALCache.cc \
            src/CGALRenderer.cc \
            src/CGAL_Nef_polyhedron.cc \
@@ -0,0 +1,548 @@
+#include "ASTCache.h"
+#include "FileModule.h"
+#include "ModuleInstantiation.h"
+#include "UserModule.h"
+#include "function.h"
+#include "expression.h"
+#include "ExpressionOptimizer.h"
+#include "handle_dep.h"
+#include "printutils.h"
+#include "StatCache.h"
+#include "openscad.h"
+#include "version.h"
+
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/format.hpp>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace {
+	std::string directory;
+
+	// Increase when changing the format of the cache files
+	const int64_t FORMAT_VERSION = 2;
+	const char MAGIC[] = "OpenSCAD AST cache";
+
+	struct ASTCacheException : public std::exception {};
+
+	/*!
+		Reads an AST written by ASTWriter from an entry of the given size.
+		Throws ASTCacheException if the data is truncated or otherwise invalid.
+	*/
+	class ASTReader
+	{
+	public:
+		ASTReader(std::istream &stream, uintmax_t size) : stream(stream), remaining(size) {}
+
+		ASTTag readTag() {
+			consume(1);
+			int c = this->stream.get();
+			if (c < 0 || c > int(ASTTag::IfElseModuleInstantiation)) throw ASTCacheException();
+			return ASTTag(c);
+		}
+
+		bool readBool() {
+			consume(1);
+			int c = this->stream.get();
+			if (c < 0) throw ASTCacheException();
+			return c != 0;
+		}
+
+		int64_t readInt() {
+			int64_t i;
+			consume(sizeof(i));
+			if (!this->stream.read(reinterpret_cast<char *>(&i), sizeof(i))) throw ASTCacheException();
+			return i;
+		}
+
+		// Sizes count bytes or elements taking at least one byte each, so none
+		// can exceed the rest of the entry
+		size_t readSize() {
+			int64_t size = readInt();
+			if (size < 0 || uintmax_t(size) > this->remaining) throw ASTCacheException();
+			return size_t(size);
+		}
+
+		// Reads an enumerator written as an integer, up to the given last one
+		template <typename T> T readEnum(T last) {
+			int64_t i = readInt();
+			if (i < 0 || i > int64_t(last)) throw ASTCacheException();
+			return T(i);
+		}
+
+		double readDouble() {
+			double d;
+			consume(sizeof(d));
+			if (!this->stream.read(reinterpret_cast<char *>(&d), sizeof(d))) throw ASTCacheException();
+			return d;
+		}
+
+		std::string readString() {
+			std::string s(readSize(), '\0');
+			consume(s.size());
+			if (!this->stream.read(&s[0], s.size())) throw ASTCacheException();
+			return s;
+		}
+
+		Location readLocation() {
+			int first_line = readInt();
+			int first_col = readInt();
+			int last_line = readInt();
+			int last_col = readInt();
+			size_t idx = readSize();
+			if (idx == this->paths.size()) {
+				this->paths.push_back(std::make_shared<fs::path>(readString()));
+			}
+			if (idx >= this->paths.size()) throw ASTCacheException();
+			return Location(first_line, first_col, last_line, last_col, this->paths[idx]);
+		}
+
+		ValuePtr readValue() {
+			switch (readEnum(Value::ValueType::RANGE)) {
+			case Value::ValueType::UNDEFINED:
+				return ValuePtr::undefined;
+			case Value::ValueType::BOOL:
+				return ValuePtr(readBool());
+			case Value::ValueType::NUMBER:
+				return ValuePtr(readDouble());
+			case Value::ValueType::STRING:
+				return ValuePtr(readString());
+			case Value::ValueType::VECTOR: {
+				Value::VectorType vec(readSize());
+				for (auto &v : vec) v = readValue();
+				return ValuePtr(std::move(vec));
+			}
+			case Value::ValueType::RANGE: {
+				double begin = readDouble();
+				double step = readDouble();
+				double end = readDouble();
+				return ValuePtr(RangeType(begin, step, end));
+			}
+			default:
+				throw ASTCacheException();
+			}
+		}
+
+		// Reads the arguments and expression shared by several expression types
+		void readArgumentsAndExpression(AssignmentList &args, std::unique_ptr<Expression> &expr) {
+			args = readAssignments();
+			expr = readExpression();
+		}
+
+		std::unique_ptr<Expression> readExpression() {
+			ASTTag tag = readTag();
+			if (tag == ASTTag::None) return nullptr;
+			Location loc = readLocation();
+			AssignmentList args;
+			std::unique_ptr<Expression> expr;
+
+			switch (tag) {
+			case ASTTag::UnaryOp: {
+				auto op = readEnum(UnaryOp::Op::Negate);
+				expr = readExpression();
+				return std::unique_ptr<Expression>(new UnaryOp(op, expr.release(), loc));
+			}
+			case ASTTag::BinaryOp: {
+				auto op = readEnum(BinaryOp::Op::NotEqual);
+				auto left = readExpression();
+				auto right = readExpression();
+				return std::unique_ptr<Expression>(new BinaryOp(left.release(), op, right.release(), loc));
+			}
+			case ASTTag::TernaryOp: {
+				auto cond = readExpression();
+				auto ifexpr = readExpression();
+				auto elseexpr = readExpression();
+				return std::unique_ptr<Expression>(new TernaryOp(cond.release(), ifexpr.release(), elseexpr.release(), loc));
+			}
+			case ASTTag::ArrayLookup: {
+				auto array = readExpression();
+				auto index = readExpression();
+				return std::unique_ptr<Expression>(new ArrayLookup(array.release(), index.release(), loc));
+			}
+			case ASTTag::Literal:
+				return std::unique_ptr<Expression>(new Literal(readValue(), loc));
+			case ASTTag::Range: {
+				auto begin = readExpression();
+				auto step = readExpression();
+				auto end = readExpression();
+				return std::unique_ptr<Expression>(new Range(begin.release(), step.release(), end.release(), loc));
+			}
+			case ASTTag::Vector: {
+				std::unique_ptr<Vector> vec(new Vector(loc));
+				size_t size = readSize();
+				for (size_t i = 0; i < size; i++) vec->push_back(readExpression().release());
+				return std::move(vec);
+			}
+			case ASTTag::Lookup:
+				return std::unique_ptr<Expression>(new Lookup(readString(), loc));
+			case ASTTag::MemberLookup: {
+				expr = readExpression();
+				auto member = readString();
+				return std::unique_ptr<Expression>(new MemberLookup(expr.release(), member, loc));
+			}
+			case ASTTag::FunctionCall: {
+				auto name = readString();
+				args = readAssignments();
+				return std::unique_ptr<Expression>(new FunctionCall(name, args, loc));
+			}
+			case ASTTag::Assert:
+				readArgumentsAndExpression(args, expr);
+				return std::unique_ptr<Expression>(new Assert(args, expr.release(), loc));
+			case ASTTag::Echo:
+				readArgumentsAndExpression(args, expr);
+				return std::unique_ptr<Expression>(new Echo(args, expr.release(), loc));
+			case ASTTag::Let:
+				readArgumentsAndExpression(args, expr);
+				return std::unique_ptr<Expression>(new Let(args, expr.release(), loc));
+			case ASTTag::LcIf: {
+				auto cond = readExpression();
+				auto ifexpr = readExpression();
+				auto elseexpr = readExpression();
+				return std::unique_ptr<Expression>(new LcIf(cond.release(), ifexpr.release(), elseexpr.release(), loc));
+			}
+			case ASTTag::LcFor:
+				readArgumentsAndExpression(args, expr);
+				return std::unique_ptr<Expression>(new LcFor(args, expr.release(), loc));
+			case ASTTag::LcForC: {
+				args = readAssignments();
+				auto incrargs = readAssignments();
+				auto cond = readExpression();
+				expr = readExpression();
+				return std::unique_ptr<Expression>(new LcForC(args, incrargs, cond.release(), expr.release(), loc));
+			}
+			case ASTTag::LcEach:
+				expr = readExpression();
+				return std::unique_ptr<Expression>(new LcEach(expr.release(), loc));
+			case ASTTag::LcLet:
+				readArgumentsAndExpression(args, expr);
+				return std::unique_ptr<Expression>(new LcLet(args, expr.release(), loc));
+			default:
+				throw ASTCacheException();
+			}
+		}
+
+		AssignmentList readAssignments() {
+			AssignmentList assignments;
+			size_t size = readSize();
+			assignments.reserve(size);
+			for (size_t i = 0; i < size; i++) {
+				auto name = readString();
+				auto loc = readLocation();
+				shared_ptr<Expression> expr(readExpression());
+				assignments.emplace_back(name, expr, loc);
+			}
+			return assignments;
+		}
+
+		std::unique_ptr<ModuleInstantiation> readModuleInstantiation() {
+			ASTTag tag = readTag();
+			Location loc = readLocation();
+			std::unique_ptr<ModuleInstantiation> inst;
+			IfElseModuleInstantiation *ifelse = nullptr;
+			if (tag == ASTTag::ModuleInstantiation) {
+				auto name = readString();
+				auto path = readString();
+				auto args = readAssignments();
+				inst.reset(new ModuleInstantiation(name, args, path, loc));
+			}
+			else if (tag == ASTTag::IfElseModuleInstantiation) {
+				auto path = readString();
+				shared_ptr<Expression> cond(readExpression());
+				inst.reset(ifelse = new IfElseModuleInstantiation(cond, path, loc));
+			}
+			else {
+				throw ASTCacheException();
+			}
+			inst->tag_root = readBool();
+			inst->tag_highlight = readBool();
+			inst->tag_background = readBool();
+			readScope(inst->scope);
+			if (ifelse) readScope(ifelse->else_scope);
+			return inst;
+		}
+
+		void readScope(LocalScope &scope) {
+			size_t numfunctions = readSize();
+			for (size_t i = 0; i < numfunctions; i++) {
+				auto name = readString();
+				auto loc = readLocation();
+				auto args = readAssignments();
+				shared_ptr<Expression> expr(readExpression());
+				scope.addFunction(new UserFunction(name.c_str(), args, expr, loc));
+			}
+			size_t nummodules = readSize();
+			for (size_t i = 0; i < nummodules; i++) {
+				auto name = readString();
+				auto loc = readLocation();
+				std::unique_ptr<UserModule> module(new UserModule(name.c_str(), loc));
+				module->definition_arguments = readAssignments();
+				readScope(module->scope);
+				scope.addModule(name, module.release());
+			}
+			for (const auto &assignment : readAssignments()) {
+				scope.addAssignment(assignment);
+			}
+			size_t numchildren = readSize();
+			for (size_t i = 0; i < numchildren; i++) {
+				scope.addChild(readModuleInstantiation().release());
+			}
+		}
+
+	private:
+		void consume(uintmax_t size) {
+			if (size > this->remaining) throw ASTCacheException();
+			this->remaining -= size;
+		}
+
+		std::istream &stream;
+		uintmax_t remaining;
+		std::vector<std::shared_ptr<fs::path>> paths;
+	};
+
+	// Identifies everything the AST of the given file depends on, except for included files
+	std::string cacheKey(const std::string &filename, const std::string &cache_id)
+	{
+		return str(boost::format("%s\n%d\n%s\n%s\n%s") % openscad_versionnumber % FORMAT_VERSION %
+							 filename % cache_id % commandline_commands);
+	}
+
+	fs::path cacheFile(const std::string &filename)
+	{
+		return fs::path(directory) / str(boost::format("%016x.ast") % std::hash<std::string>()(filename));
+	}
+}
+
+void ASTWriter::write(const std::string &s)
+{
+	write(int64_t(s.size()));
+	this->stream.write(s.data(), s.size());
+}
+
+void ASTWriter::write(const Location &loc)
+{
+	write(int64_t(loc.firstLine()));
+	write(int64_t(loc.firstColumn()));
+	write(int64_t(loc.lastLine()));
+	write(int64_t(loc.lastColumn()));
+	const auto path = loc.fileName();
+	auto it = this->paths.find(path);
+	if (it != this->paths.end()) {
+		write(it->second);
+	}
+	else {
+		int64_t idx = this->paths.size();
+		this->paths.emplace(path, idx);
+		write(idx);
+		write(path);
+	}
+}
+
+void ASTWriter::write(const ValuePtr &value)
+{
+	write(int64_t(value->type()));
+	switch (value->type()) {
+	case Value::ValueType::BOOL:
+		write(value->toBool());
+		break;
+	case Value::ValueType::NUMBER:
+		write(value->toDouble());
+		break;
+	case Value::ValueType::STRING:
+		write(value->toString());
+		break;
+	case Value::ValueType::VECTOR:
+		write(int64_t(value->toVector().size()));
+		for (const auto &v : value->toVector()) write(v);
+		break;
+	case Value::ValueType::RANGE: {
+		RangeType range = value->toRange();
+		write(range.begin_value());
+		write(range.step_value());
+		write(range.end_value());
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+void ASTWriter::write(const shared_ptr<Expression> &expr)
+{
+	if (expr) expr->serialize(*this);
+	else write(ASTTag::None);
+}
+
+void ASTWriter::write(const AssignmentList &assignments)
+{
+	write(int64_t(assignments.size()));
+	for (const auto &assignment : assignments) {
+		write(assignment.name);
+		write(assignment.location());
+		write(assignment.expr);
+	}
+}
+
+void ASTWriter::write(const LocalScope &scope)
+{
+	write(int64_t(scope.astFunctions.size()));
+	for (const auto &f : scope.astFunctions) {
+		write(f.second->name);
+		write(f.second->location());
+		write(f.second->definition_arguments);
+		write(f.second->expr);
+	}
+	write(int64_t(scope.astModules.size()));
+	for (const auto &m : scope.astModules) {
+		write(m.first);
+		write(m.second->location());
+		write(m.second->definition_arguments);
+		write(m.second->scope);
+	}
+	write(scope.assignments);
+	write(int64_t(scope.children.size()));
+	for (const auto &inst : scope.children) {
+		inst->serialize(*this);
+	}
+}
+
+namespace ASTCache {
+
+	void setDirectory(const std::string &dir)
+	{
+		directory = dir;
+	}
+
+	bool enabled()
+	{
+		return !directory.empty();
+	}
+
+	/*!
+		Returns the cached AST of the given library file, or nullptr if the cache
+		is disabled, has no entry for the file or the entry is out of date or
+		unreadable. Replays the dependencies the parser would have registered,
+		and the messages it printed.
+	*/
+	FileModule *load(const std::string &filename, const std::string &cache_id)
+	{
+		if (!enabled()) return nullptr;
+
+		const auto file = cacheFile(filename);
+		boost::system::error_code ec;
+		auto size = fs::file_size(file, ec);
+		if (ec) return nullptr;
+		std::ifstream stream(file.string(), std::ios::binary);
+		if (!stream.is_open()) return nullptr;
+
+		std::unique_ptr<FileModule> module;
+		std::vector<std::string> includes;
+		std::string messages;
+		try {
+			ASTReader reader(stream, size);
+			if (reader.readString() != MAGIC ||
+					reader.readString() != cacheKey(filename, cache_id)) return nullptr;
+
+			auto path = reader.readString();
+			auto name = reader.readString();
+			module.reset(new FileModule(path, name));
+			reader.readScope(module->scope);
+
+			size_t numlibs = reader.readSize();
+			for (size_t i = 0; i < numlibs; i++) module->usedlibs.insert(reader.readString());
+			size_t numfonts = reader.readSize();
+			for (size_t i = 0; i < numfonts; i++) module->registerUse(reader.readString(), Location::NONE);
+			size_t numincludes = reader.readSize();
+			for (size_t i = 0; i < numincludes; i++) {
+				auto localpath = reader.readString();
+				auto fullpath = reader.readString();
+				auto mtime = reader.readInt();
+				auto filesize = reader.readInt();
+				// The entry holds the contents of included files as they were when it
+				// was written, so any other version of an include invalidates it, even
+				// an older one
+				struct stat st;
+				bool exists = StatCache::stat(fullpath.c_str(), st) == 0;
+				if (mtime != (exists ? int64_t(st.st_mtime) : -1) ||
+						filesize != (exists ? int64_t(st.st_size) : -1)) return nullptr;
+				module->registerInclude(localpath, fullpath, Location::NONE);
+				includes.push_back(fullpath);
+			}
+			size_t numindicators = reader.readSize();
+			for (size_t i = 0; i < numindicators; i++) {
+				int linenr = reader.readInt();
+				int colnr = reader.readInt();
+				int nrofchar = reader.readInt();
+				module->indicatorData.emplace_back(linenr, colnr, nrofchar, reader.readString());
+			}
+			messages = reader.readString();
+		}
+		catch (const std::exception &) {
+			// Includes ASTCacheException, and running out of memory on corrupted sizes
+			PRINTDB("Invalid AST cache entry for %s: %s", filename % file.string());
+			return nullptr;
+		}
+
+		// Print what the parser printed, like warnings about deprecated syntax
+		if (!messages.empty()) {
+			std::vector<std::string> lines;
+			boost::split(lines, messages, boost::is_any_of("\n"));
+			for (const auto &line : lines) PRINT(line);
+		}
+
+		// Register the dependencies found by the lexer
+		for (const auto &include : includes) {
+			if (fs::exists(include)) handle_dep(include);
+		}
+		for (const auto &lib : module->usedlibs) {
+			if (fs::path(lib).is_absolute()) handle_dep(lib);
+		}
+		for (const auto &font : module->usedfonts) handle_dep(font);
+
+		// Entries hold expressions as written, see Literal::serialize()
+		ExpressionOptimizer::optimize(*module);
+		PRINTDB("Loaded cached AST for %s", filename);
+		return module.release();
+	}
+
+	/*!
+		Writes the AST of the given successfully parsed library file to the cache,
+		with the messages printed while parsing it, one per line. The entry is
+		written to a temporary file first, so concurrent processes never see
+		partially written entries.
+	*/
+	void store(const FileModule &module, const std::string &filename, const std::string &cache_id,
+						 const std::string &messages)
+	{
+		if (!enabled()) return;
+
+		boost::system::error_code ec;
+		fs::create_directories(directory, ec);
+		const auto file = cacheFile(filename);
+		const auto tmpfile = fs::path(directory) / fs::unique_path("%%%%-%%%%-%%%%-%%%%.tmp");
+		{
+			std::ofstream stream(tmpfile.string(), std::ios::binary);
+			if (!stream.is_open()) {
+				PRINTDB("Can't write AST cache entry for %s: %s", filename % tmpfile.string());
+				return;
+			}
+			ASTWriter writer(stream);
+			writer.write(std::string(MAGIC));
+			writer.write(cacheKey(filename, cache_id));
+			module.serialize(writer);
+			writer.write(messages);
+			if (!stream) {
+				stream.close();
+				fs::remove(tmpfile, ec);
+				return;
+			}
+		}
+		fs::rename(tmpfile, file, ec);
+		if (ec) fs::remove(tmpfile, ec);
+	}
+
+}
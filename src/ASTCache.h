@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <ostream>
+#include <unordered_map>
+#include "memory.h"
+#include "value.h"
+#include "Assignment.h"
+
+class FileModule;
+class LocalScope;
+class Expression;
+
+/*!
+	On-disk cache of parsed library files, so separate processes using the
+	same libraries don't need to parse them again. See ModuleCache::evaluate().
+
+	Entries are binary dumps of the AST, written by the serialize() methods of
+	the AST nodes through an ASTWriter. They are keyed by the file path, its
+	modification time and size, the OpenSCAD version and the command line
+	definitions appended to the source. Included files are checked separately
+	when loading an entry, against the modification time and size they had
+	when it was written. Messages printed by the parser are stored as well,
+	and printed again when loading the entry.
+*/
+namespace ASTCache {
+	// Sets the directory holding the cache. Empty disables the cache.
+	void setDirectory(const std::string &dir);
+	bool enabled();
+
+	FileModule *load(const std::string &filename, const std::string &cache_id);
+	void store(const FileModule &module, const std::string &filename, const std::string &cache_id,
+						 const std::string &messages);
+}
+
+// Identifies the type of each serialized AST node
+enum class ASTTag : char {
+	None,
+	UnaryOp,
+	BinaryOp,
+	TernaryOp,
+	ArrayLookup,
+	Literal,
+	Range,
+	Vector,
+	Lookup,
+	MemberLookup,
+	FunctionCall,
+	Assert,
+	Echo,
+	Let,
+	LcIf,
+	LcFor,
+	LcForC,
+	LcEach,
+	LcLet,
+	ModuleInstantiation,
+	IfElseModuleInstantiation
+};
+
+class ASTWriter
+{
+public:
+	ASTWriter(std::ostream &stream) : stream(stream) {}
+
+	void write(ASTTag tag) { this->stream.put(char(tag)); }
+	void write(bool b) { this->stream.put(b ? 1 : 0); }
+	void write(int64_t i) { this->stream.write(reinterpret_cast<const char *>(&i), sizeof(i)); }
+	void write(double d) { this->stream.write(reinterpret_cast<const char *>(&d), sizeof(d)); }
+	void write(const std::string &s);
+	void write(const Location &loc);
+	void write(const ValuePtr &value);
+	void write(const shared_ptr<Expression> &expr);
+	void write(const AssignmentList &assignments);
+	void write(const LocalScope &scope);
+
+private:
+	std::ostream &stream;
+	// Source files are written once, and referred to by index afterwards
+	std::unordered_map<std::string, int64_t> paths;
+};
@@ -1,25 +1,106 @@
 #include "CGALCache.h"
 #include "printutils.h"
 #include "CGAL_Nef_polyhedron.h"
+#include "feature.h"
+#include <sstream>
+
+#pragma push_macro("NDEBUG")
+#undef NDEBUG
+#include <CGAL/IO/Nef_polyhedron_iostream_3.h>
+#pragma pop_macro("NDEBUG")
 
 CGALCache *CGALCache::inst = nullptr;
 
 CGALCache::CGALCache(size_t limit) : cache(limit)
 {
+	this->cache.setCompactor(compact);
+}
+
+/*!
+	Called for entries about to be evicted. If enabled, the polyhedron is
+	serialized in nef3 format, which is usually much smaller than the live
+	Nef polyhedron, and restored by get() on the next cache hit.
+	Returns the new cost of the entry.
+*/
+size_t CGALCache::compact(cache_entry &entry)
+{
+	const auto memsize = entry.N ? entry.N->memsize() : 0;
+	if (!Feature::ExperimentalCompactCGALCache.is_enabled() || !entry.N || entry.N->isEmpty()) return memsize;
+
+	std::ostringstream stream;
+	stream << *entry.N->p3;
+	auto serialized = stream.str();
+	if (serialized.size() >= memsize) return memsize;
+
+	PRINTDB("CGAL Cache compact: %d -> %d bytes", memsize % serialized.size());
+	entry.serialized.swap(serialized);
+	entry.serialized.shrink_to_fit();
+	// The convexity is not part of the nef3 format
+	entry.convexity = entry.N->getConvexity();
+	entry.N.reset();
+	return entry.serialized.capacity();
+}
+
+/*!
+	Restores the polyhedron of the given entry if it has been compacted. If
+	that fails, the entry is removed, so the node is evaluated again.
+	Returns whether the entry is still there, restored. The restored entry
+	may no longer fit into the cache, or be compacted again when making
+	room for it, which also makes it a miss.
+*/
+bool CGALCache::restore(const std::string &id) const
+{
+	auto entry = this->cache.peek(id);
+	if (entry->serialized.empty()) return true;
+
+	auto N = make_shared<CGAL_Nef_polyhedron>(new CGAL_Nef_polyhedron3);
+	bool restored = true;
+	CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+	try {
+		std::istringstream stream(entry->serialized);
+		stream >> *N->p3;
+		restored = !stream.fail();
+	}
+	catch (const CGAL::Failure_exception &e) {
+		PRINTB("WARNING: CGAL error restoring cached polyhedron, evaluating it again: %s", e.what());
+		restored = false;
+	}
+	CGAL::set_error_behaviour(old_behaviour);
+	if (!restored) {
+		this->cache.remove(id);
+		return false;
+	}
+	N->setConvexity(entry->convexity);
+	entry->N = N;
+	entry->serialized.clear();
+	entry->serialized.shrink_to_fit();
+	return this->cache.setCost(id, N->memsize()) && this->cache.peek(id)->serialized.empty();
+}
+
+// Restoring a compacted entry may fail, which makes it a miss
+bool CGALCache::contains(const std::string &id) const
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->cache.contains(id) && restore(id);
 }
 
 shared_ptr<const CGAL_Nef_polyhedron> CGALCache::get(const std::string &id) const
 {
-	const auto &N = this->cache[id]->N;
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (!this->cache.contains(id) || !restore(id)) return nullptr;
+	const auto entry = this->cache[id];
+	if (!entry) return nullptr;
+	const auto &N = entry->N;
 #ifdef DEBUG
 	PRINTB("CGAL Cache hit: %s (%d bytes)", id.substr(0, 40) % (N ? N->memsize() : 0));
 #endif
 	return N;
 }
 
-bool CGALCache::insert(const std::string &id, const shared_ptr<const CGAL_Nef_polyhedron> &N)
+bool CGALCache::insert(const std::string &id, const shared_ptr<const CGAL_Nef_polyhedron> &N, double computetime)
 {
-	auto inserted = this->cache.insert(id, new cache_entry(N), N ? N->memsize() : 0);
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto inserted = this->cache.insert(id, new cache_entry(N), N ? N->memsize() : 0, computetime);
 #ifdef DEBUG
 	if (inserted) PRINTB("CGAL Cache insert: %s (%d bytes)", id.substr(0, 40) % (N ? N->memsize() : 0));
 	else PRINTB("CGAL Cache insert failed: %s (%d bytes)", id.substr(0, 40) % (N ? N->memsize() : 0));
@@ -29,27 +110,33 @@ bool CGALCache::insert(const std::string &id, const shared_ptr<const CGAL_Nef_po
 
 size_t CGALCache::maxSizeMB() const
 {
+	std::lock_guard<std::mutex> lock(this->mutex);
 	return this->cache.maxCost()/(1024*1024);
 }
 
 void CGALCache::setMaxSizeMB(size_t limit)
 {
+	std::lock_guard<std::mutex> lock(this->mutex);
 	this->cache.setMaxCost(limit*1024*1024);
 }
 
 void CGALCache::clear()
 {
+	std::lock_guard<std::mutex> lock(this->mutex);
 	cache.clear();
 }
 
 void CGALCache::print()
 {
+	std::lock_guard<std::mutex> lock(this->mutex);
 	PRINTB("CGAL Polyhedrons in cache: %d", this->cache.size());
 	PRINTB("CGAL cache size in bytes: %d", this->cache.totalCost());
+	PRINTB("CGAL cache hits: %d, evictions: %d", this->cache.hitCount() % this->cache.evictionCount());
+	PRINTB("CGAL cache compute time of cached polyhedrons: %.3f s", this->cache.totalBenefit());
 }
 
 CGALCache::cache_entry::cache_entry(const shared_ptr<const CGAL_Nef_polyhedron> &N)
-	: N(N)
+	: N(N), convexity(1)
 {
 	if (print_messages_stack.size() > 0) this->msg = print_messages_stack.back();
 }
@@ -2,8 +2,11 @@
 
 #include "cache.h"
 #include "memory.h"
+#include <mutex>
 
 /*!
+	Cache of Nef polyhedrons by node key. Like GeometryCache, every access
+	locks the cache, as the GUI renders in worker threads.
 */
 class CGALCache
 {
@@ -12,9 +15,10 @@ public:
 
 	static CGALCache *instance() { if (!inst) inst = new CGALCache; return inst; }
 
-	bool contains(const std::string &id) const { return this->cache.contains(id); }
+	bool contains(const std::string &id) const;
 	shared_ptr<const class CGAL_Nef_polyhedron> get(const std::string &id) const;
-	bool insert(const std::string &id, const shared_ptr<const CGAL_Nef_polyhedron> &N);
+	// computetime: Seconds it took to compute N; used to prioritize cache eviction
+	bool insert(const std::string &id, const shared_ptr<const CGAL_Nef_polyhedron> &N, double computetime = 0);
 	size_t maxSizeMB() const;
 	void setMaxSizeMB(size_t limit);
 	void clear();
@@ -25,10 +29,17 @@ private:
 
 	struct cache_entry {
 		shared_ptr<const CGAL_Nef_polyhedron> N;
+		// N in nef3 format, if the entry has been compacted, see compact()
+		std::string serialized;
+		unsigned int convexity;
 		std::string msg;
 		cache_entry(const shared_ptr<const CGAL_Nef_polyhedron> &N);
 		~cache_entry() { }
 	};
 
-	Cache<std::string, cache_entry> cache;
+	static size_t compact(cache_entry &entry);
+	bool restore(const std::string &id) const;
+
+	mutable std::mutex mutex;
+	mutable Cache<std::string, cache_entry> cache;
 };
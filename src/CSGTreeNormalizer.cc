@@ -3,6 +3,11 @@
 #include "CSGTreeNormalizer.h"
 #include "csgnode.h"
 #include "printutils.h"
+#include "parallel.h"
+
+// Minimum number of operation nodes below a top-level union before it's
+// worth normalizing its operands in parallel
+static const size_t PARALLEL_NORMALIZE_MIN_NODES = 256;
 
 // Helper function to debug normalization bugs
 #if 0
@@ -23,12 +28,49 @@ shared_ptr<CSGNode> CSGTreeNormalizer::normalize(const shared_ptr<CSGNode> &root
 {
 	this->aborted = false;
 	this->nodecount = 0;
-	shared_ptr<CSGNode> temp = root;
-	temp = normalizePass(temp);
+	shared_ptr<CSGNode> temp;
+	if (!normalizeParallel(root, temp)) temp = normalizePass(root);
+	this->normalized.clear();
 	this->rootnode.reset();
+	if (this->aborted) {
+		PRINTB("WARNING: Normalized tree is growing past %d elements. Aborting normalization.\n", this->limit);
+		return shared_ptr<CSGNode>();
+	}
 	return temp;
 }
 
+/*!
+	Counts a normalized node towards the limit.
+	Returns false and flags the normalization as aborted if the limit has been exceeded,
+	or if a normalizer working in parallel has aborted.
+*/
+bool CSGTreeNormalizer::incrementNodeCount()
+{
+	size_t count;
+	if (this->sharedstate) {
+		if (this->sharedstate->aborted) {
+			this->aborted = true;
+			return false;
+		}
+		count = ++this->sharedstate->nodecount;
+	}
+	else {
+		count = ++this->nodecount;
+	}
+	if (count > this->limit) {
+		this->aborted = true;
+		if (this->sharedstate) this->sharedstate->aborted = true;
+		return false;
+	}
+	return true;
+}
+
+void CSGTreeNormalizer::decrementNodeCount()
+{
+	if (this->sharedstate) this->sharedstate->nodecount--;
+	else this->nodecount--;
+}
+
 /*!
 	After aborting, a subtree might have become invalidated (nullptr child node)
 	since terms can be instantiated multiple times.
@@ -60,6 +102,86 @@ static bool hasLeftUnion(shared_ptr<CSGNode> node) {
 	return op && isUnion(op->left());
 }
 
+/*!
+	Normalizes the operands of a top-level union in parallel.
+
+	The operands of a union are normalized independently of each other, so
+	as long as they don't share any operation nodes (normalization rewrites
+	nodes in place), each of them can be given to a separate normalizer.
+	The node count limit is shared between all of them.
+
+	Returns false if the tree isn't suitable for parallel normalization,
+	in which case nothing has been modified.
+*/
+bool CSGTreeNormalizer::normalizeParallel(const shared_ptr<CSGNode> &root, shared_ptr<CSGNode> &result)
+{
+	if (parallel_thread_count() < 2 || !isUnion(root)) return false;
+
+	// Collect the slots holding the top-level union nodes in preorder,
+	// and the slots holding their non-union operands.
+	result = root;
+	std::vector<shared_ptr<CSGNode> *> spine;
+	std::vector<shared_ptr<CSGNode> *> operands;
+	std::unordered_map<const CSGNode *, size_t> owner;
+	std::stack<shared_ptr<CSGNode> *> todo;
+	todo.push(&result);
+	while (!todo.empty()) {
+		shared_ptr<CSGNode> *slot = todo.top();
+		todo.pop();
+		if (isUnion(*slot)) {
+			if (!owner.emplace(slot->get(), 0).second) return false;
+			spine.push_back(slot);
+			auto op = static_pointer_cast<CSGOperation>(*slot);
+			todo.push(&op->right());
+			todo.push(&op->left());
+		}
+		else if (dynamic_pointer_cast<CSGOperation>(*slot)) {
+			operands.push_back(slot);
+		}
+	}
+	if (operands.size() < 2) return false;
+
+	// Make sure no operation node is reachable from more than one operand
+	size_t opcount = spine.size();
+	std::stack<CSGNode *> nodes;
+	for (size_t i = 0; i < operands.size(); i++) {
+		nodes.push(operands[i]->get());
+		while (!nodes.empty()) {
+			auto op = dynamic_cast<CSGOperation *>(nodes.top());
+			nodes.pop();
+			if (!op) continue;
+			auto inserted = owner.emplace(op, i + 1);
+			if (!inserted.second) {
+				if (inserted.first->second != i + 1) return false;
+				continue;
+			}
+			opcount++;
+			nodes.push(op->left().get());
+			nodes.push(op->right().get());
+		}
+	}
+	if (opcount < PARALLEL_NORMALIZE_MIN_NODES) return false;
+
+	SharedState state;
+	state.nodecount = spine.size();
+	parallel_for_each_index(operands.size(), [&](size_t i) {
+		CSGTreeNormalizer normalizer(this->limit, &state);
+		*operands[i] = normalizer.normalizePass(*operands[i]);
+	});
+	this->nodecount = state.nodecount;
+	if (state.aborted) {
+		this->aborted = true;
+		result.reset();
+		return true;
+	}
+
+	// Children are after their parents in preorder, so collapse bottom-up
+	for (auto it = spine.rbegin(); it != spine.rend(); it++) {
+		**it = collapse_null_terms(**it);
+	}
+	return true;
+}
+
 shared_ptr<CSGNode> CSGTreeNormalizer::normalizePass(shared_ptr<CSGNode> node)
 {
 	// This function implements the CSG normalization
@@ -77,20 +199,30 @@ shared_ptr<CSGNode> CSGTreeNormalizer::normalizePass(shared_ptr<CSGNode> node)
 	// See Issue #2883 for problem with previous iterative implementation
 	// See Pull Request #2343 for the initial reasons for making this not recursive.
 
-	// stores current node and bool indicating if it was a left or right call;
-	typedef std::pair<shared_ptr<CSGOperation>, bool> stackframe_t;
+	// stores current node, bool indicating if it was a left or right call,
+	// and the child term before normalization (used to memoize the result)
+	struct stackframe_t {
+		shared_ptr<CSGOperation> parent;
+		bool left;
+		shared_ptr<CSGNode> term;
+		stackframe_t(const shared_ptr<CSGOperation> &parent, bool left, const shared_ptr<CSGNode> &term)
+			: parent(parent), left(left), term(term) {}
+	};
 	std::stack<stackframe_t> callstack;
 	
 entrypoint:
 	if (dynamic_pointer_cast<CSGLeaf>(node)) goto return_node;
+	{
+		// Shared subterm which has already been normalized
+		auto found = this->normalized.find(node);
+		if (found != this->normalized.end()) {
+			node = found->second;
+			goto return_node;
+		}
+	}
 	do {
 		while (node && match_and_replace(node)) {	}
-		this->nodecount++;
-		if (nodecount > this->limit) {
-			PRINTB("WARNING: Normalized tree is growing past %d elements. Aborting normalization.\n", this->limit);
-			this->aborted = true;
-			return shared_ptr<CSGNode>();
-		}
+		if (!incrementNodeCount()) return shared_ptr<CSGNode>();
 		if (!node || dynamic_pointer_cast<CSGLeaf>(node)) goto return_node;
 		goto normalize_left_if_op;
 cont_left: ;
@@ -114,19 +246,22 @@ return_node:
 	} else {
 		stackframe_t frame = callstack.top();
 		callstack.pop();
-		if (frame.second) { // came from a left call
-			frame.first->left() = node;
-			node = frame.first;
+		if (!this->aborted && dynamic_pointer_cast<CSGOperation>(frame.term)) {
+			this->normalized[frame.term] = node;
+		}
+		if (frame.left) { // came from a left call
+			frame.parent->left() = node;
+			node = frame.parent;
 			goto cont_left;
-		} else {            // came from a right call
-			frame.first->right() = node;
-			node = frame.first;
+		} else {          // came from a right call
+			frame.parent->right() = node;
+			node = frame.parent;
 			goto cont_right;
 		}
 	}
 normalize_left_if_op:
 	if (shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node)) {
-		callstack.emplace(op, true);
+		callstack.emplace(op, true, op->left());
 		node = op->left();
 		goto entrypoint;
 	}
@@ -134,7 +269,7 @@ normalize_left_if_op:
 normalize_right:
 	shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node);
 	assert(op);
-	callstack.emplace(op, false);
+	callstack.emplace(op, false, op->right());
 	node = op->right();
 	goto entrypoint;
 }
@@ -144,12 +279,12 @@ shared_ptr<CSGNode> CSGTreeNormalizer::collapse_null_terms(const shared_ptr<CSGN
 	shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node);
 	if (op) {
 		if (!op->right()) {
-			this->nodecount--;
+			decrementNodeCount();
 			if (op->getType() == OpenSCADOperator::UNION || op->getType() == OpenSCADOperator::DIFFERENCE) return op->left();
 			else return op->right();
 		}
 		if (!op->left()) {
-			this->nodecount--;
+			decrementNodeCount();
 			if (op->getType() == OpenSCADOperator::UNION) return op->right();
 			else return op->left();
 		}
@@ -1,24 +1,45 @@
 #pragma once
 
+#include <atomic>
+#include <unordered_map>
 #include "memory.h"
 
 class CSGTreeNormalizer
 {
 public:
-	CSGTreeNormalizer(size_t limit) : aborted(false), limit(limit), nodecount(0) {}
+	CSGTreeNormalizer(size_t limit) : aborted(false), limit(limit), nodecount(0), sharedstate(nullptr) {}
 	~CSGTreeNormalizer() {}
 
 	shared_ptr<class CSGNode> normalize(const shared_ptr<CSGNode> &term);
 
 private:
+	// Abort state and node count shared between normalizers working on
+	// independent subtrees in parallel
+	struct SharedState {
+		std::atomic<bool> aborted;
+		std::atomic<size_t> nodecount;
+		SharedState() : aborted(false), nodecount(0) {}
+	};
+	CSGTreeNormalizer(size_t limit, SharedState *sharedstate)
+		: aborted(false), limit(limit), nodecount(0), sharedstate(sharedstate) {}
+
+	bool normalizeParallel(const shared_ptr<CSGNode> &root, shared_ptr<CSGNode> &result);
 	shared_ptr<CSGNode> normalizePass(shared_ptr<CSGNode> term) ;
 	bool match_and_replace(shared_ptr<class CSGNode> &term);
 	shared_ptr<CSGNode> collapse_null_terms(const shared_ptr<CSGNode> &term);
 	shared_ptr<CSGNode> cleanup_term(shared_ptr<CSGNode> &t);
 	unsigned int count(const shared_ptr<CSGNode> &term) const;
+	bool incrementNodeCount();
+	void decrementNodeCount();
 
 	bool aborted;
 	size_t limit;
 	size_t nodecount;
+	SharedState *sharedstate;
+	// Normalized form of each operation subterm seen during this normalization.
+	// Subterms are shared between several parents when the rewrite rules
+	// duplicate an operand (e.g. x * (y + z) -> (x * y) + (x * z)),
+	// and need to be normalized only once.
+	std::unordered_map<shared_ptr<CSGNode>, shared_ptr<CSGNode>> normalized;
 	shared_ptr<class CSGNode> rootnode;
 };
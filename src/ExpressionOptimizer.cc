@@ -0,0 +1,258 @@
+#include "ExpressionOptimizer.h"
+#include "FileModule.h"
+#include "UserModule.h"
+#include "ModuleInstantiation.h"
+#include "function.h"
+#include "expression.h"
+#include "builtin.h"
+#include "builtincontext.h"
+#include "feature.h"
+#include "printutils.h"
+
+#include <typeinfo>
+#include <algorithm>
+
+namespace {
+	// Limits on what is evaluated while optimizing
+	const size_t FOLD_MAX_ITERATIONS = 10000;
+	const size_t FOLD_MAX_ELEMENTS = 10000;
+
+	// Constants of the root context, see BuiltinContext
+	bool is_constant(const std::string &name)
+	{
+		return name == "PI";
+	}
+
+	bool is_special_variable(const std::string &name)
+	{
+		return !name.empty() && name[0] == '$';
+	}
+
+	size_t num_values(const Value &value)
+	{
+		switch (value.type()) {
+		case Value::ValueType::RANGE:
+			return value.toRange().numValues();
+		case Value::ValueType::VECTOR:
+			return value.toVector().size();
+		case Value::ValueType::STRING:
+			return value.toString().size();
+		default:
+			return 1;
+		}
+	}
+
+	// Returns false if the value has too many elements to keep in the AST
+	bool count_elements(const Value &value, size_t &numElements)
+	{
+		if (++numElements > FOLD_MAX_ELEMENTS) return false;
+		if (value.type() == Value::ValueType::VECTOR) {
+			for (const auto &e : value.toVector()) {
+				if (!count_elements(*e, numElements)) return false;
+			}
+		}
+		return true;
+	}
+}
+
+void ExpressionOptimizer::optimize(FileModule &module)
+{
+	if (!Feature::ExperimentalConstantFolding.is_enabled()) return;
+	ExpressionOptimizer optimizer(module);
+	optimizer.optimize(module.scope);
+}
+
+ExpressionOptimizer::ExpressionOptimizer(const FileModule &module) : usesLibraries(module.usesLibraries())
+{
+	ReferenceCollector refs;
+	collectNames(module.scope, refs);
+	this->assignedNames = std::move(refs.assignedNames);
+}
+
+ExpressionOptimizer::~ExpressionOptimizer()
+{
+}
+
+void ExpressionOptimizer::collectNames(const LocalScope &scope, ReferenceCollector &refs)
+{
+	refs.collect(scope.assignments);
+	for (const auto child : scope.children) {
+		refs.collect(child->arguments);
+		collectNames(child->scope, refs);
+		if (auto ifelse = dynamic_cast<const IfElseModuleInstantiation *>(child)) collectNames(ifelse->else_scope, refs);
+	}
+	for (const auto &f : scope.astFunctions) {
+		this->definedFunctions.insert(f.first);
+		refs.collect(f.second->definition_arguments);
+		refs.collect(f.second->expr);
+	}
+	for (const auto &m : scope.astModules) {
+		refs.collect(m.second->definition_arguments);
+		collectNames(m.second->scope, refs);
+	}
+}
+
+void ExpressionOptimizer::optimize(LocalScope &scope)
+{
+	optimize(scope.assignments);
+	for (auto child : scope.children) {
+		optimize(child->arguments);
+		optimize(child->scope);
+		if (auto ifelse = dynamic_cast<IfElseModuleInstantiation *>(child)) optimize(ifelse->else_scope);
+	}
+	for (const auto &f : scope.astFunctions) {
+		optimize(f.second->definition_arguments);
+		optimize(f.second->expr);
+	}
+	for (const auto &m : scope.astModules) {
+		optimize(m.second->definition_arguments);
+		optimize(m.second->scope);
+	}
+}
+
+void ExpressionOptimizer::optimize(shared_ptr<Expression> &expr, bool conditional)
+{
+	if (!expr) return;
+	if (conditional) {
+		this->conditional++;
+		if (!this->loops.empty()) this->loops.back().conditional++;
+	}
+
+	// Hoist the largest subexpressions possible, not their parts
+	bool hoist = isHoistable(expr);
+	if (hoist) this->loops.back().suspended++;
+
+	bool expensive = this->expensive;
+	this->expensive = false;
+	expr->optimize(*this);
+	bool folded = !this->expensive && this->conditional == 0 && fold(expr);
+	this->expensive = this->expensive || expensive;
+
+	if (hoist) {
+		auto &loop = this->loops.back();
+		loop.suspended--;
+		if (!folded) {
+			// Not a valid variable name, so it can't hide any
+			std::string name = "#" + std::to_string(this->numHoisted++);
+			loop.hoisted->emplace_back(name, expr);
+			expr = make_shared<HoistedLookup>(name, expr);
+		}
+	}
+	if (conditional) {
+		this->conditional--;
+		if (!this->loops.empty()) this->loops.back().conditional--;
+	}
+}
+
+void ExpressionOptimizer::optimize(AssignmentList &assignments, bool conditional)
+{
+	for (auto &assignment : assignments) optimize(assignment.expr, conditional);
+}
+
+void ExpressionOptimizer::optimizeSequentially(AssignmentList &assignments, bool conditional)
+{
+	for (auto &assignment : assignments) {
+		optimize(assignment.expr, conditional);
+		bind(assignment.name);
+	}
+}
+
+void ExpressionOptimizer::optimizeLoop(AssignmentList &arguments, shared_ptr<Expression> &expr, AssignmentList &hoisted)
+{
+	optimize(arguments);
+	// Only loops over a few constant values are evaluated while optimizing.
+	// The body of a nested loop runs for every iteration of the enclosing
+	// loops, so they share the budget.
+	size_t iterations = this->loops.empty() ? 1 : this->loops.back().iterations;
+	for (const auto &arg : arguments) {
+		size_t values = arg.expr && typeid(*arg.expr) == typeid(Literal) ?
+			num_values(*arg.expr->evaluate(nullptr)) : FOLD_MAX_ITERATIONS + 1;
+		iterations = std::min(iterations * std::min(values, FOLD_MAX_ITERATIONS + 1), FOLD_MAX_ITERATIONS + 1);
+	}
+	if (iterations > FOLD_MAX_ITERATIONS) {
+		preventFolding();
+		// Neither this loop nor the enclosing ones are evaluated then, so the
+		// body starts over
+		iterations = 1;
+	}
+
+	size_t numBound = this->bound.size();
+	for (const auto &arg : arguments) bind(arg.name);
+	hoisted.clear();
+	this->loops.push_back({numBound, &hoisted, iterations, 0, 0});
+	optimize(expr);
+	this->loops.pop_back();
+	unbind(numBound);
+}
+
+/*!
+	Replaces the given expression by its value, if it only depends on
+	literals, constants and pure builtin functions, and can be evaluated
+	without printing anything. Functions defined in the file or in used
+	libraries may hide the builtins, and so can assignments the constants.
+*/
+bool ExpressionOptimizer::fold(shared_ptr<Expression> &expr)
+{
+	// List comprehensions are flattened into the enclosing vector
+	if (typeid(*expr) == typeid(Literal) || dynamic_cast<const ListComprehension *>(expr.get())) return false;
+
+	ReferenceCollector refs;
+	refs.collect(expr);
+	if (refs.sideEffects) return false;
+	for (const auto &variable : refs.variables) {
+		if (!is_constant(variable) || this->assignedNames.count(variable)) return false;
+	}
+	for (const auto &function : refs.functions) {
+		if (this->usesLibraries || this->definedFunctions.count(function) || !Builtins::isPureFunction(function)) return false;
+	}
+
+	// Printing throws on worker threads, see check_worker_thread()
+	if (!this->context) this->context.reset(new BuiltinContext);
+	bool worker = is_worker_thread();
+	set_worker_thread(true);
+	ValuePtr value;
+	try {
+		value = expr->evaluate(this->context.get());
+	}
+	catch (...) {
+		set_worker_thread(worker);
+		return false;
+	}
+	set_worker_thread(worker);
+
+	size_t numElements = 0;
+	if (!count_elements(*value, numElements)) return false;
+	// Formatting large values takes a while, so only when needed
+	if (OpenSCAD::debug != "") {
+		PRINTDB("Line %d: folded %s to %s", expr->location().firstLine() % *expr % value->toEchoString());
+	}
+	expr = make_shared<Literal>(value, expr);
+	return true;
+}
+
+/*!
+	Whether the given expression is evaluated with every iteration of the
+	innermost enclosing loop, but doesn't depend on the names bound within
+	it. Functions see the special variables of their callers, so they may
+	depend on the loop when it binds special variables.
+*/
+bool ExpressionOptimizer::isHoistable(const shared_ptr<Expression> &expr) const
+{
+	if (this->loops.empty()) return false;
+	const auto &loop = this->loops.back();
+	if (loop.conditional > 0 || loop.suspended > 0) return false;
+	// Nothing to gain for single lookups, and list comprehensions are
+	// flattened into the enclosing vector
+	if (typeid(*expr) == typeid(Literal) || typeid(*expr) == typeid(Lookup) || typeid(*expr) == typeid(HoistedLookup) ||
+			dynamic_cast<const ListComprehension *>(expr.get())) return false;
+
+	ReferenceCollector refs;
+	refs.collect(expr);
+	if (refs.sideEffects) return false;
+	bool special = false;
+	for (size_t i = loop.firstBound; i < this->bound.size(); i++) {
+		if (refs.variables.count(this->bound[i])) return false;
+		if (is_special_variable(this->bound[i])) special = true;
+	}
+	return !special || refs.functions.empty();
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_set>
+#include "memory.h"
+#include "Assignment.h"
+
+class FileModule;
+class LocalScope;
+class Expression;
+class BuiltinContext;
+
+/*!
+	Simplifies the expressions of a parsed file, if the constant-folding
+	feature is enabled:
+
+	- Constant subexpressions, which only use literals, PI and pure builtin
+	  functions, are evaluated once and replaced by a Literal.
+	- Subexpressions of list comprehension for loop bodies which don't depend
+	  on the loop are replaced by a HoistedLookup, so they are evaluated once
+	  per loop instead of once per element.
+
+	Replaced expressions are still printed and serialized as written.
+	Anything whose evaluation would print a message is left alone, so
+	messages stay the same, and so are conditional expressions, which might
+	never be evaluated otherwise.
+*/
+class ExpressionOptimizer
+{
+public:
+	static void optimize(FileModule &module);
+
+	// Called by the overrides of Expression::optimize(). Conditional
+	// expressions aren't always evaluated when their parent is.
+	void optimize(shared_ptr<Expression> &expr, bool conditional = false);
+	void optimize(AssignmentList &assignments, bool conditional = false);
+	// Optimizes the expressions of the given assignments, with the names of the
+	// assignments bound when optimizing the ones following them
+	void optimizeSequentially(AssignmentList &assignments, bool conditional = false);
+	void optimizeLoop(AssignmentList &arguments, shared_ptr<Expression> &expr, AssignmentList &hoisted);
+	// Keeps enclosing expressions from being evaluated while optimizing, for
+	// loops which might take long
+	void preventFolding() { this->expensive = true; }
+
+	// Names bound by enclosing expressions, like in ReferenceCollector
+	size_t numBound() const { return this->bound.size(); }
+	void bind(const std::string &name) { this->bound.push_back(name); }
+	void unbind(size_t numBound) { this->bound.resize(numBound); }
+
+private:
+	ExpressionOptimizer(const FileModule &module);
+	~ExpressionOptimizer();
+
+	void optimize(LocalScope &scope);
+	void collectNames(const LocalScope &scope, class ReferenceCollector &refs);
+	bool fold(shared_ptr<Expression> &expr);
+	bool isHoistable(const shared_ptr<Expression> &expr) const;
+
+	// Names the file assigns anywhere, including parameters and named arguments,
+	// and functions it defines anywhere. Those can't be resolved up front.
+	std::unordered_set<std::string> assignedNames;
+	std::unordered_set<std::string> definedFunctions;
+	bool usesLibraries;
+
+	// For evaluating constants, created when first needed
+	std::unique_ptr<BuiltinContext> context;
+	// Whether the last optimized expression must not be evaluated
+	bool expensive = false;
+	// Depth of conditional expressions, see optimize()
+	int conditional = 0;
+	std::vector<std::string> bound;
+
+	// Enclosing list comprehension for loops, innermost last
+	struct Loop {
+		size_t firstBound; // Names bound within the loop start here
+		AssignmentList *hoisted;
+		size_t iterations; // Of the loop body, counting those of enclosing loops
+		int conditional; // Depth of conditional expressions within the loop body
+		int suspended; // Depth of expressions about to be hoisted themselves
+	};
+	std::vector<Loop> loops;
+	size_t numHoisted = 0;
+};
@@ -27,17 +27,24 @@
 #include "FileModule.h"
 #include "ModuleCache.h"
 #include "node.h"
+#include "ModuleInstantiation.h"
 #include "printutils.h"
 #include "exceptions.h"
 #include "modcontext.h"
 #include "parsersettings.h"
 #include "StatCache.h"
+#include "handle_dep.h"
 #include "evalcontext.h"
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include "boost-utils.h"
 namespace fs = boost::filesystem;
 #include "FontCache.h"
+#include "ASTCache.h"
+#include "builtin.h"
+#include "expression.h"
+#include "function.h"
+#include "UserModule.h"
 #include <sys/stat.h>
 
 FileModule::FileModule(const std::string &path, const std::string &filename)
@@ -54,6 +61,40 @@ void FileModule::print(std::ostream &stream, const std::string &indent) const
 	scope.print(stream, indent);
 }
 
+/*!
+	Writes the parsed file to an on-disk AST cache, see ASTCache::load() for
+	the reverse.
+*/
+void FileModule::serialize(ASTWriter &writer) const
+{
+	writer.write(this->path);
+	writer.write(this->filename);
+	writer.write(this->scope);
+
+	writer.write(int64_t(this->usedlibs.size()));
+	for (const auto &lib : this->usedlibs) writer.write(lib);
+	writer.write(int64_t(this->usedfonts.size()));
+	for (const auto &font : this->usedfonts) writer.write(font);
+	writer.write(int64_t(this->includes.size()));
+	// The modification time and size of each include identify the version
+	// whose contents were parsed into the scope, or -1 if it doesn't exist
+	for (const auto &include : this->includes) {
+		writer.write(include.first);
+		writer.write(include.second.filename);
+		struct stat st;
+		bool exists = StatCache::stat(include.second.filename.c_str(), st) == 0;
+		writer.write(int64_t(exists ? st.st_mtime : -1));
+		writer.write(int64_t(exists ? st.st_size : -1));
+	}
+	writer.write(int64_t(this->indicatorData.size()));
+	for (const auto &data : this->indicatorData) {
+		writer.write(int64_t(data.linenr));
+		writer.write(int64_t(data.colnr));
+		writer.write(int64_t(data.nrofchar));
+		writer.write(data.path);
+	}
+}
+
 void FileModule::registerUse(const std::string path, const Location &loc)
 {
 	PRINTDB("registerUse(): (%p) %d, %d - %d, %d (%s) -> %s", this %
@@ -66,7 +107,10 @@ void FileModule::registerUse(const std::string path, const Location &loc)
 
 	if (boost::iequals(ext, ".otf") || boost::iequals(ext, ".ttf")) {
 		if (fs::is_regular(path)) {
+			// The font cache is shared, see ModuleCache::prefetch()
+			check_worker_thread();
 			FontCache::instance()->register_font_file(path);
+			usedfonts.insert(path);
 		} else {
 			PRINTB("ERROR: Can't read font with path '%s'", path);
 		}
@@ -103,10 +147,16 @@ time_t FileModule::includesChanged() const
 }
 
 time_t FileModule::include_modified(const IncludeFile &inc) const
+{
+	return file_modified(inc.filename);
+}
+
+// Returns the modification time of the given file, or 0 if it doesn't exist
+time_t FileModule::file_modified(const std::string &filename)
 {
 	struct stat st;
 
-	if (StatCache::stat(inc.filename.c_str(), st) == 0) {
+	if (StatCache::stat(filename.c_str(), st) == 0) {
 		return st.st_mtime;
 	}
 	
@@ -130,7 +180,7 @@ time_t FileModule::handleDependencies(bool is_root)
 	// If a lib in usedlibs was previously missing, we need to relocate it
 	// by searching the applicable paths. We can identify a previously missing module
 	// as it will have a relative path.
-	time_t latest = 0;
+	std::vector<std::string> libs;
 	for (auto filename : this->usedlibs) {
 
 		auto found = true;
@@ -148,20 +198,26 @@ time_t FileModule::handleDependencies(bool is_root)
 			}
 		}
 
-		if (found) {
-			auto oldmodule = ModuleCache::instance()->lookup(filename);
-			FileModule *newmodule;
-			auto mtime = ModuleCache::instance()->evaluate(this->getFullpath(),filename, newmodule);
-			if (mtime > latest) latest = mtime;
-			auto changed = newmodule && newmodule != oldmodule;
-			// Detect appearance but not removal of files, and keep old module
-			// on compile errors (FIXME: Is this correct behavior?)
-			if (changed) {
-				PRINTDB("  %s: %p -> %p", filename % oldmodule % newmodule);
-			}
-			else {
-				PRINTDB("  %s: %p", filename % oldmodule);
-			}
+		if (found) libs.push_back(filename);
+	}
+
+	// Parse the libraries needing it up front, all at once
+	ModuleCache::instance()->prefetch(this->getFullpath(), libs);
+
+	time_t latest = 0;
+	for (const auto &filename : libs) {
+		auto oldmodule = ModuleCache::instance()->lookup(filename);
+		FileModule *newmodule;
+		auto mtime = ModuleCache::instance()->evaluate(this->getFullpath(),filename, newmodule);
+		if (mtime > latest) latest = mtime;
+		auto changed = newmodule && newmodule != oldmodule;
+		// Detect appearance but not removal of files, and keep old module
+		// on compile errors (FIXME: Is this correct behavior?)
+		if (changed) {
+			PRINTDB("  %s: %p -> %p", filename % oldmodule % newmodule);
+		}
+		else {
+			PRINTDB("  %s: %p", filename % oldmodule);
 		}
 	}
 
@@ -182,19 +238,173 @@ AbstractNode *FileModule::instantiate(const Context *ctx, const ModuleInstantiat
 	return this->instantiateWithFileContext(&context, inst, evalctx);
 }
 
+namespace {
+	/*!
+		Decides whether instantiating a top level statement can print messages or
+		give different results each time, through echo(), assert() or impure
+		builtin functions, including within the modules and functions it calls.
+		Those are resolved within the enclosing scopes. Modules and functions
+		which aren't found there, like those of used libraries, aren't analyzed,
+		so they are assumed to be impure.
+		Use a new checker for each statement, as calls are only followed once.
+	*/
+	class PurityChecker
+	{
+	public:
+		PurityChecker(const LocalScope &filescope) { this->scopes.push_back(&filescope); }
+
+		bool isPure(const ModuleInstantiation &inst) {
+			// The children are instantiated in the scope of the instantiation
+			if (!isPure(inst.arguments) || !isPure(inst.scope)) return false;
+			if (auto ifelse = dynamic_cast<const IfElseModuleInstantiation *>(&inst)) {
+				if (!isPure(ifelse->else_scope)) return false;
+			}
+			for (auto scope = this->scopes.rbegin(); scope != this->scopes.rend(); ++scope) {
+				auto module = (*scope)->modules.find(inst.name());
+				if (module == (*scope)->modules.end()) continue;
+				if (!this->visited.insert(module->second).second) return true;
+				this->scopes.push_back(&module->second->scope);
+				bool pure = isPure(module->second->definition_arguments) && isPure(module->second->scope);
+				this->scopes.pop_back();
+				return pure;
+			}
+			return Builtins::isPureModule(inst.name());
+		}
+
+	private:
+		bool isPure(const LocalScope &scope) {
+			this->scopes.push_back(&scope);
+			bool pure = isPure(scope.assignments);
+			for (const auto child : scope.children) {
+				if (!pure) break;
+				pure = isPure(*child);
+			}
+			this->scopes.pop_back();
+			return pure;
+		}
+
+		bool isPure(const AssignmentList &assignments) {
+			ReferenceCollector refs;
+			refs.collect(assignments);
+			return isPure(refs);
+		}
+
+		bool isPure(const ReferenceCollector &refs) {
+			if (refs.sideEffects) return false;
+			for (const auto &name : refs.functions) {
+				if (!isPureFunction(name)) return false;
+			}
+			return true;
+		}
+
+		bool isPureFunction(const std::string &name) {
+			for (auto scope = this->scopes.rbegin(); scope != this->scopes.rend(); ++scope) {
+				auto function = (*scope)->functions.find(name);
+				if (function == (*scope)->functions.end()) continue;
+				if (!this->visited.insert(function->second).second) return true;
+				ReferenceCollector refs;
+				refs.collect(function->second->definition_arguments);
+				refs.collect(function->second->expr);
+				return isPure(refs);
+			}
+			return Builtins::isPureFunction(name);
+		}
+
+		std::vector<const LocalScope *> scopes;
+		std::unordered_set<const void *> visited;
+	};
+}
+
+/*!
+	Instantiates this file in the given context.
+
+	If toplevel is given, it receives the node of each top level module
+	instantiation along with the variables and files it depends on. If it
+	already holds those of a previous instantiation of this module, nodes whose
+	variables still have the same values, and whose files haven't been
+	modified, are reused instead of being instantiated again. Statements which
+	printed messages or may have side effects, see PurityChecker, are always
+	instantiated again, so they print the same as a fresh instantiation.
+	Reused nodes become children of the returned root, so the caller must
+	remove them from the previous root before deleting it.
+*/
 AbstractNode *FileModule::instantiateWithFileContext(FileContext *ctx, const ModuleInstantiation *inst,
-																										 EvalContext *evalctx) const
+																										 EvalContext *evalctx, TopLevelNodes *toplevel) const
 {
 	assert(evalctx == nullptr);
 	
 	auto node = new RootNode(inst);
+	if (!toplevel) {
+		try {
+			ctx->initializeModule(*this); // May throw an ExperimentalFeatureException
+			// FIXME: Set document path to the path of the module
+			auto instantiatednodes = this->scope.instantiateChildren(ctx);
+			node->children.insert(node->children.end(), instantiatednodes.begin(), instantiatednodes.end());
+		} catch (EvaluationException &e) {
+			//PRINT(e.what()); //please output the message before throwing the exception
+		}
+		return node;
+	}
+
+	TopLevelNodes previous;
+	previous.swap(*toplevel);
+	if (previous.size() != this->scope.children.size()) previous.clear();
+
+	// Top level variables are looked up in ctx, special variables like $t
+	// may also be found in its parent
+	const Context *rootctx = ctx->getParent();
 	try {
 		ctx->initializeModule(*this); // May throw an ExperimentalFeatureException
-		// FIXME: Set document path to the path of the module
-		auto instantiatednodes = this->scope.instantiateChildren(ctx);
-		node->children.insert(node->children.end(), instantiatednodes.begin(), instantiatednodes.end());
+		for (size_t i = 0; i < this->scope.children.size(); i++) {
+			if (!previous.empty() && previous[i].pure) {
+				bool unchanged = true;
+				for (const auto &lookup : previous[i].lookups) {
+					if (ctx->lookup_variable(lookup.first, true) != lookup.second) {
+						unchanged = false;
+						break;
+					}
+				}
+				for (const auto &file : previous[i].files) {
+					if (!unchanged || file_modified(file.first) != file.second) {
+						unchanged = false;
+						break;
+					}
+				}
+				if (unchanged) {
+					if (previous[i].node) node->children.push_back(previous[i].node);
+					toplevel->push_back(std::move(previous[i]));
+					continue;
+				}
+			}
+
+			TopLevelNode instantiated;
+			std::unordered_set<std::string> files;
+			ctx->setLookupRecorder(&instantiated.lookups);
+			if (rootctx) rootctx->setLookupRecorder(&instantiated.lookups);
+			set_dep_recorder(&files);
+			print_messages_push();
+			try {
+				instantiated.node = this->scope.children[i]->evaluate(ctx);
+			} catch (...) {
+				ctx->setLookupRecorder(nullptr);
+				if (rootctx) rootctx->setLookupRecorder(nullptr);
+				set_dep_recorder(nullptr);
+				print_messages_pop();
+				throw;
+			}
+			ctx->setLookupRecorder(nullptr);
+			if (rootctx) rootctx->setLookupRecorder(nullptr);
+			set_dep_recorder(nullptr);
+			// Warnings, like those about unknown variables, must be repeated as well
+			instantiated.pure = print_messages_stack.back().empty() &&
+				PurityChecker(this->scope).isPure(*this->scope.children[i]);
+			print_messages_pop();
+			for (const auto &file : files) instantiated.files.emplace(file, file_modified(file));
+			if (instantiated.node) node->children.push_back(instantiated.node);
+			toplevel->push_back(std::move(instantiated));
+		}
 	} catch (EvaluationException &e) {
-		//PRINT(e.what()); //please output the message before throwing the exception
+		// toplevel stays incomplete, so it won't be reused
 	}
 
 	return node;
@@ -18,7 +18,20 @@ public:
 
 	AbstractNode *instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx = nullptr) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
-	AbstractNode *instantiateWithFileContext(class FileContext *ctx, const ModuleInstantiation *inst, EvalContext *evalctx) const;
+	void serialize(class ASTWriter &writer) const;
+	// The node instantiated from a top level module instantiation (or nullptr),
+	// the top level and special variables it looked up, with their values, and
+	// the files it depends on, like imported files, with their modification times.
+	// Only pure nodes, which didn't print anything and have no side effects, are reused.
+	struct TopLevelNode {
+		AbstractNode *node = nullptr;
+		bool pure = false;
+		std::unordered_map<std::string, ValuePtr> lookups;
+		std::unordered_map<std::string, time_t> files;
+	};
+	typedef std::vector<TopLevelNode> TopLevelNodes;
+	AbstractNode *instantiateWithFileContext(class FileContext *ctx, const ModuleInstantiation *inst, EvalContext *evalctx,
+																					 TopLevelNodes *toplevel = nullptr) const;
 
 	void setModulePath(const std::string &path) { this->path = path; }
 	const std::string &modulePath() const { return this->path; }
@@ -36,6 +49,7 @@ public:
 	LocalScope scope;
 	typedef std::unordered_set<std::string> ModuleContainer;
 	ModuleContainer usedlibs;
+	ModuleContainer usedfonts;
 
 	std::vector<IndicatorData> indicatorData;
 
@@ -45,6 +59,7 @@ private:
 	};
 
 	std::time_t include_modified(const IncludeFile &inc) const;
+	static std::time_t file_modified(const std::string &filename);
 
 	typedef std::unordered_map<std::string, struct IncludeFile> IncludeContainer;
 	IncludeContainer includes;
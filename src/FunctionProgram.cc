@@ -0,0 +1,597 @@
+#include "FunctionProgram.h"
+#include "function.h"
+#include "modcontext.h"
+#include "builtin.h"
+#include "degree_trig.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace {
+	// Deeper recursion is left to the AST, which reports it as an error
+	// where the stack check fails
+	const size_t MAX_FRAMES = 1000;
+	// Same limit as in UserFunction::evaluate()
+	const unsigned int MAX_TAIL_CALLS = 1000000;
+
+	bool type_of(const Value &value, FunctionCompiler::Type &type)
+	{
+		switch (value.type()) {
+		case Value::ValueType::NUMBER:
+			type = FunctionCompiler::Type::Number;
+			return true;
+		case Value::ValueType::BOOL:
+			type = FunctionCompiler::Type::Bool;
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// Gets a number or boolean argument of the given type
+	bool get_number(const Value &value, bool isBool, double &number)
+	{
+		if (isBool) {
+			if (value.type() != Value::ValueType::BOOL) return false;
+			number = value.toBool() ? 1 : 0;
+		}
+		else {
+			if (value.type() != Value::ValueType::NUMBER) return false;
+			number = value.toDouble();
+		}
+		return true;
+	}
+
+	// Builtin functions with a fixed number of number arguments
+	struct BuiltinOp {
+		const char *name;
+		FunctionProgram::OpCode op;
+		size_t numArgs;
+	};
+	const BuiltinOp builtin_ops[] = {
+		{"abs", FunctionProgram::OpCode::Abs, 1},
+		{"sign", FunctionProgram::OpCode::Sign, 1},
+		{"sin", FunctionProgram::OpCode::Sin, 1},
+		{"cos", FunctionProgram::OpCode::Cos, 1},
+		{"tan", FunctionProgram::OpCode::Tan, 1},
+		{"asin", FunctionProgram::OpCode::Asin, 1},
+		{"acos", FunctionProgram::OpCode::Acos, 1},
+		{"atan", FunctionProgram::OpCode::Atan, 1},
+		{"atan2", FunctionProgram::OpCode::Atan2, 2},
+		{"pow", FunctionProgram::OpCode::Pow, 2},
+		{"sqrt", FunctionProgram::OpCode::Sqrt, 1},
+		{"exp", FunctionProgram::OpCode::Exp, 1},
+		{"ln", FunctionProgram::OpCode::Ln, 1},
+		{"log", FunctionProgram::OpCode::Log, 1},
+		{"log", FunctionProgram::OpCode::LogBase, 2},
+		{"floor", FunctionProgram::OpCode::Floor, 1},
+		{"ceil", FunctionProgram::OpCode::Ceil, 1},
+		{"round", FunctionProgram::OpCode::Round, 1}
+	};
+}
+
+std::unique_ptr<FunctionProgram> FunctionProgram::compile(const UserFunction &function, const Context *ctx, const Context &args)
+{
+	// Only functions defined at the top level of a file are compiled. They are
+	// always called in the context of their file, whose parent holds just the
+	// builtins, so the functions they call can be resolved once.
+	auto filectx = dynamic_cast<const FileContext *>(ctx);
+	if (!filectx || !filectx->functions_p || !ctx->getParent() || ctx->getParent()->getParent()) return nullptr;
+	auto found = filectx->functions_p->find(function.name);
+	if (found == filectx->functions_p->end() || found->second != &function) return nullptr;
+
+	std::unique_ptr<FunctionProgram> program(new FunctionProgram);
+	FunctionCompiler compiler(*program, function, filectx);
+	if (!compiler.compileFunction(args)) return nullptr;
+	return program;
+}
+
+FunctionProgram::Status FunctionProgram::run(const Context *ctx, const Context &args, ValuePtr &result) const
+{
+	std::vector<double> stack(4 * this->frameSize);
+	for (size_t i = 0; i < this->parameters.size(); i++) {
+		if (!get_number(*args.lookup_variable(this->parameters[i], true), this->parameterIsBool[i], stack[i])) return Status::Unsupported;
+	}
+	std::vector<double> globalValues(this->globals.size());
+	for (size_t i = 0; i < this->globals.size(); i++) {
+		if (!get_number(*ctx->lookup_variable(this->globals[i], true), this->globalIsBool[i], globalValues[i])) return Status::Unsupported;
+	}
+
+	struct Frame {
+		size_t pc;
+		size_t base;
+		unsigned int tailCalls;
+	};
+	std::vector<Frame> frames;
+	double *s = stack.data();
+	size_t pc = 0, base = 0, sp = this->numSlots;
+	unsigned int tailCalls = 0;
+	while (true) {
+		const Instruction &instr = this->code[pc++];
+		switch (instr.op) {
+		case OpCode::Constant:
+			s[sp++] = instr.value;
+			break;
+		case OpCode::Load:
+			s[sp++] = s[base + instr.arg];
+			break;
+		case OpCode::LoadGlobal:
+			s[sp++] = globalValues[instr.arg];
+			break;
+		case OpCode::Store:
+			s[base + instr.arg] = s[--sp];
+			break;
+		case OpCode::Negate:
+			s[sp - 1] = -s[sp - 1];
+			break;
+		case OpCode::Not:
+			s[sp - 1] = s[sp - 1] == 0 ? 1 : 0;
+			break;
+		case OpCode::ToBool:
+			s[sp - 1] = s[sp - 1] != 0 ? 1 : 0;
+			break;
+		case OpCode::Add:
+			sp--;
+			s[sp - 1] = s[sp - 1] + s[sp];
+			break;
+		case OpCode::Subtract:
+			sp--;
+			s[sp - 1] = s[sp - 1] - s[sp];
+			break;
+		case OpCode::Multiply:
+			sp--;
+			s[sp - 1] = s[sp - 1] * s[sp];
+			break;
+		case OpCode::Divide:
+			sp--;
+			s[sp - 1] = s[sp - 1] / s[sp];
+			break;
+		case OpCode::Modulo:
+			sp--;
+			s[sp - 1] = fmod(s[sp - 1], s[sp]);
+			break;
+		case OpCode::Less:
+			sp--;
+			s[sp - 1] = s[sp - 1] < s[sp] ? 1 : 0;
+			break;
+		case OpCode::LessEqual:
+			sp--;
+			s[sp - 1] = s[sp - 1] <= s[sp] ? 1 : 0;
+			break;
+		case OpCode::Greater:
+			sp--;
+			s[sp - 1] = s[sp - 1] > s[sp] ? 1 : 0;
+			break;
+		case OpCode::GreaterEqual:
+			sp--;
+			s[sp - 1] = s[sp - 1] >= s[sp] ? 1 : 0;
+			break;
+		case OpCode::Equal:
+			sp--;
+			s[sp - 1] = s[sp - 1] == s[sp] ? 1 : 0;
+			break;
+		case OpCode::NotEqual:
+			sp--;
+			s[sp - 1] = s[sp - 1] != s[sp] ? 1 : 0;
+			break;
+		case OpCode::Jump:
+			pc = instr.arg;
+			break;
+		case OpCode::JumpIfFalse:
+			if (s[--sp] == 0) pc = instr.arg;
+			break;
+		case OpCode::JumpIfTrue:
+			if (s[--sp] != 0) pc = instr.arg;
+			break;
+		case OpCode::Abs:
+			s[sp - 1] = std::fabs(s[sp - 1]);
+			break;
+		case OpCode::Sign: {
+			double x = s[sp - 1];
+			s[sp - 1] = (x < 0) ? -1.0 : ((x > 0) ? 1.0 : 0.0);
+			break;
+		}
+		case OpCode::Sin:
+			s[sp - 1] = sin_degrees(s[sp - 1]);
+			break;
+		case OpCode::Cos:
+			s[sp - 1] = cos_degrees(s[sp - 1]);
+			break;
+		case OpCode::Tan:
+			s[sp - 1] = tan_degrees(s[sp - 1]);
+			break;
+		case OpCode::Asin:
+			s[sp - 1] = asin_degrees(s[sp - 1]);
+			break;
+		case OpCode::Acos:
+			s[sp - 1] = acos_degrees(s[sp - 1]);
+			break;
+		case OpCode::Atan:
+			s[sp - 1] = atan_degrees(s[sp - 1]);
+			break;
+		case OpCode::Atan2:
+			sp--;
+			s[sp - 1] = atan2_degrees(s[sp - 1], s[sp]);
+			break;
+		case OpCode::Pow:
+			sp--;
+			s[sp - 1] = pow(s[sp - 1], s[sp]);
+			break;
+		case OpCode::Sqrt:
+			s[sp - 1] = sqrt(s[sp - 1]);
+			break;
+		case OpCode::Exp:
+			s[sp - 1] = exp(s[sp - 1]);
+			break;
+		case OpCode::Ln:
+			s[sp - 1] = log(s[sp - 1]);
+			break;
+		case OpCode::Log:
+			s[sp - 1] = log(s[sp - 1]) / log(10.0);
+			break;
+		case OpCode::LogBase:
+			sp--;
+			s[sp - 1] = log(s[sp]) / log(s[sp - 1]);
+			break;
+		case OpCode::Floor:
+			s[sp - 1] = floor(s[sp - 1]);
+			break;
+		case OpCode::Ceil:
+			s[sp - 1] = ceil(s[sp - 1]);
+			break;
+		case OpCode::Round:
+			s[sp - 1] = round(s[sp - 1]);
+			break;
+		case OpCode::Min:
+		case OpCode::Max: {
+			sp -= instr.arg;
+			double val = s[sp];
+			for (int i = 1; i < instr.arg; i++) {
+				double x = s[sp + i];
+				if (instr.op == OpCode::Min ? x < val : x > val) val = x;
+			}
+			s[sp++] = val;
+			break;
+		}
+		case OpCode::Call:
+			// The arguments become the first slots of the new frame
+			if (frames.size() >= MAX_FRAMES) return Status::TooDeep;
+			frames.push_back({pc, base, tailCalls});
+			base = sp - instr.arg;
+			sp = base + this->numSlots;
+			pc = 0;
+			tailCalls = 0;
+			if (stack.size() < base + this->frameSize) {
+				stack.resize(2 * (base + this->frameSize));
+				s = stack.data();
+			}
+			break;
+		case OpCode::TailCall:
+			if (++tailCalls > MAX_TAIL_CALLS) return Status::TooDeep;
+			std::copy(s + sp - instr.arg, s + sp, s + base);
+			sp = base + this->numSlots;
+			pc = 0;
+			break;
+		case OpCode::Return: {
+			double value = s[sp - 1];
+			if (frames.empty()) {
+				result = this->resultIsBool ? ValuePtr(value != 0) : ValuePtr(value);
+				return Status::Done;
+			}
+			sp = base;
+			s[sp++] = value;
+			pc = frames.back().pc;
+			base = frames.back().base;
+			tailCalls = frames.back().tailCalls;
+			frames.pop_back();
+			break;
+		}
+		}
+	}
+}
+
+FunctionCompiler::FunctionCompiler(FunctionProgram &program, const UserFunction &function, const FileContext *ctx)
+	: program(program), function(function), ctx(ctx)
+{
+}
+
+bool FunctionCompiler::compileFunction(const Context &args)
+{
+	// The type of the result is needed for calls of the function itself before
+	// it is known, so compile again if the first guess was wrong
+	for (auto assumed : {Type::Number, Type::Bool}) {
+		this->program = FunctionProgram();
+		this->variables.clear();
+		this->depth = this->maxDepth = 0;
+		this->resultType = assumed;
+
+		for (const auto &arg : this->function.definition_arguments) {
+			Type type;
+			if (arg.name.empty() || arg.name[0] == '$' ||
+					!type_of(*args.lookup_variable(arg.name, true), type)) return false;
+			for (const auto &variable : this->variables) {
+				if (variable.name == arg.name) return false;
+			}
+			this->variables.push_back({arg.name, int(this->variables.size()), type});
+			this->program.parameters.push_back(arg.name);
+			this->program.parameterIsBool.push_back(type == Type::Bool);
+		}
+		this->program.numSlots = this->variables.size();
+
+		Type type;
+		if (!compile(this->function.expr, true, type)) return false;
+		if (type != assumed) continue;
+		emit(FunctionProgram::OpCode::Return);
+		this->program.resultIsBool = type == Type::Bool;
+		this->program.frameSize = this->program.numSlots + this->maxDepth;
+		return true;
+	}
+	return false;
+}
+
+bool FunctionCompiler::compile(const shared_ptr<Expression> &expr, bool tail, Type &type)
+{
+	if (!expr || !expr->compile(*this, tail)) return false;
+	type = this->type;
+	return true;
+}
+
+bool FunctionCompiler::compileLiteral(const ValuePtr &value)
+{
+	if (!type_of(*value, this->type)) return false;
+	emit(FunctionProgram::OpCode::Constant, 0, this->type == Type::Bool ? (value->toBool() ? 1 : 0) : value->toDouble());
+	push();
+	return true;
+}
+
+bool FunctionCompiler::compileLookup(const std::string &name)
+{
+	for (auto it = this->variables.rbegin(); it != this->variables.rend(); ++it) {
+		if (it->name == name) {
+			emit(FunctionProgram::OpCode::Load, it->slot);
+			push();
+			this->type = it->type;
+			return true;
+		}
+	}
+
+	// Special variables depend on the caller
+	if (name.empty() || name[0] == '$') return false;
+	auto &globals = this->program.globals;
+	auto found = std::find(globals.begin(), globals.end(), name);
+	if (found == globals.end()) {
+		// Unknown variables cause a warning
+		if (!type_of(*this->ctx->lookup_variable(name, true), this->type)) return false;
+		found = globals.insert(globals.end(), name);
+		this->program.globalIsBool.push_back(this->type == Type::Bool);
+	}
+	else {
+		this->type = this->program.globalIsBool[found - globals.begin()] ? Type::Bool : Type::Number;
+	}
+	emit(FunctionProgram::OpCode::LoadGlobal, int(found - globals.begin()));
+	push();
+	return true;
+}
+
+bool FunctionCompiler::compileUnaryOp(UnaryOp::Op op, const shared_ptr<Expression> &expr)
+{
+	Type type;
+	if (!compile(expr, false, type)) return false;
+	switch (op) {
+	case UnaryOp::Op::Not:
+		emit(FunctionProgram::OpCode::Not);
+		this->type = Type::Bool;
+		return true;
+	case UnaryOp::Op::Negate:
+		if (type != Type::Number) return false;
+		emit(FunctionProgram::OpCode::Negate);
+		this->type = Type::Number;
+		return true;
+	}
+	return false;
+}
+
+bool FunctionCompiler::compileBinaryOp(BinaryOp::Op op, const shared_ptr<Expression> &left, const shared_ptr<Expression> &right)
+{
+	Type ltype, rtype;
+	if (op == BinaryOp::Op::LogicalAnd || op == BinaryOp::Op::LogicalOr) {
+		// Evaluate the right side only when needed
+		bool isAnd = op == BinaryOp::Op::LogicalAnd;
+		if (!compile(left, false, ltype)) return false;
+		size_t jump = emit(isAnd ? FunctionProgram::OpCode::JumpIfFalse : FunctionProgram::OpCode::JumpIfTrue);
+		pop();
+		if (!compile(right, false, rtype)) return false;
+		emit(FunctionProgram::OpCode::ToBool);
+		size_t end = emit(FunctionProgram::OpCode::Jump);
+		patch(jump);
+		pop();
+		emit(FunctionProgram::OpCode::Constant, 0, isAnd ? 0 : 1);
+		push();
+		patch(end);
+		this->type = Type::Bool;
+		return true;
+	}
+
+	if (!compile(left, false, ltype) || !compile(right, false, rtype)) return false;
+	FunctionProgram::OpCode code;
+	switch (op) {
+	case BinaryOp::Op::Multiply: code = FunctionProgram::OpCode::Multiply; break;
+	case BinaryOp::Op::Divide: code = FunctionProgram::OpCode::Divide; break;
+	case BinaryOp::Op::Modulo: code = FunctionProgram::OpCode::Modulo; break;
+	case BinaryOp::Op::Plus: code = FunctionProgram::OpCode::Add; break;
+	case BinaryOp::Op::Minus: code = FunctionProgram::OpCode::Subtract; break;
+	case BinaryOp::Op::Less: code = FunctionProgram::OpCode::Less; break;
+	case BinaryOp::Op::LessEqual: code = FunctionProgram::OpCode::LessEqual; break;
+	case BinaryOp::Op::Greater: code = FunctionProgram::OpCode::Greater; break;
+	case BinaryOp::Op::GreaterEqual: code = FunctionProgram::OpCode::GreaterEqual; break;
+	case BinaryOp::Op::Equal: code = FunctionProgram::OpCode::Equal; break;
+	case BinaryOp::Op::NotEqual: code = FunctionProgram::OpCode::NotEqual; break;
+	default: return false;
+	}
+	switch (op) {
+	case BinaryOp::Op::Less:
+	case BinaryOp::Op::LessEqual:
+	case BinaryOp::Op::Greater:
+	case BinaryOp::Op::GreaterEqual:
+		// Booleans compare like numbers
+		this->type = Type::Bool;
+		break;
+	case BinaryOp::Op::Equal:
+	case BinaryOp::Op::NotEqual:
+		// A boolean never equals a number
+		if (ltype != rtype) return false;
+		this->type = Type::Bool;
+		break;
+	default:
+		// Arithmetic on booleans gives undef
+		if (ltype != Type::Number || rtype != Type::Number) return false;
+		this->type = Type::Number;
+		break;
+	}
+	emit(code);
+	pop();
+	return true;
+}
+
+bool FunctionCompiler::compileTernaryOp(const shared_ptr<Expression> &cond, const shared_ptr<Expression> &ifexpr,
+																				const shared_ptr<Expression> &elseexpr, bool tail)
+{
+	Type ctype, iftype, elsetype;
+	if (!compile(cond, false, ctype)) return false;
+	size_t jump = emit(FunctionProgram::OpCode::JumpIfFalse);
+	pop();
+	if (!compile(ifexpr, tail, iftype)) return false;
+	size_t end = emit(FunctionProgram::OpCode::Jump);
+	patch(jump);
+	pop();
+	if (!compile(elseexpr, tail, elsetype) || iftype != elsetype) return false;
+	patch(end);
+	this->type = iftype;
+	return true;
+}
+
+bool FunctionCompiler::compileLet(const AssignmentList &arguments, const shared_ptr<Expression> &expr, bool tail)
+{
+	size_t numVariables = this->variables.size();
+	for (size_t i = 0; i < arguments.size(); i++) {
+		const auto &assignment = arguments[i];
+		// Unnamed and repeated assignments cause warnings
+		if (assignment.name.empty() || assignment.name[0] == '$') return false;
+		for (size_t j = 0; j < i; j++) {
+			if (arguments[j].name == assignment.name) return false;
+		}
+		Type type;
+		if (!compile(assignment.expr, false, type)) return false;
+		int slot = int(this->program.numSlots++);
+		emit(FunctionProgram::OpCode::Store, slot);
+		pop();
+		// Later assignments see the earlier ones
+		this->variables.push_back({assignment.name, slot, type});
+	}
+	Type type;
+	bool ok = compile(expr, tail, type);
+	this->variables.erase(this->variables.begin() + numVariables, this->variables.end());
+	return ok;
+}
+
+bool FunctionCompiler::compileCall(const std::string &name, const AssignmentList &arguments, bool tail)
+{
+	if (name == this->function.name) return compileSelfCall(arguments, tail);
+	if (isBuiltin(name)) return compileBuiltinCall(name, arguments);
+	return false;
+}
+
+bool FunctionCompiler::compileBuiltinCall(const std::string &name, const AssignmentList &arguments)
+{
+	FunctionProgram::OpCode code;
+	size_t numArgs = arguments.size();
+	if ((name == "min" || name == "max") && numArgs >= 1) {
+		code = name == "min" ? FunctionProgram::OpCode::Min : FunctionProgram::OpCode::Max;
+	}
+	else {
+		auto found = std::find_if(std::begin(builtin_ops), std::end(builtin_ops), [&](const BuiltinOp &op) {
+			return name == op.name && numArgs == op.numArgs;
+		});
+		if (found == std::end(builtin_ops)) return false;
+		code = found->op;
+	}
+
+	// Builtins take their arguments by position, ignoring the names
+	for (const auto &arg : arguments) {
+		if (!compileNumber(arg.expr)) return false;
+	}
+	emit(code, int(numArgs));
+	pop(int(numArgs));
+	push();
+	this->type = Type::Number;
+	return true;
+}
+
+bool FunctionCompiler::compileSelfCall(const AssignmentList &arguments, bool tail)
+{
+	// Match arguments to parameters like EvalContext::resolveArguments(),
+	// giving up on anything it would warn about
+	const auto &parameters = this->function.definition_arguments;
+	std::vector<const Assignment *> given(parameters.size(), nullptr);
+	size_t posarg = 0;
+	for (const auto &arg : arguments) {
+		if (!arg.name.empty()) {
+			auto found = std::find_if(parameters.begin(), parameters.end(), [&](const Assignment &parameter) {
+				return parameter.name == arg.name;
+			});
+			if (found == parameters.end() || given[found - parameters.begin()]) return false;
+			given[found - parameters.begin()] = &arg;
+		}
+		else if (posarg < parameters.size()) given[posarg++] = &arg;
+		else return false;
+	}
+
+	for (size_t i = 0; i < parameters.size(); i++) {
+		Type type;
+		if (given[i]) {
+			if (!compile(given[i]->expr, false, type)) return false;
+		}
+		else {
+			// Only defaults which can be evaluated without a context
+			if (!parameters[i].expr || !parameters[i].expr->isLiteral()) return false;
+			if (!compileLiteral(parameters[i].expr->evaluate(this->ctx))) return false;
+			type = this->type;
+		}
+		if (type != this->variables[i].type) return false;
+	}
+	emit(tail ? FunctionProgram::OpCode::TailCall : FunctionProgram::OpCode::Call, int(parameters.size()));
+	pop(int(parameters.size()));
+	push();
+	this->type = this->resultType;
+	return true;
+}
+
+bool FunctionCompiler::compileNumber(const shared_ptr<Expression> &expr)
+{
+	Type type;
+	return compile(expr, false, type) && type == Type::Number;
+}
+
+bool FunctionCompiler::isBuiltin(const std::string &name) const
+{
+	if (this->ctx->functions_p->find(name) != this->ctx->functions_p->end() || this->ctx->usesFunction(name)) return false;
+	const auto &builtins = Builtins::instance()->getFunctions();
+	return builtins.find(name) != builtins.end();
+}
+
+size_t FunctionCompiler::emit(FunctionProgram::OpCode op, int arg, double value)
+{
+	this->program.code.push_back({op, arg, value});
+	return this->program.code.size() - 1;
+}
+
+void FunctionCompiler::patch(size_t jump)
+{
+	this->program.code[jump].arg = int(this->program.code.size());
+}
+
+void FunctionCompiler::push(int count)
+{
+	this->depth += count;
+	this->maxDepth = std::max(this->maxDepth, this->depth);
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "memory.h"
+#include "value.h"
+#include "Assignment.h"
+#include "expression.h"
+
+class Context;
+class FileContext;
+class UserFunction;
+
+/*!
+	Compiled form of a numeric user function, see UserFunction::evaluate().
+
+	Functions whose parameters, variables and result are numbers or booleans,
+	and which only use arithmetic, comparisons, let(), conditions, math builtins
+	and calls of themselves, are compiled to a compact stack based bytecode.
+	Interpreting it needs no contexts, name lookups or dispatch on expression
+	types, which dominate the cost of evaluating such functions from the AST.
+
+	Anything the bytecode can't express exactly as the AST would evaluate it,
+	including anything that could print a warning, makes the compilation fail,
+	and the function is evaluated from its AST as before.
+*/
+class FunctionProgram
+{
+public:
+	enum class OpCode : unsigned char {
+		Constant, Load, LoadGlobal, Store,
+		Negate, Not, Add, Subtract, Multiply, Divide, Modulo,
+		Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual,
+		Jump, JumpIfFalse, JumpIfTrue,
+		Abs, Sign, Sin, Cos, Tan, Asin, Acos, Atan, Atan2, Pow, Sqrt, Exp, Ln, Log, LogBase,
+		Floor, Ceil, Round, Min, Max, ToBool,
+		Call, TailCall, Return
+	};
+
+	struct Instruction {
+		OpCode op;
+		int arg; // Slot, jump target or number of arguments
+		double value; // Constant
+	};
+
+	// Returns nullptr if the function can't be compiled
+	static std::unique_ptr<FunctionProgram> compile(const UserFunction &function, const Context *ctx, const Context &args);
+
+	enum class Status {
+		Done,
+		Unsupported, // Types don't match the ones the function was compiled for
+		TooDeep // Recursion exceeds the frames or tail calls the bytecode allows
+	};
+
+	/*!
+		Evaluates the function with the parameters given in args, and the outside
+		variables looked up in ctx. Unless Done is returned, the evaluation is
+		left to the AST.
+	*/
+	Status run(const Context *ctx, const Context &args, ValuePtr &result) const;
+
+private:
+	friend class FunctionCompiler;
+
+	std::vector<Instruction> code;
+	std::vector<std::string> parameters;
+	std::vector<bool> parameterIsBool;
+	std::vector<std::string> globals; // Outside variables, looked up when starting
+	std::vector<bool> globalIsBool;
+	size_t numSlots = 0; // Parameters and let() variables
+	size_t frameSize = 0; // Slots and the maximum depth of the evaluation stack
+	bool resultIsBool = false;
+};
+
+/*!
+	Compiles the body of a UserFunction into a FunctionProgram, driven by
+	Expression::compile(). Each compile method returns false if the given
+	expression can't be compiled, and leaves its value on the evaluation stack
+	of the program otherwise. Compilation never prints anything.
+*/
+class FunctionCompiler
+{
+public:
+	enum class Type { Number, Bool };
+
+	FunctionCompiler(FunctionProgram &program, const UserFunction &function, const FileContext *ctx);
+
+	// Compiles the given expression, giving the type of its value. Calls of
+	// the function itself in tail position become tail calls.
+	bool compile(const shared_ptr<Expression> &expr, bool tail, Type &type);
+
+	// Called by the overrides of Expression::compile()
+	bool compileLiteral(const ValuePtr &value);
+	bool compileLookup(const std::string &name);
+	bool compileUnaryOp(UnaryOp::Op op, const shared_ptr<Expression> &expr);
+	bool compileBinaryOp(BinaryOp::Op op, const shared_ptr<Expression> &left, const shared_ptr<Expression> &right);
+	bool compileTernaryOp(const shared_ptr<Expression> &cond, const shared_ptr<Expression> &ifexpr,
+												const shared_ptr<Expression> &elseexpr, bool tail);
+	bool compileLet(const AssignmentList &arguments, const shared_ptr<Expression> &expr, bool tail);
+	bool compileCall(const std::string &name, const AssignmentList &arguments, bool tail);
+
+	// Compiles the function, for parameters of the types of the given values
+	bool compileFunction(const Context &args);
+
+private:
+	bool compileBuiltinCall(const std::string &name, const AssignmentList &arguments);
+	bool compileSelfCall(const AssignmentList &arguments, bool tail);
+	bool compileNumber(const shared_ptr<Expression> &expr);
+	bool isBuiltin(const std::string &name) const;
+
+	size_t emit(FunctionProgram::OpCode op, int arg = 0, double value = 0);
+	// Sets the target of the jump at the given position to the next instruction
+	void patch(size_t jump);
+	// Tracks the depth of the evaluation stack
+	void push(int count = 1);
+	void pop(int count = 1) { this->depth -= count; }
+
+	FunctionProgram &program;
+	const UserFunction &function;
+	const FileContext *ctx;
+
+	struct Variable {
+		std::string name;
+		int slot;
+		Type type;
+	};
+	// Parameters and let() variables in scope, innermost last
+	std::vector<Variable> variables;
+	// Type of the value of the last compiled expression
+	Type type = Type::Number;
+	// Assumed type of the result of the function, for calls of itself
+	Type resultType = Type::Number;
+	size_t depth = 0;
+	size_t maxDepth = 0;
+};
@@ -1,6 +1,8 @@
 #include "GeometryCache.h"
 #include "printutils.h"
 #include "Geometry.h"
+#include "GeometryUtils.h"
+#include "feature.h"
 #ifdef DEBUG
   #ifndef ENABLE_CGAL
   #define ENABLE_CGAL
@@ -10,18 +12,64 @@
 
 GeometryCache *GeometryCache::inst = nullptr;
 
+/*!
+	Returns nullptr if the entry isn't there (anymore), as another thread may
+	have evicted it since contains() was called.
+*/
 shared_ptr<const Geometry> GeometryCache::get(const std::string &id) const
 {
-	const auto &geom = this->cache[id]->geom;
+	std::lock_guard<std::mutex> lock(this->mutex);
+	const auto entry = this->cache[id];
+	if (!entry) return nullptr;
+	const auto &geom = entry->geom;
 #ifdef DEBUG
 	PRINTDB("Geometry Cache hit: %s (%d bytes)", id.substr(0, 40) % (geom ? geom->memsize() : 0));
 #endif
 	return geom;
 }
 
-bool GeometryCache::insert(const std::string &id, const shared_ptr<const Geometry> &geom)
+/*!
+	Returns a previously cached geometry with the same content as geom if
+	there is one, otherwise remembers geom for later lookups and returns it.
+	Only done if the geometry-deduplication feature is enabled.
+*/
+shared_ptr<const Geometry> GeometryCache::share(const shared_ptr<const Geometry> &geom)
 {
-	auto inserted = this->cache.insert(id, new cache_entry(geom), geom ? geom->memsize() : 0);
+	if (!geom || !Feature::ExperimentalGeometryDeduplication.is_enabled()) return geom;
+	size_t hash = GeometryUtils::contentHash(*geom);
+	if (!hash) return geom;
+
+	auto range = this->shared.equal_range(hash);
+	for (auto it = range.first; it != range.second;) {
+		if (auto other = it->second.lock()) {
+			if (GeometryUtils::contentEqual(*other, *geom)) return other;
+			++it;
+		}
+		else {
+			it = this->shared.erase(it);
+		}
+	}
+
+	// Drop geometries which have since been evicted and released
+	if (this->shared.size() > 2 * this->cache.size() + 64) {
+		for (auto it = this->shared.begin(); it != this->shared.end();) {
+			if (it->second.expired()) it = this->shared.erase(it);
+			else ++it;
+		}
+	}
+	this->shared.emplace(hash, geom);
+	return geom;
+}
+
+/*!
+	Note that an entry sharing its geometry with other entries is still
+	charged its full size, so the cache never holds more than its limit.
+*/
+bool GeometryCache::insert(const std::string &id, const shared_ptr<const Geometry> &geom_in, double computetime)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto geom = share(geom_in);
+	auto inserted = this->cache.insert(id, new cache_entry(geom), geom ? geom->memsize() : 0, computetime);
 #ifdef DEBUG
 	assert(!dynamic_cast<const CGAL_Nef_polyhedron*>(geom.get()));
 	if (inserted) PRINTDB("Geometry Cache insert: %s (%d bytes)",
@@ -34,18 +82,23 @@ bool GeometryCache::insert(const std::string &id, const shared_ptr<const Geometr
 
 size_t GeometryCache::maxSizeMB() const
 {
+	std::lock_guard<std::mutex> lock(this->mutex);
 	return this->cache.maxCost()/(1024*1024);
 }
 
 void GeometryCache::setMaxSizeMB(size_t limit)
 {
+	std::lock_guard<std::mutex> lock(this->mutex);
 	this->cache.setMaxCost(limit*1024*1024);
 }
 
 void GeometryCache::print()
 {
+	std::lock_guard<std::mutex> lock(this->mutex);
 	PRINTB("Geometries in cache: %d", this->cache.size());
 	PRINTB("Geometry cache size in bytes: %d", this->cache.totalCost());
+	PRINTB("Geometry cache hits: %d, evictions: %d", this->cache.hitCount() % this->cache.evictionCount());
+	PRINTB("Geometry cache compute time of cached geometries: %.3f s", this->cache.totalBenefit());
 }
 
 GeometryCache::cache_entry::cache_entry(const shared_ptr<const Geometry> &geom)
@@ -4,6 +4,14 @@
 #include "memory.h"
 #include "Geometry.h"
 
+#include <unordered_map>
+#include <mutex>
+
+/*!
+	Cache of geometries by node key. The GUI renders in worker threads (see
+	CGALWorker), including the background render, so every access locks the
+	cache.
+*/
 class GeometryCache
 {
 public:	
@@ -11,12 +19,19 @@ public:
 
 	static GeometryCache *instance() { if (!inst) inst = new GeometryCache; return inst; }
 
-	bool contains(const std::string &id) const { return this->cache.contains(id); }
+	bool contains(const std::string &id) const {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->cache.contains(id);
+	}
 	shared_ptr<const class Geometry> get(const std::string &id) const;
-	bool insert(const std::string &id, const shared_ptr<const Geometry> &geom);
+	// computetime: Seconds it took to compute geom; used to prioritize cache eviction
+	bool insert(const std::string &id, const shared_ptr<const Geometry> &geom, double computetime = 0);
 	size_t maxSizeMB() const;
 	void setMaxSizeMB(size_t limit);
-	void clear() { cache.clear(); }
+	void clear() {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		cache.clear(); shared.clear();
+	}
 	void print();
 
 private:
@@ -29,5 +44,11 @@ private:
 		~cache_entry() { }
 	};
 
+	shared_ptr<const Geometry> share(const shared_ptr<const Geometry> &geom);
+
+	mutable std::mutex mutex;
 	Cache<std::string, cache_entry> cache;
+	// Cached geometries by content hash, so identical geometries cached for
+	// different nodes share one instance. See share().
+	std::unordered_multimap<size_t, std::weak_ptr<const Geometry>> shared;
 };
@@ -27,8 +27,12 @@
 #include "calc.h"
 #include "dxfdata.h"
 #include "degree_trig.h"
+#include "feature.h"
+#include "progress.h"
 #include <ciso646> // C alternative tokens (xor)
 #include <algorithm>
+#include <unordered_map>
+#include <chrono>
 
 #pragma push_macro("NDEBUG")
 #undef NDEBUG
@@ -36,8 +40,8 @@
 #include <CGAL/Point_2.h>
 #pragma pop_macro("NDEBUG")
 
-GeometryEvaluator::GeometryEvaluator(const class Tree &tree):
-	tree(tree)
+GeometryEvaluator::GeometryEvaluator(const class Tree &tree, bool inexact):
+	tree(tree), inexact(inexact), cancelflag(nullptr)
 {
 }
 
@@ -47,8 +51,10 @@ GeometryEvaluator::GeometryEvaluator(const class Tree &tree):
 shared_ptr<const Geometry> GeometryEvaluator::evaluateGeometry(const AbstractNode &node, 
 																															 bool allownef)
 {
-	const std::string &key = this->tree.getIdString(node);
+	const std::string key = cacheKey(node);
 	if (!GeometryCache::instance()->contains(key)) {
+		const auto start = std::chrono::steady_clock::now();
+		this->evaluationmark = start;
 		shared_ptr<const CGAL_Nef_polyhedron> N;
 		if (CGALCache::instance()->contains(key)) {
 			N = CGALCache::instance()->get(key);
@@ -90,7 +96,10 @@ shared_ptr<const Geometry> GeometryEvaluator::evaluateGeometry(const AbstractNod
 				}
 			}
 		}
+		this->evaluationtimes[node.index()] =
+			std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 		smartCacheInsert(node, this->root);
+		this->evaluationtimes.clear();
 		return this->root;
 	}
 	return GeometryCache::instance()->get(key);
@@ -118,6 +127,149 @@ GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren(const Abstrac
 	return ResultObject();
 }
 
+/*!
+	Removes geometries which are identical to an earlier geometry in the list,
+	since they don't contribute anything to a union. Only done if the
+	geometry-deduplication feature is enabled, since it hashes every vertex.
+*/
+template <typename Container, typename GetGeometry>
+static void remove_duplicate_geometries(Container &children, GetGeometry get)
+{
+	if (!Feature::ExperimentalGeometryDeduplication.is_enabled() || children.size() < 2) return;
+	std::unordered_multimap<size_t, const Geometry *> seen;
+	for (auto it = children.begin(); it != children.end();) {
+		const Geometry *geom = get(*it);
+		size_t hash = GeometryUtils::contentHash(*geom);
+		if (!hash) hash = std::hash<const Geometry *>()(geom);
+
+		bool duplicate = false;
+		auto range = seen.equal_range(hash);
+		for (auto s = range.first; s != range.second && !duplicate; ++s) {
+			duplicate = GeometryUtils::contentEqual(*s->second, *geom);
+		}
+		if (duplicate) {
+			it = children.erase(it);
+		}
+		else {
+			seen.emplace(hash, geom);
+			++it;
+		}
+	}
+}
+
+/*!
+	Whether no two of the given bounding boxes overlap or touch
+*/
+static bool disjoint_bboxes(const std::vector<BoundingBox> &bboxes)
+{
+	BoundingBox total;
+	for (const auto &bbox : bboxes) total.extend(bbox);
+
+	// Sweep along the longest axis, only comparing boxes overlapping along it
+	int axis;
+	total.sizes().maxCoeff(&axis);
+	std::vector<size_t> order(bboxes.size());
+	for (size_t i = 0; i < order.size(); i++) order[i] = i;
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return bboxes[a].min()[axis] < bboxes[b].min()[axis];
+	});
+	for (size_t i = 0; i < order.size(); i++) {
+		const auto &bbox = bboxes[order[i]];
+		for (size_t j = i + 1; j < order.size() && bboxes[order[j]].min()[axis] <= bbox.max()[axis]; j++) {
+			if (bbox.intersects(bboxes[order[j]])) return false;
+		}
+	}
+	return true;
+}
+
+/*!
+	Union of PolySets with pairwise disjoint bounding boxes, which is simply
+	all their polygons combined. This is typical for arrays of identical parts
+	(fasteners, perforations etc.) placed with different transforms.
+
+	Returns nullptr if any child is not a PolySet or if any two bounding boxes
+	overlap or touch, in which case the union needs to be done by CGAL.
+*/
+static PolySet *union_disjoint_polysets(const Geometry::Geometries &children)
+{
+	std::vector<const PolySet *> polysets;
+	std::vector<BoundingBox> bboxes;
+	for (const auto &item : children) {
+		auto ps = dynamic_cast<const PolySet *>(item.second.get());
+		if (!ps) return nullptr;
+		if (ps->isEmpty()) continue;
+		polysets.push_back(ps);
+		bboxes.push_back(ps->getBoundingBox());
+	}
+	if (polysets.size() < 2 || !disjoint_bboxes(bboxes)) return nullptr;
+
+	auto result = new PolySet(3);
+	unsigned int convexity = 1;
+	for (auto ps : polysets) {
+		result->append(*ps);
+		convexity = std::max(convexity, ps->getConvexity());
+	}
+	result->setConvexity(convexity);
+	return result;
+}
+
+/*!
+	Like union_disjoint_polysets(), but for the children of the given node
+	before collectChildren3D(). Transforms still pending for them, see
+	isLazyTransform(), are applied while copying their polygons into the
+	result, so a part placed many times isn't copied for every placement
+	first. The result is the same as with the transforms applied by the
+	children.
+
+	Returns nullptr if any child is not a 3D PolySet.
+*/
+PolySet *GeometryEvaluator::unionDisjointChildren(const AbstractNode &node)
+{
+	std::vector<const PolySet *> polysets;
+	std::vector<const TransformList *> transforms;
+	std::vector<BoundingBox> bboxes;
+	for (const auto &item : this->visitedchildren[node.index()]) {
+		if (item.first->modinst->isBackground() || !item.second) continue;
+		auto ps = dynamic_cast<const PolySet *>(item.second.get());
+		if (!ps || ps->getDimension() != 3) return nullptr;
+		if (ps->isEmpty()) continue;
+
+		auto pending = this->pendingtransforms.find(item.first->index());
+		polysets.push_back(ps);
+		transforms.push_back(pending != this->pendingtransforms.end() ? &pending->second : nullptr);
+		if (transforms.back()) {
+			BoundingBox bbox;
+			for (const auto &p : ps->polygons) {
+				for (auto v : p) {
+					for (const auto &matrix : *transforms.back()) v = matrix * v;
+					bbox.extend(v);
+				}
+			}
+			bboxes.push_back(bbox);
+		}
+		else {
+			bboxes.push_back(ps->getBoundingBox());
+		}
+	}
+	if (polysets.size() < 2 || !disjoint_bboxes(bboxes)) return nullptr;
+
+	auto result = new PolySet(3);
+	unsigned int convexity = 1;
+	for (size_t i = 0; i < polysets.size(); i++) {
+		if (transforms[i]) result->append(*polysets[i], transforms[i]->data(), transforms[i]->size());
+		else result->append(*polysets[i]);
+		convexity = std::max(convexity, polysets[i]->getConvexity());
+	}
+	result->setConvexity(convexity);
+
+	// Cache the children whose geometry is final, like collectChildren3D() would have
+	for (const auto &item : this->visitedchildren[node.index()]) {
+		if (item.first->modinst->isBackground()) continue;
+		if (!this->pendingtransforms.erase(item.first->index())) smartCacheInsert(*item.first, item.second);
+	}
+	return result;
+}
+
 /*!
 	Applies the operator to all child nodes of the given node.
 	
@@ -125,9 +277,22 @@ GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren(const Abstrac
 */
 GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren3D(const AbstractNode &node, OpenSCADOperator op)
 {
+	// Whether the bounding boxes of the children are disjoint is checked once: here, so pending
+	// transforms are applied while building the union, or with deduplication, on the
+	// deduplicated children below
+	const bool disjointunion = op == OpenSCADOperator::UNION && Feature::ExperimentalDisjointUnion.is_enabled();
+	const bool deduplicate = Feature::ExperimentalGeometryDeduplication.is_enabled();
+	if (disjointunion && !deduplicate) {
+		if (PolySet *ps = unionDisjointChildren(node)) return ResultObject(ps);
+	}
+
 	Geometry::Geometries children = collectChildren3D(node);
 	if (children.size() == 0) return ResultObject();
 
+	if (op == OpenSCADOperator::UNION) {
+		remove_duplicate_geometries(children, [](const Geometry::GeometryItem &item) { return item.second.get(); });
+	}
+
 	if (op == OpenSCADOperator::HULL) {
 		PolySet *ps = new PolySet(3, true);
 
@@ -152,6 +317,21 @@ GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren3D(const Abstr
 		return ResultObject(CGALUtils::applyMinkowski(actualchildren));
 	}
 
+	if (disjointunion && deduplicate) {
+		if (PolySet *ps = union_disjoint_polysets(children)) return ResultObject(ps);
+	}
+
+	if (this->inexact) {
+		if (PolySet *ps = CGALUtils::applyOperatorInexact(children, op)) {
+			unsigned int convexity = 1;
+			for (const auto &item : children) {
+				convexity = std::max(convexity, item.second->getConvexity());
+			}
+			ps->setConvexity(convexity);
+			return ResultObject(ps);
+		}
+	}
+
 	CGAL_Nef_polyhedron *N = CGALUtils::applyOperator(children, op);
 	// FIXME: Clarify when we can return nullptr and what that means
 	if (!N) N = new CGAL_Nef_polyhedron;
@@ -223,6 +403,7 @@ Polygon2d *GeometryEvaluator::applyMinkowski2D(const AbstractNode &node)
 std::vector<const class Polygon2d *> GeometryEvaluator::collectChildren2D(const AbstractNode &node)
 {
 	std::vector<const Polygon2d *> children;
+	applyPendingTransforms(node);
 	for(const auto &item : this->visitedchildren[node.index()]) {
 		const AbstractNode *chnode = item.first;
 		const shared_ptr<const Geometry> &chgeom = item.second;
@@ -257,31 +438,74 @@ std::vector<const class Polygon2d *> GeometryEvaluator::collectChildren2D(const
 void GeometryEvaluator::smartCacheInsert(const AbstractNode &node, 
 																				 const shared_ptr<const Geometry> &geom)
 {
-	const std::string &key = this->tree.getIdString(node);
+	const std::string key = cacheKey(node);
 
 	shared_ptr<const CGAL_Nef_polyhedron> N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom);
 	if (N) {
-		if (!CGALCache::instance()->contains(key)) CGALCache::instance()->insert(key, N);
+		if (!CGALCache::instance()->contains(key)) CGALCache::instance()->insert(key, N, evaluationTime(node));
 	}
 	else {
 		if (!GeometryCache::instance()->contains(key)) {
-			if (!GeometryCache::instance()->insert(key, geom)) {
+			if (!GeometryCache::instance()->insert(key, geom, evaluationTime(node))) {
 				PRINT("WARNING: GeometryEvaluator: Node didn't fit into cache");
 			}
 		}
 	}
 }
 
-bool GeometryEvaluator::isSmartCached(const AbstractNode &node)
+/*!
+	Returns the time in seconds it took to evaluate the given node, including
+	its children, in the current evaluation. Returns 0 if unknown.
+*/
+double GeometryEvaluator::evaluationTime(const AbstractNode &node) const
+{
+	auto it = this->evaluationtimes.find(node.index());
+	return it != this->evaluationtimes.end() ? it->second : 0;
+}
+
+/*!
+	Returns the key under which the geometry of the given node is cached.
+	Results of inexact evaluations get their own keys, so they are never
+	returned to an exact evaluation (e.g. for export). Nodes not depending
+	on any inexact CSG operation keep their exact keys, so both kinds of
+	evaluation share them.
+*/
+std::string GeometryEvaluator::cacheKey(const AbstractNode &node) const
 {
 	const std::string &key = this->tree.getIdString(node);
+	return this->inexact && usesCorefinement(node) ? "inexact:" + key : key;
+}
+
+/*!
+	Whether the given node or any of its descendants may combine several
+	children with a CSG operation, which an inexact evaluation does using
+	corefinement, see applyToChildren3D(). Single children are passed on as
+	they are.
+*/
+bool GeometryEvaluator::usesCorefinement(const AbstractNode &node) const
+{
+	auto it = this->corefinement.find(node.index());
+	if (it != this->corefinement.end()) return it->second;
+
+	const auto &children = node.getChildren();
+	bool result = children.size() > 1;
+	for (size_t i = 0; i < children.size() && !result; i++) {
+		result = usesCorefinement(*children[i]);
+	}
+	this->corefinement[node.index()] = result;
+	return result;
+}
+
+bool GeometryEvaluator::isSmartCached(const AbstractNode &node)
+{
+	const std::string key = cacheKey(node);
 	return (GeometryCache::instance()->contains(key) ||
 					CGALCache::instance()->contains(key));
 }
 
 shared_ptr<const Geometry> GeometryEvaluator::smartCacheGet(const AbstractNode &node, bool preferNef)
 {
-	const std::string &key = this->tree.getIdString(node);
+	const std::string key = cacheKey(node);
 	shared_ptr<const Geometry> geom;
 	bool hasgeom = GeometryCache::instance()->contains(key);
 	bool hascgal = CGALCache::instance()->contains(key);
@@ -297,6 +521,7 @@ shared_ptr<const Geometry> GeometryEvaluator::smartCacheGet(const AbstractNode &
 Geometry::Geometries GeometryEvaluator::collectChildren3D(const AbstractNode &node)
 {
 	Geometry::Geometries children;
+	applyPendingTransforms(node);
 	for(const auto &item : this->visitedchildren[node.index()]) {
 		const AbstractNode *chnode = item.first;
 		const shared_ptr<const Geometry> &chgeom = item.second;
@@ -340,6 +565,10 @@ Polygon2d *GeometryEvaluator::applyToChildren2D(const AbstractNode &node, OpenSC
 		return nullptr;
 	}
 
+	if (op == OpenSCADOperator::UNION) {
+		remove_duplicate_geometries(children, [](const Polygon2d *poly) { return poly; });
+	}
+
 	if (children.size() == 1) {
 		return new Polygon2d(*children[0]); // Copy
 	}
@@ -377,6 +606,20 @@ void GeometryEvaluator::addToParent(const State &state,
 																		const AbstractNode &node, 
 																		const shared_ptr<const Geometry> &geom)
 {
+	if (this->cancelflag && *this->cancelflag) throw ProgressCancelException();
+
+	// Nodes are done in traversal order, so the time since the previous node
+	// was done is the time spent on this node itself. Add to that the time
+	// spent on its children, and account for the total in the parent.
+	const auto now = std::chrono::steady_clock::now();
+	auto &seconds = this->evaluationtimes[node.index()];
+	seconds += std::chrono::duration<double>(now - this->evaluationmark).count();
+	this->evaluationmark = now;
+	if (state.parent()) this->evaluationtimes[state.parent()->index()] += seconds;
+
+	for (const auto &item : this->visitedchildren[node.index()]) {
+		this->pendingtransforms.erase(item.first->index());
+	}
 	this->visitedchildren.erase(node.index());
 	if (state.parent()) {
 		this->visitedchildren[state.parent()->index()].push_back(std::make_pair(&node, geom));
@@ -514,9 +757,16 @@ Response GeometryEvaluator::visit(State &state, const LeafNode &node)
 				}
 			}
             geom.reset(geometry);
+			addToParent(state, node, geom);
+			// Cache right away, so identical leaves later in this traversal
+			// (e.g. siblings in the same group) are shared rather than re-created.
+			// If it doesn't fit, the parent will warn when collecting its children.
+			GeometryCache::instance()->insert(cacheKey(node), geom, evaluationTime(node));
+		}
+		else {
+			geom = smartCacheGet(node, state.preferNef());
+			addToParent(state, node, geom);
 		}
-		else geom = smartCacheGet(node, state.preferNef());
-		addToParent(state, node, geom);
 		node.progress_report();
 	}
 	return Response::PruneTraversal;
@@ -536,7 +786,7 @@ Response GeometryEvaluator::visit(State &state, const TextNode &node)
 			}
 			geom.reset(ClipperUtils::apply(polygonlist, ClipperLib::ctUnion));
 		}
-		else geom = GeometryCache::instance()->get(this->tree.getIdString(node));
+		else geom = GeometryCache::instance()->get(cacheKey(node));
 		addToParent(state, node, geom);
 		node.progress_report();
 	}
@@ -570,6 +820,100 @@ Response GeometryEvaluator::visit(State &state, const CsgOpNode &node)
 	return Response::ContinueTraversal;
 }
 
+/*!
+	Returns true if the transform of the given node can be left for its parent
+	to apply, which saves copying the (often cached) child geometry for every
+	transform. This is the case if the parent is a transform with this node
+	as its only child, since it then applies all matrices to a single copy,
+	and for PolySets with the disjoint-union feature enabled, since
+	unionDisjointChildren() applies them while building the union.
+	Any other use of the children applies them first, see
+	applyPendingTransforms().
+*/
+bool GeometryEvaluator::isLazyTransform(const State &state, const TransformNode &node, const Geometry &geom) const
+{
+	if (!state.parent() || node.modinst->isBackground()) return false;
+	auto parent = dynamic_cast<const TransformNode *>(state.parent());
+	if (parent && parent->getChildren().size() == 1) return true;
+	return Feature::ExperimentalDisjointUnion.is_enabled() &&
+		geom.getDimension() == 3 && dynamic_cast<const PolySet *>(&geom);
+}
+
+/*!
+	Applies the given matrices in order, one at a time, so the result is
+	exactly the same as with each transform node applying its own matrix.
+	Const (e.g. cached) geometry is copied once.
+*/
+GeometryEvaluator::ResultObject GeometryEvaluator::applyTransforms(ResultObject res, const TransformList &transforms)
+{
+	for (const auto &matrix : transforms) {
+		shared_ptr<const Geometry> geom = res.constptr();
+		if (!geom) break;
+		shared_ptr<Geometry> newgeom;
+		if (geom->getDimension() == 2) {
+			shared_ptr<const Polygon2d> polygons = dynamic_pointer_cast<const Polygon2d>(geom);
+			assert(polygons);
+
+			// If we got a const object, make a copy
+			shared_ptr<Polygon2d> newpoly;
+			if (res.isConst()) newpoly.reset(new Polygon2d(*polygons));
+			else newpoly = dynamic_pointer_cast<Polygon2d>(res.ptr());
+
+			Transform2d mat2;
+			mat2.matrix() << 
+				matrix(0,0), matrix(0,1), matrix(0,3),
+				matrix(1,0), matrix(1,1), matrix(1,3),
+				matrix(3,0), matrix(3,1), matrix(3,3);
+			newpoly->transform(mat2);
+			newgeom = newpoly;
+			// A 2D transformation may flip the winding order of a polygon.
+			// If that happens with a sanitized polygon, we need to reverse
+			// the winding order for it to be correct.
+			if (newpoly->isSanitized() && mat2.matrix().determinant() <= 0) {
+				newgeom.reset(ClipperUtils::sanitize(*newpoly));
+			}
+		}
+		else if (geom->getDimension() == 3) {
+			shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(geom);
+			if (ps) {
+				// If we got a const object, make a copy
+				shared_ptr<PolySet> newps;
+				if (res.isConst()) newps.reset(new PolySet(*ps));
+				else newps = dynamic_pointer_cast<PolySet>(res.ptr());
+				newps->transform(matrix);
+				newgeom = newps;
+			}
+			else {
+				shared_ptr<const CGAL_Nef_polyhedron> N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom);
+				assert(N);
+				// If we got a const object, make a copy
+				shared_ptr<CGAL_Nef_polyhedron> newN;
+				if (res.isConst()) newN.reset((CGAL_Nef_polyhedron*)N->copy());
+				else newN = dynamic_pointer_cast<CGAL_Nef_polyhedron>(res.ptr());
+				newN->transform(matrix);
+				newgeom = newN;
+			}
+		}
+		else break;
+		res = ResultObject(newgeom);
+	}
+	return res;
+}
+
+/*!
+	Applies the transforms still pending for children of the given node,
+	see isLazyTransform(), replacing their geometry in visitedchildren.
+*/
+void GeometryEvaluator::applyPendingTransforms(const AbstractNode &node)
+{
+	for (auto &item : this->visitedchildren[node.index()]) {
+		auto pending = this->pendingtransforms.find(item.first->index());
+		if (pending == this->pendingtransforms.end()) continue;
+		item.second = applyTransforms(ResultObject(item.second), pending->second).constptr();
+		this->pendingtransforms.erase(pending);
+	}
+}
+
 /*!
 	input: List of 2D or 3D objects (not mixed)
 	output: Polygon2d or 3D PolySet
@@ -587,55 +931,35 @@ Response GeometryEvaluator::visit(State &state, const TransformNode &node)
 				// due to the way parse/eval works we can't currently distinguish between NaN and Inf
 				std::string loc = node.modinst->location().toRelativeString(this->tree.getDocumentPath());
 				PRINTB("WARNING: Transformation matrix contains Not-a-Number and/or Infinity - removing object. %s", loc);
+				for (const auto &item : this->visitedchildren[node.index()]) {
+					this->pendingtransforms.erase(item.first->index());
+				}
 			}
 			else {
-				// First union all children
-				ResultObject res = applyToChildren(node, OpenSCADOperator::UNION);
-				if ((geom = res.constptr())) {
-					if (geom->getDimension() == 2) {
-						shared_ptr<const Polygon2d> polygons = dynamic_pointer_cast<const Polygon2d>(geom);
-						assert(polygons);
-						
-						// If we got a const object, make a copy
-						shared_ptr<Polygon2d> newpoly;
-						if (res.isConst()) newpoly.reset(new Polygon2d(*polygons));
-						else newpoly = dynamic_pointer_cast<Polygon2d>(res.ptr());
-						
-						Transform2d mat2;
-						mat2.matrix() << 
-							node.matrix(0,0), node.matrix(0,1), node.matrix(0,3),
-							node.matrix(1,0), node.matrix(1,1), node.matrix(1,3),
-							node.matrix(3,0), node.matrix(3,1), node.matrix(3,3);
-						newpoly->transform(mat2);
-						// A 2D transformation may flip the winding order of a polygon.
-						// If that happens with a sanitized polygon, we need to reverse
-						// the winding order for it to be correct.
-						if (newpoly->isSanitized() && mat2.matrix().determinant() <= 0) {
-							geom.reset(ClipperUtils::sanitize(*newpoly));
-						}
-					}
-					else if (geom->getDimension() == 3) {
-						shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(geom);
-						if (ps) {
-							// If we got a const object, make a copy
-							shared_ptr<PolySet> newps;
-							if (res.isConst()) newps.reset(new PolySet(*ps));
-							else newps = dynamic_pointer_cast<PolySet>(res.ptr());
-							newps->transform(node.matrix);
-							geom = newps;
-						}
-						else {
-							shared_ptr<const CGAL_Nef_polyhedron> N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom);
-							assert(N);
-							// If we got a const object, make a copy
-							shared_ptr<CGAL_Nef_polyhedron> newN;
-							if (res.isConst()) newN.reset((CGAL_Nef_polyhedron*)N->copy());
-							else newN = dynamic_pointer_cast<CGAL_Nef_polyhedron>(res.ptr());
-							newN->transform(node.matrix);
-							geom = newN;
-						}
-					}
+				// First union all children. If the only child is a transform whose
+				// matrices haven't been applied yet, apply them before our own.
+				TransformList transforms;
+				ResultObject res;
+				auto &children = this->visitedchildren[node.index()];
+				auto pending = children.size() == 1 ?
+					this->pendingtransforms.find(children.front().first->index()) : this->pendingtransforms.end();
+				if (pending != this->pendingtransforms.end()) {
+					res = ResultObject(children.front().second);
+					transforms.swap(pending->second);
+					this->pendingtransforms.erase(pending);
+				}
+				else {
+					res = applyToChildren(node, OpenSCADOperator::UNION);
+				}
+				transforms.push_back(node.matrix);
+
+				if ((geom = res.constptr()) && isLazyTransform(state, node, *geom)) {
+					this->pendingtransforms[node.index()].swap(transforms);
+					addToParent(state, node, geom);
+					node.progress_report();
+					return Response::ContinueTraversal;
 				}
+				geom = applyTransforms(res, transforms).constptr();
 			}
 		}
 		else {
@@ -981,6 +1305,7 @@ Response GeometryEvaluator::visit(State &state, const ProjectionNode &node)
 	if (state.isPostfix()) {
 		shared_ptr<const class Geometry> geom;
 		if (!isSmartCached(node)) {
+			applyPendingTransforms(node);
 
 			if (!node.cut_mode) {
 				ClipperLib::Clipper sumclipper;
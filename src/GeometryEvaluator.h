@@ -9,11 +9,14 @@
 #include <list>
 #include <vector>
 #include <map>
+#include <chrono>
+#include <atomic>
+#include <string>
 
 class GeometryEvaluator : public NodeVisitor
 {
 public:
-	GeometryEvaluator(const class Tree &tree);
+	GeometryEvaluator(const class Tree &tree, bool inexact = false);
 	~GeometryEvaluator() {}
 
 	shared_ptr<const Geometry> evaluateGeometry(const AbstractNode &node, bool allownef);
@@ -35,6 +38,8 @@ public:
 	Response visit(State &state, const OffsetNode &node) override;
 
 	const Tree &getTree() const { return this->tree; }
+	// Evaluation throws ProgressCancelException as soon as *flag becomes true
+	void setCancelFlag(const std::atomic<bool> *flag) { this->cancelflag = flag; }
 
 private:
 	class ResultObject {
@@ -55,9 +60,15 @@ private:
 		shared_ptr<const Geometry> const_pointer;
 	};
 
+	// Matrices of nested transform nodes, innermost first
+	typedef std::vector<Transform3d, Eigen::aligned_allocator<Transform3d>> TransformList;
+
 	void smartCacheInsert(const AbstractNode &node, const shared_ptr<const Geometry> &geom);
 	shared_ptr<const Geometry> smartCacheGet(const AbstractNode &node, bool preferNef);
 	bool isSmartCached(const AbstractNode &node);
+	std::string cacheKey(const AbstractNode &node) const;
+	bool usesCorefinement(const AbstractNode &node) const;
+	double evaluationTime(const AbstractNode &node) const;
 	std::vector<const class Polygon2d *> collectChildren2D(const AbstractNode &node);
 	Geometry::Geometries collectChildren3D(const AbstractNode &node);
 	Polygon2d *applyMinkowski2D(const AbstractNode &node);
@@ -68,9 +79,24 @@ private:
 	ResultObject applyToChildren3D(const AbstractNode &node, OpenSCADOperator op);
 	ResultObject applyToChildren(const AbstractNode &node, OpenSCADOperator op);
 	void addToParent(const State &state, const AbstractNode &node, const shared_ptr<const Geometry> &geom);
+	bool isLazyTransform(const State &state, const class TransformNode &node, const Geometry &geom) const;
+	ResultObject applyTransforms(ResultObject res, const TransformList &transforms);
+	void applyPendingTransforms(const AbstractNode &node);
+	class PolySet *unionDisjointChildren(const AbstractNode &node);
 
 	std::map<int, Geometry::Geometries> visitedchildren;
+	// Matrices not yet applied to the geometry of the given (transform) node
+	// in visitedchildren. See isLazyTransform().
+	std::map<int, TransformList> pendingtransforms;
+	// Evaluation time in seconds of each node, see addToParent()
+	std::map<int, double> evaluationtimes;
+	std::chrono::steady_clock::time_point evaluationmark;
 	const Tree &tree;
+	// Use fast, inexact CSG operations. Such results are cached separately
+	bool inexact;
+	// Memoized results of usesCorefinement()
+	mutable std::map<int, bool> corefinement;
+	const std::atomic<bool> *cancelflag;
 	shared_ptr<const Geometry> root;
 
 public:
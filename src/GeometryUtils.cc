@@ -1,22 +1,123 @@
 #include "GeometryUtils.h"
+#include "polyset.h"
+#include "Polygon2d.h"
 #include "ext/libtess2/Include/tesselator.h"
 #include "printutils.h"
 #include "Reindexer.h"
 #include <boost/lexical_cast.hpp>
 #include <unordered_map>
+#include <algorithm>
+#include <memory>
+#include <mutex>
 #include <cmath>
 
 #include <boost/functional/hash.hpp>
 
-static void *stdAlloc(void* userData, unsigned int size) {
-	TESS_NOTUSED(userData);
-	return malloc(size);
-}
+/*!
+	Bump allocator backing libtess2.
 
-static void stdFree(void* userData, void* ptr) {
-	TESS_NOTUSED(userData);
-	free(ptr);
-}
+	libtess2 allocates every mesh vertex, half-edge, face and dictionary node
+	through TESSalloc. Since a tessellator only lives for the duration of one
+	polygon, nothing is freed individually; instead, all memory is released at
+	once by reset(), which keeps the blocks around for the next polygon.
+*/
+class TessArena {
+public:
+	TessArena() : current(0), offset(0) { }
+
+	void *alloc(size_t size) {
+		size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+		while (this->current < this->blocks.size()) {
+			auto &block = this->blocks[this->current];
+			if (this->offset + size <= block.size) {
+				auto ptr = block.data.get() + this->offset;
+				this->offset += size;
+				return ptr;
+			}
+			this->current++;
+			this->offset = 0;
+		}
+		this->blocks.emplace_back(std::max<size_t>(size, BLOCK_SIZE));
+		this->offset = size;
+		return this->blocks.back().data.get();
+	}
+
+	void reset() {
+		// Don't hang on to the memory of an unusually large polygon
+		if (this->blocks.size() > MAX_RETAINED_BLOCKS) this->blocks.clear();
+		this->current = 0;
+		this->offset = 0;
+	}
+
+	static void *tessAlloc(void *userData, unsigned int size) {
+		return static_cast<TessArena *>(userData)->alloc(size);
+	}
+
+	static void tessFree(void *userData, void *ptr) {
+		TESS_NOTUSED(userData);
+		TESS_NOTUSED(ptr);
+	}
+
+private:
+	enum : size_t {
+		ALIGNMENT = 16,
+		BLOCK_SIZE = 256 * 1024,
+		MAX_RETAINED_BLOCKS = 16
+	};
+
+	struct Block {
+		Block(size_t size) : data(new char[size]), size(size) { }
+		std::unique_ptr<char[]> data;
+		size_t size;
+	};
+	std::vector<Block> blocks;
+	size_t current;
+	size_t offset;
+};
+
+/*!
+	Per-polygon tessellation state: the arena used by libtess2 as well as
+	scratch buffers for passing contours to it.
+	Instances are pooled and reused, so repeated tessellation (possibly from
+	several threads) doesn't hit the system allocator.
+*/
+struct TessContext {
+	TessArena arena;
+	std::vector<TESSreal> contour;
+	std::vector<int> allindices;
+
+	class Handle {
+	public:
+		Handle() : context(acquire()) { }
+		~Handle() { release(std::move(this->context)); }
+		TessContext *operator->() const { return this->context.get(); }
+	private:
+		std::unique_ptr<TessContext> context;
+	};
+
+private:
+	static std::unique_ptr<TessContext> acquire() {
+		std::lock_guard<std::mutex> lock(poolmutex);
+		if (pool.empty()) return std::unique_ptr<TessContext>(new TessContext);
+		auto context = std::move(pool.back());
+		pool.pop_back();
+		return context;
+	}
+
+	static void release(std::unique_ptr<TessContext> context) {
+		context->arena.reset();
+		context->contour.clear();
+		context->allindices.clear();
+		std::lock_guard<std::mutex> lock(poolmutex);
+		pool.push_back(std::move(context));
+	}
+
+	static std::mutex poolmutex;
+	static std::vector<std::unique_ptr<TessContext>> pool;
+};
+
+std::mutex TessContext::poolmutex;
+std::vector<std::unique_ptr<TessContext>> TessContext::pool;
 
 typedef std::pair<int,int> IndexedEdge;
 
@@ -264,21 +365,23 @@ bool GeometryUtils::tessellatePolygonWithHoles(const std::vector<Vector3f>& vert
     normalvec = passednormal;
   }
 
+  TessContext::Handle context;
   TESSalloc ma;
   TESStesselator* tess = nullptr;
 
   memset(&ma, 0, sizeof(ma));
-  ma.memalloc = stdAlloc;
-  ma.memfree = stdFree;
+  ma.memalloc = TessArena::tessAlloc;
+  ma.memfree = TessArena::tessFree;
+  ma.userData = &context->arena;
   ma.extraVertices = 256; // realloc not provided, allow 256 extra vertices.
   
   if (!(tess = tessNewTess(&ma))) return true;
 
 	int numContours = 0;
-  std::vector<TESSreal> contour;
+  auto &contour = context->contour;
 	// Since libtess2's indices is based on the running number of points added, we need to map back
 	// to our indices. allindices does the mapping.
-	std::vector<int> allindices;
+	auto &allindices = context->allindices;
   for (const auto &face : cleanfaces) {
     contour.clear();
     for (auto idx : face) {
@@ -294,7 +397,10 @@ bool GeometryUtils::tessellatePolygonWithHoles(const std::vector<Vector3f>& vert
 		numContours++;
   }
 
-  if (!tessTesselate(tess, TESS_WINDING_ODD, TESS_CONSTRAINED_DELAUNAY_TRIANGLES, 3, 3, normalvec)) return -1;
+  if (!tessTesselate(tess, TESS_WINDING_ODD, TESS_CONSTRAINED_DELAUNAY_TRIANGLES, 3, 3, normalvec)) {
+    tessDeleteTess(tess);
+    return true;
+  }
 
   const auto vindices = tessGetVertexIndices(tess);
   const auto elements = tessGetElements(tess);
@@ -476,3 +582,72 @@ int GeometryUtils::findUnconnectedEdges(const std::vector<IndexedTriangle> &tria
 
 	return edges.size();
 }
+
+/*!
+	Returns a hash of the vertices of the given geometry, such that geometries
+	comparing equal using contentEqual() have the same hash.
+	2D PolySets are not supported since they carry their originating Polygon2d.
+*/
+size_t GeometryUtils::contentHash(const Geometry &geom)
+{
+	size_t seed = 0;
+	if (auto ps = dynamic_cast<const PolySet *>(&geom)) {
+		if (ps->getDimension() != 3) return 0;
+		boost::hash_combine(seed, ps->polygons.size());
+		for (const auto &p : ps->polygons) {
+			boost::hash_combine(seed, p.size());
+			for (const auto &v : p) {
+				for (int i = 0; i < 3; i++) boost::hash_combine(seed, v[i]);
+			}
+		}
+	}
+	else if (auto poly = dynamic_cast<const Polygon2d *>(&geom)) {
+		boost::hash_combine(seed, poly->outlines().size());
+		boost::hash_combine(seed, poly->isSanitized());
+		for (const auto &o : poly->outlines()) {
+			boost::hash_combine(seed, o.positive);
+			boost::hash_combine(seed, o.vertices.size());
+			for (const auto &v : o.vertices) {
+				boost::hash_combine(seed, v[0]);
+				boost::hash_combine(seed, v[1]);
+			}
+		}
+	}
+	else {
+		return 0;
+	}
+	boost::hash_combine(seed, geom.getConvexity());
+	return seed ? seed : 1;
+}
+
+/*!
+	Returns true if the given geometries have exactly the same vertices,
+	in the same order, so one can be used in place of the other.
+*/
+bool GeometryUtils::contentEqual(const Geometry &a, const Geometry &b)
+{
+	if (&a == &b) return true;
+	if (a.getConvexity() != b.getConvexity()) return false;
+
+	auto ps_a = dynamic_cast<const PolySet *>(&a);
+	auto ps_b = dynamic_cast<const PolySet *>(&b);
+	if (ps_a && ps_b) {
+		return ps_a->getDimension() == 3 && ps_b->getDimension() == 3 &&
+			ps_a->polygons == ps_b->polygons;
+	}
+
+	auto poly_a = dynamic_cast<const Polygon2d *>(&a);
+	auto poly_b = dynamic_cast<const Polygon2d *>(&b);
+	if (poly_a && poly_b) {
+		if (poly_a->isSanitized() != poly_b->isSanitized()) return false;
+		const auto &outlines_a = poly_a->outlines();
+		const auto &outlines_b = poly_b->outlines();
+		if (outlines_a.size() != outlines_b.size()) return false;
+		for (size_t i = 0; i < outlines_a.size(); i++) {
+			if (outlines_a[i].positive != outlines_b[i].positive ||
+					outlines_a[i].vertices != outlines_b[i].vertices) return false;
+		}
+		return true;
+	}
+	return false;
+}
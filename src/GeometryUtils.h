@@ -3,6 +3,8 @@
 #include "linalg.h"
 #include <vector>
 
+class Geometry;
+
 typedef std::vector<Vector3d> Polygon;
 typedef std::vector<Polygon> Polygons;
 
@@ -36,4 +38,9 @@ namespace GeometryUtils {
 
 	int findUnconnectedEdges(const std::vector<std::vector<IndexedFace>> &polygons);
 	int findUnconnectedEdges(const std::vector<IndexedTriangle> &triangles);
+
+	// Content hashing of 3D PolySets and Polygon2ds. Returns 0 for geometry
+	// which cannot be hashed, which never compares equal to anything else.
+	size_t contentHash(const Geometry &geom);
+	bool contentEqual(const Geometry &a, const Geometry &b);
 }
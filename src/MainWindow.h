@@ -9,11 +9,13 @@
 #include "builtincontext.h"
 #include "module.h"
 #include "ModuleInstantiation.h"
+#include "FileModule.h"
 #include "Tree.h"
 #include "memory.h"
 #include "editor.h"
 #include "export.h"
 #include <vector>
+#include <functional>
 #include <QMutex>
 #include <QElapsedTimer>
 #include <QTime>
@@ -47,12 +49,14 @@ public:
 	ModuleInstantiation root_inst;	// Top level instance
 	AbstractNode *absolute_root_node; // Result of tree evaluation
 	AbstractNode *root_node;		  // Root if the root modifier (!) is used
+	FileModule::TopLevelNodes toplevel_nodes; // Top level nodes of absolute_root_node, for reuse by the next instantiation
 	Tree tree;
 	EditorInterface *activeEditor;
 	TabManager *tabManager;
 
 #ifdef ENABLE_CGAL
 	shared_ptr<const class Geometry> root_geom;
+	bool root_geom_inexact; // root_geom was rendered using inexact CSG operations
 	class CGALRenderer *cgalRenderer;
 #endif
 #ifdef ENABLE_OPENCSG
@@ -110,6 +114,7 @@ private:
 	void updateCompileResult();
 	void compile(bool reload, bool forcedone = false, bool rebuildParameterWidget=true);
 	void compileCSG();
+	bool deferUntilBackgroundRenderDone(const std::function<void()> &continuation);
 	bool checkEditorModified();
 	QString dumpCSGTree(AbstractNode *root);
 
@@ -191,7 +196,9 @@ private slots:
 	void actionRender();
 	void actionRenderDone(shared_ptr<const class Geometry>);
 	void cgalRender();
+	void backgroundRenderDone(shared_ptr<const class Geometry>);
 #endif
+	void startBackgroundRender();
 	void actionCheckValidity();
 	void actionDisplayAST();
 	void actionDisplayCSGTree();
@@ -270,6 +277,7 @@ public slots:
 	void viewAll();
 	void animateUpdateDocChanged();
 	void animateUpdate();
+	void cancelBackgroundRender();
 	void dragEnterEvent(QDragEnterEvent *event) override;
 	void dropEvent(QDropEvent *event) override;
 	void helpAbout();
@@ -302,6 +310,12 @@ private:
 	class QTemporaryFile *tempFile;
 	class ProgressWidget *progresswidget;
 	class CGALWorker *cgalworker;
+	// Renders the previewed design in the background to fill the caches
+	class CGALWorker *backgroundworker;
+	// Called once the background render has stopped, see deferUntilBackgroundRenderDone()
+	std::vector<std::function<void()>> afterBackgroundRender;
+	// Whether the window is hidden, and closes once the background render has stopped
+	bool closeDeferred = false;
 	QMutex consolemutex;
 	EditorInterface *renderedEditor; // stores pointer to editor which has been most recently rendered
 	time_t includes_mtime;   // latest include mod time
@@ -3,6 +3,9 @@
 #include "FileModule.h"
 #include "printutils.h"
 #include "openscad.h"
+#include "ASTCache.h"
+#include "handle_dep.h"
+#include "parallel.h"
 
 #include <boost/format.hpp>
 
@@ -17,6 +20,13 @@
 
 ModuleCache *ModuleCache::inst = nullptr;
 
+namespace {
+	std::string get_cache_id(const struct stat &st)
+	{
+		return str(boost::format("%x.%x") % st.st_mtime % st.st_size);
+	}
+}
+
 /*!
 	Reevaluate the given file and all its dependencies and recompile anything
 	needing reevaluation. Updates the cache if necessary.
@@ -46,7 +56,7 @@ std::time_t ModuleCache::evaluate(const std::string &mainFile,const std::string
 	if (!valid) return 0;
 
 	// If the file is present, we'll always cache some result
-	std::string cache_id = str(boost::format("%x.%x") % st.st_mtime % st.st_size);
+	std::string cache_id = get_cache_id(st);
 
 	cache_entry &cacheEntry = this->entries[filename];
 	// Initialize entry, if new
@@ -90,8 +100,10 @@ std::time_t ModuleCache::evaluate(const std::string &mainFile,const std::string
 		}
 #endif
 
+		FileModule *prefetched_module = takePrefetched(filename, cache_id);
+		FileModule *cached_module = prefetched_module ? nullptr : ASTCache::load(filename, cache_id);
 		std::string text;
-		{
+		if (!prefetched_module && !cached_module) {
 			std::ifstream ifs(filename.c_str());
 			if (!ifs.is_open()) {
 				PRINTB("WARNING: Can't open library file '%s'\n", filename);
@@ -103,7 +115,18 @@ std::time_t ModuleCache::evaluate(const std::string &mainFile,const std::string
 		print_messages_push();
 		
 		delete cacheEntry.parsed_module;
-		lib_mod = parse(cacheEntry.parsed_module, text, filename, mainFile, false) ? cacheEntry.parsed_module : nullptr;
+		if (prefetched_module) {
+			lib_mod = cacheEntry.parsed_module = prefetched_module;
+			// Prefetched modules didn't print anything
+			ASTCache::store(*lib_mod, filename, cache_id, "");
+		}
+		else if (cached_module) {
+			lib_mod = cacheEntry.parsed_module = cached_module;
+		}
+		else {
+			lib_mod = parse(cacheEntry.parsed_module, text, filename, mainFile, false) ? cacheEntry.parsed_module : nullptr;
+			if (lib_mod) ASTCache::store(*lib_mod, filename, cache_id, print_messages_stack.back());
+		}
 		PRINTDB("compiled module: %s", filename);
 		cacheEntry.module = lib_mod;
 		cacheEntry.cache_id = cache_id;
@@ -120,9 +143,97 @@ std::time_t ModuleCache::evaluate(const std::string &mainFile,const std::string
 	return std::max({deps_mtime, cacheEntry.mtime, cacheEntry.includes_mtime});
 }
 
+/*!
+	Parses the given libraries in worker threads, if they aren't cached yet
+	or have changed, so evaluate() can pick up the results instead of
+	parsing the libraries one after another. The given filenames must be
+	absolute.
+
+	Parsing is speculative, like other work done on worker threads: any
+	library whose parsing would print something is left for evaluate() to
+	parse again, so messages stay the same.
+*/
+void ModuleCache::prefetch(const std::string &mainFile, const std::vector<std::string> &filenames)
+{
+	// The make command must run before parsing goes on, see handle_dep(), and
+	// the on-disk cache already saves most of the parsing
+	if (is_worker_thread() || make_command || ASTCache::enabled()) return;
+
+	struct job {
+		std::string filename;
+		prefetched_entry result;
+	};
+	std::vector<job> jobs;
+	for (const auto &filename : filenames) {
+		struct stat st;
+		if (StatCache::stat(filename.c_str(), st) != 0) continue;
+		std::string cache_id = get_cache_id(st);
+
+		auto entry = this->entries.find(filename);
+		if (entry != this->entries.end() && entry->second.cache_id == cache_id) continue;
+		auto prefetched = this->prefetched.find(filename);
+		if (prefetched != this->prefetched.end() && prefetched->second.cache_id == cache_id) continue;
+		jobs.emplace_back();
+		jobs.back().filename = filename;
+		jobs.back().result.cache_id = cache_id;
+	}
+	if (jobs.size() < 2) return;
+
+	parallel_for_each_index(jobs.size(), [&](size_t i) {
+		auto &job = jobs[i];
+		bool worker = is_worker_thread();
+		set_worker_thread(true);
+		auto recorder = set_dep_recorder(&job.result.dependencies);
+		try {
+			std::ifstream ifs(job.filename.c_str());
+			if (ifs.is_open()) {
+				std::string text = STR(ifs.rdbuf() << "\n\x03\n" << commandline_commands);
+				FileModule *module = nullptr;
+				if (parse(module, text, job.filename, mainFile, false)) job.result.module = module;
+				else delete module;
+			}
+		}
+		catch (...) {
+			// Parsed again by evaluate()
+		}
+		set_dep_recorder(recorder);
+		set_worker_thread(worker);
+	});
+
+	for (auto &job : jobs) {
+		if (!job.result.module) continue;
+		auto &prefetched = this->prefetched[job.filename];
+		delete prefetched.module;
+		prefetched = std::move(job.result);
+	}
+}
+
+/*!
+	Returns the module prefetch() parsed for the given version of the file,
+	if any, and handles the dependencies found while parsing it, like the
+	parser would have.
+*/
+FileModule *ModuleCache::takePrefetched(const std::string &filename, const std::string &cache_id)
+{
+	auto it = this->prefetched.find(filename);
+	if (it == this->prefetched.end()) return nullptr;
+	FileModule *module = it->second.module;
+	if (it->second.cache_id == cache_id) {
+		for (const auto &dependency : it->second.dependencies) handle_dep(dependency);
+	}
+	else {
+		delete module;
+		module = nullptr;
+	}
+	this->prefetched.erase(it);
+	return module;
+}
+
 void ModuleCache::clear()
 {
 	this->entries.clear();
+	for (const auto &prefetched : this->prefetched) delete prefetched.second.module;
+	this->prefetched.clear();
 }
 
 FileModule *ModuleCache::lookup(const std::string &filename)
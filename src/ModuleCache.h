@@ -3,6 +3,8 @@
 #include <string>
 #include <ctime>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 /*!
 	Caches FileModules based on their filenames
@@ -13,6 +15,7 @@ public:
 	static ModuleCache *instance() { if (!inst) inst = new ModuleCache; return inst; }
 
 	std::time_t evaluate(const std::string &mainFile, const std::string &filename, class FileModule *&module);
+	void prefetch(const std::string &mainFile, const std::vector<std::string> &filenames);
 	class FileModule *lookup(const std::string &filename);
 	size_t size() { return this->entries.size(); }
 	void clear();
@@ -32,4 +35,13 @@ private:
 		std::time_t includes_mtime{}; // time the includes last changed
 	};
 	std::unordered_map<std::string, cache_entry> entries;
+
+	// Modules parsed by prefetch(), not yet picked up by evaluate()
+	struct prefetched_entry {
+		class FileModule *module{};
+		std::string cache_id;
+		std::unordered_set<std::string> dependencies; // passed to handle_dep() by the parser
+	};
+	std::unordered_map<std::string, prefetched_entry> prefetched;
+	class FileModule *takePrefetched(const std::string &filename, const std::string &cache_id);
 };
@@ -4,6 +4,7 @@
 #include "expression.h"
 #include "exceptions.h"
 #include "printutils.h"
+#include "ASTCache.h"
 #include <boost/filesystem.hpp>
 
 namespace fs = boost::filesystem;
@@ -70,6 +71,32 @@ void IfElseModuleInstantiation::print(std::ostream &stream, const std::string &i
 	}
 }
 
+void ModuleInstantiation::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::ModuleInstantiation);
+	writer.write(this->loc);
+	writer.write(this->modname);
+	writer.write(this->modpath);
+	writer.write(this->arguments);
+	writer.write(this->tag_root);
+	writer.write(this->tag_highlight);
+	writer.write(this->tag_background);
+	writer.write(this->scope);
+}
+
+void IfElseModuleInstantiation::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::IfElseModuleInstantiation);
+	writer.write(this->loc);
+	writer.write(this->modpath);
+	writer.write(this->arguments.front().expr);
+	writer.write(this->tag_root);
+	writer.write(this->tag_highlight);
+	writer.write(this->tag_background);
+	writer.write(this->scope);
+	writer.write(this->else_scope);
+}
+
 /**
  * This is separated because PRINTB uses quite a lot of stack space
  * and the method using it evaluate()
@@ -15,6 +15,7 @@ public:
 
 	virtual void print(std::ostream &stream, const std::string &indent, const bool inlined) const;
 	void print(std::ostream &stream, const std::string &indent) const override { print(stream, indent, false); };
+	virtual void serialize(class ASTWriter &writer) const;
 	class AbstractNode *evaluate(const class Context *ctx) const;
 	std::vector<AbstractNode*> instantiateChildren(const Context *evalctx) const;
 
@@ -44,6 +45,7 @@ public:
 	~IfElseModuleInstantiation();
 	std::vector<AbstractNode*> instantiateElseChildren(const Context *evalctx) const;
 	void print(std::ostream &stream, const std::string &indent, const bool inlined) const final;
+	void serialize(class ASTWriter &writer) const final;
 
 	LocalScope else_scope;
 };
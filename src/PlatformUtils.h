@@ -7,6 +7,8 @@ namespace fs=boost::filesystem;
 
 #define STACK_BUFFER_SIZE (128 * 1024)
 #define STACK_LIMIT_DEFAULT (STACKSIZE - STACK_BUFFER_SIZE)
+// Worker threads get the default thread stack size, which is 512kB on Mac OS X
+#define STACK_LIMIT_WORKER (512 * 1024 - STACK_BUFFER_SIZE)
 
 namespace PlatformUtils {
         extern const char *OPENSCAD_FOLDER_NAME;
@@ -0,0 +1,336 @@
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "SoftwareRasterizer.h"
+#include "polyset.h"
+#include "polyset-utils.h"
+#include "Polygon2d.h"
+#include "degree_trig.h"
+#include "imageutils.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+// Size in pixels of the square tiles rasterized in parallel
+static const int TILE_SIZE = 64;
+
+// Lines are drawn on top of coplanar faces (similar to glPolygonOffset)
+static const float LINE_DEPTH_BIAS = 1e-4f;
+
+static void toRGBA(const Color4f &color, uint8_t rgba[4])
+{
+	for (int i = 0; i < 4; i++) {
+		rgba[i] = uint8_t(std::round(std::min(std::max(color[i], 0.0f), 1.0f) * 255.0f));
+	}
+}
+
+// Converts a pixel coordinate to int, clamped to [lo, hi]
+static int clampPixel(double v, int lo, int hi)
+{
+	if (!(v > lo)) return lo;
+	if (!(v < hi)) return hi;
+	return int(v);
+}
+
+SoftwareRasterizer::SoftwareRasterizer(const Camera &cam)
+	: width(std::max(int(cam.pixel_width), 1)), height(std::max(int(cam.pixel_height), 1)),
+		bgcolor(1.0f, 1.0f, 1.0f)
+{
+	// Same projection and modelview matrices as GLView::setupCamera(),
+	// followed by the object translation done in GLView::paintGL()
+	auto aspectratio = double(this->width) / this->height;
+	auto dist = cam.zoomValue();
+	this->projection.setZero();
+	switch (cam.projection) {
+	case Camera::ProjectionType::PERSPECTIVE: {
+		// gluPerspective(fov, aspectratio, 0.1 * dist, 100 * dist)
+		auto f = 1.0 / tan_degrees(cam.fov / 2);
+		auto znear = 0.1 * dist, zfar = 100 * dist;
+		this->projection(0, 0) = f / aspectratio;
+		this->projection(1, 1) = f;
+		this->projection(2, 2) = (zfar + znear) / (znear - zfar);
+		this->projection(2, 3) = 2 * zfar * znear / (znear - zfar);
+		this->projection(3, 2) = -1;
+		break;
+	}
+	default:
+	case Camera::ProjectionType::ORTHOGONAL: {
+		// glOrtho(-height * aspectratio, height * aspectratio, -height, height, -100 * dist, +100 * dist)
+		auto h = dist * tan_degrees(cam.fov / 2);
+		this->projection(0, 0) = 1 / (h * aspectratio);
+		this->projection(1, 1) = 1 / h;
+		this->projection(2, 2) = -1 / (100 * dist);
+		this->projection(3, 3) = 1;
+		break;
+	}
+	}
+
+	// gluLookAt(0, -dist, 0,  0, 0, 0,  0, 0, 1)
+	Transform3d view;
+	view.matrix() << 1, 0, 0, 0,
+		0, 0, 1, 0,
+		0, -1, 0, -dist,
+		0, 0, 0, 1;
+	Transform3d model(angle_axis_degrees(cam.object_rot.x(), Vector3d::UnitX()) *
+										angle_axis_degrees(cam.object_rot.y(), Vector3d::UnitY()) *
+										angle_axis_degrees(cam.object_rot.z(), Vector3d::UnitZ()));
+	model.translate(cam.object_trans);
+	this->modelview = (view * model).matrix();
+	this->mvp = this->projection * this->modelview;
+}
+
+Eigen::Vector4d SoftwareRasterizer::toClip(const Vector3d &v) const
+{
+	return this->mvp * Eigen::Vector4d(v[0], v[1], v[2], 1.0);
+}
+
+/*!
+	Perspective divide and viewport transform. Returns pixel coordinates
+	with the origin in the top left corner, and normalized device depth.
+*/
+Vector3d SoftwareRasterizer::toScreen(const Eigen::Vector4d &clip) const
+{
+	return Vector3d((clip[0] / clip[3] + 1) * 0.5 * this->width,
+									(1 - clip[1] / clip[3]) * 0.5 * this->height,
+									clip[2] / clip[3]);
+}
+
+/*!
+	Adds a triangle after clipping it against the near plane.
+	Everything beyond the far plane is rejected by the depth test.
+*/
+void SoftwareRasterizer::addTriangle(const Vector3d &p0, const Vector3d &p1, const Vector3d &p2, const Color4f &color)
+{
+	const Eigen::Vector4d in[3] = {toClip(p0), toClip(p1), toClip(p2)};
+	Eigen::Vector4d out[4];
+	int n = 0;
+	for (int i = 0; i < 3; i++) {
+		const auto &a = in[i];
+		const auto &b = in[(i + 1) % 3];
+		double da = a[2] + a[3], db = b[2] + b[3];
+		if (da >= 0) out[n++] = a;
+		if ((da >= 0) != (db >= 0)) out[n++] = a + (b - a) * (da / (da - db));
+	}
+	if (n < 3) return;
+
+	Triangle tri;
+	toRGBA(color, tri.color);
+	const Vector3d s0 = toScreen(out[0]);
+	for (int i = 1; i + 1 < n; i++) {
+		const Vector3d s1 = toScreen(out[i]);
+		const Vector3d s2 = toScreen(out[i + 1]);
+		tri.x[0] = s0[0]; tri.y[0] = s0[1]; tri.z[0] = s0[2];
+		tri.x[1] = s1[0]; tri.y[1] = s1[1]; tri.z[1] = s1[2];
+		tri.x[2] = s2[0]; tri.y[2] = s2[1]; tri.z[2] = s2[2];
+		this->triangles.push_back(tri);
+	}
+}
+
+void SoftwareRasterizer::addLine(const Vector3d &p0, const Vector3d &p1, const Color4f &color, bool depthtest)
+{
+	Eigen::Vector4d a = toClip(p0), b = toClip(p1);
+	double da = a[2] + a[3], db = b[2] + b[3];
+	if (da < 0 && db < 0) return;
+	if (da < 0) a = a + (b - a) * (da / (da - db));
+	else if (db < 0) b = b + (a - b) * (db / (db - da));
+
+	Line line;
+	toRGBA(color, line.color);
+	line.depthtest = depthtest;
+	const Vector3d s0 = toScreen(a), s1 = toScreen(b);
+	line.x[0] = s0[0]; line.y[0] = s0[1]; line.z[0] = s0[2];
+	line.x[1] = s1[0]; line.y[1] = s1[1]; line.z[1] = s1[2];
+	this->lines.push_back(line);
+}
+
+void SoftwareRasterizer::drawSurface(const PolySet &ps, const Color4f &color)
+{
+	PolySet ps_tri(3, ps.convexValue());
+	PolysetUtils::tessellate_faces(ps, ps_tri);
+
+	// GLView sets up two opposing directional lights in eye space and an
+	// ambient term of 0.2, so exactly one of them lights each face.
+	const Vector3d light = Vector3d(-1, 1, 1).normalized();
+	const Matrix3d normalmatrix = this->modelview.topLeftCorner<3, 3>();
+	for (const auto &t : ps_tri.polygons) {
+		if (t.size() != 3) continue;
+		Vector3d normal = normalmatrix * (t[1] - t[0]).cross(t[2] - t[0]);
+		double len = normal.norm();
+		double shading = 0.2 + (len > 0 ? std::abs(normal.dot(light)) / len : 0);
+		Color4f shaded(color[0] * shading, color[1] * shading, color[2] * shading, color[3]);
+		addTriangle(t[0], t[1], t[2], shaded);
+	}
+}
+
+void SoftwareRasterizer::drawEdges(const PolySet &ps, const Color4f &color)
+{
+	for (const auto &p : ps.polygons) {
+		for (size_t i = 0; i < p.size(); i++) {
+			addLine(p[i], p[(i + 1) % p.size()], color, true);
+		}
+	}
+}
+
+void SoftwareRasterizer::drawPolygon2d(const Polygon2d &poly, const Color4f &facecolor, const Color4f &edgecolor)
+{
+	std::unique_ptr<PolySet> ps(poly.tessellate());
+	if (ps) {
+		for (const auto &t : ps->polygons) {
+			if (t.size() == 3) addTriangle(t[0], t[1], t[2], facecolor);
+		}
+	}
+	// Like CGALRenderer, 2D edges are drawn without depth test
+	for (const auto &o : poly.outlines()) {
+		const auto &v = o.vertices;
+		for (size_t i = 0; i < v.size(); i++) {
+			const auto &a = v[i], &b = v[(i + 1) % v.size()];
+			addLine(Vector3d(a[0], a[1], 0), Vector3d(b[0], b[1], 0), edgecolor, false);
+		}
+	}
+}
+
+/*!
+	Narrows the parameter range [tmin, tmax] of the line p + t*d to where it's
+	within [lo, hi]. Returns false if that part is empty.
+*/
+static bool clipLine(double p, double d, double lo, double hi, double &tmin, double &tmax)
+{
+	if (d == 0) return p >= lo && p <= hi;
+	double t0 = (lo - p) / d, t1 = (hi - p) / d;
+	if (t0 > t1) std::swap(t0, t1);
+	tmin = std::max(tmin, t0);
+	tmax = std::min(tmax, t1);
+	return tmin <= tmax;
+}
+
+/*!
+	Rasterizes all primitives into the tile [x0,x1) x [y0,y1).
+	Tiles don't overlap, so they can be rasterized concurrently.
+*/
+void SoftwareRasterizer::rasterizeTile(int x0, int y0, int x1, int y1,
+																			 const std::vector<uint32_t> &tris, const std::vector<uint32_t> &lns)
+{
+	for (auto idx : tris) {
+		const auto &t = this->triangles[idx];
+		double area = (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (t.y[1] - t.y[0]) * (t.x[2] - t.x[0]);
+		if (area == 0) continue;
+		double invarea = 1.0 / area;
+		int minx = clampPixel(std::floor(std::min({t.x[0], t.x[1], t.x[2]})), x0, x1 - 1);
+		int maxx = clampPixel(std::ceil(std::max({t.x[0], t.x[1], t.x[2]})), x0, x1 - 1);
+		int miny = clampPixel(std::floor(std::min({t.y[0], t.y[1], t.y[2]})), y0, y1 - 1);
+		int maxy = clampPixel(std::ceil(std::max({t.y[0], t.y[1], t.y[2]})), y0, y1 - 1);
+		for (int y = miny; y <= maxy; y++) {
+			double py = y + 0.5;
+			for (int x = minx; x <= maxx; x++) {
+				double px = x + 0.5;
+				// Barycentric coordinates, normalized by the signed area so
+				// that both windings have all positive weights inside
+				double w0 = ((t.x[2] - t.x[1]) * (py - t.y[1]) - (t.y[2] - t.y[1]) * (px - t.x[1])) * invarea;
+				double w1 = ((t.x[0] - t.x[2]) * (py - t.y[2]) - (t.y[0] - t.y[2]) * (px - t.x[2])) * invarea;
+				double w2 = 1.0 - w0 - w1;
+				if (w0 < 0 || w1 < 0 || w2 < 0) continue;
+				float z = float(w0 * t.z[0] + w1 * t.z[1] + w2 * t.z[2]);
+				size_t i = size_t(y) * this->width + x;
+				if (z < this->depth[i]) {
+					this->depth[i] = z;
+					std::copy(t.color, t.color + 4, &this->pixels[4 * i]);
+				}
+			}
+		}
+	}
+
+	// Lines are drawn two pixels wide, like GLView's glLineWidth(2)
+	for (auto idx : lns) {
+		const auto &l = this->lines[idx];
+		double dx = l.x[1] - l.x[0], dy = l.y[1] - l.y[0];
+		// Only step along the part of the line crossing this tile
+		double tmin = 0, tmax = 1;
+		if (!clipLine(l.x[0], dx, x0 - 1, x1 + 1, tmin, tmax) ||
+				!clipLine(l.y[0], dy, y0 - 1, y1 + 1, tmin, tmax)) continue;
+		int steps = std::max(1, int(std::ceil((tmax - tmin) * std::max(std::abs(dx), std::abs(dy)))));
+		bool steep = std::abs(dy) > std::abs(dx);
+		for (int s = 0; s <= steps; s++) {
+			double f = tmin + (tmax - tmin) * s / steps;
+			int x = int(std::floor(l.x[0] + f * dx)), y = int(std::floor(l.y[0] + f * dy));
+			float z = float(l.z[0] + f * (l.z[1] - l.z[0])) - LINE_DEPTH_BIAS;
+			for (int k = 0; k < 2; k++) {
+				int px = steep ? x + k : x, py = steep ? y : y + k;
+				if (px < x0 || px >= x1 || py < y0 || py >= y1) continue;
+				size_t i = size_t(py) * this->width + px;
+				if (l.depthtest && !(z <= this->depth[i])) continue;
+				if (l.depthtest) this->depth[i] = z;
+				std::copy(l.color, l.color + 4, &this->pixels[4 * i]);
+			}
+		}
+	}
+}
+
+void SoftwareRasterizer::paint()
+{
+	uint8_t bg[4];
+	toRGBA(this->bgcolor, bg);
+	bg[3] = 255;
+	this->pixels.resize(size_t(this->width) * this->height * 4);
+	for (size_t i = 0; i < this->pixels.size(); i += 4) std::copy(bg, bg + 4, &this->pixels[i]);
+	this->depth.assign(size_t(this->width) * this->height, 1.0f);
+
+	// Bin primitives into the tiles overlapped by their bounding boxes
+	const int tilesx = (this->width + TILE_SIZE - 1) / TILE_SIZE;
+	const int tilesy = (this->height + TILE_SIZE - 1) / TILE_SIZE;
+	std::vector<std::vector<uint32_t>> tiletris(tilesx * tilesy), tilelines(tilesx * tilesy);
+	auto bin = [&](const float *xs, const float *ys, int n, uint32_t idx, std::vector<std::vector<uint32_t>> &bins) {
+		float minx = *std::min_element(xs, xs + n), maxx = *std::max_element(xs, xs + n);
+		float miny = *std::min_element(ys, ys + n), maxy = *std::max_element(ys, ys + n);
+		if (!(maxx >= -1 && maxy >= -1 && minx <= this->width && miny <= this->height)) return;
+		int tx0 = clampPixel(minx - 1, 0, this->width - 1) / TILE_SIZE;
+		int tx1 = clampPixel(maxx + 1, 0, this->width - 1) / TILE_SIZE;
+		int ty0 = clampPixel(miny - 1, 0, this->height - 1) / TILE_SIZE;
+		int ty1 = clampPixel(maxy + 1, 0, this->height - 1) / TILE_SIZE;
+		for (int ty = ty0; ty <= ty1; ty++) {
+			for (int tx = tx0; tx <= tx1; tx++) bins[ty * tilesx + tx].push_back(idx);
+		}
+	};
+	for (uint32_t i = 0; i < this->triangles.size(); i++) {
+		bin(this->triangles[i].x, this->triangles[i].y, 3, i, tiletris);
+	}
+	for (uint32_t i = 0; i < this->lines.size(); i++) {
+		bin(this->lines[i].x, this->lines[i].y, 2, i, tilelines);
+	}
+
+	parallel_for_each_index(tilesx * tilesy, [&](size_t tile) {
+		int tx = int(tile) % tilesx, ty = int(tile) / tilesx;
+		rasterizeTile(tx * TILE_SIZE, ty * TILE_SIZE,
+									std::min(this->width, (tx + 1) * TILE_SIZE), std::min(this->height, (ty + 1) * TILE_SIZE),
+									tiletris[tile], tilelines[tile]);
+	});
+}
+
+bool SoftwareRasterizer::save(std::ostream &output) const
+{
+	return write_png(output, const_cast<unsigned char *>(this->pixels.data()), this->width, this->height);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include "linalg.h"
+#include "Camera.h"
+#include "colormap.h"
+
+class PolySet;
+class Polygon2d;
+
+/*!
+	CPU rasterizer used for exporting rendered geometry to PNG without an
+	OpenGL context.
+
+	It reproduces what CGALRenderer draws into an OffscreenView: the same
+	camera setup as GLView::setupCamera(), z-buffered triangles lit like
+	GLView's two opposing directional lights, and optional edges.
+	Primitives are collected by the draw*() calls and rasterized by paint(),
+	which splits the image into tiles rendered in parallel.
+*/
+class SoftwareRasterizer
+{
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	SoftwareRasterizer(const Camera &camera);
+
+	void setBackgroundColor(const Color4f &color) { this->bgcolor = color; }
+
+	// Lit, depth tested faces of a 3D PolySet
+	void drawSurface(const PolySet &ps, const Color4f &color);
+	// Polygon outlines of a 3D PolySet, depth tested
+	void drawEdges(const PolySet &ps, const Color4f &color);
+	// Unlit 2D polygon in the z=0 plane, with its outlines drawn on top
+	void drawPolygon2d(const Polygon2d &poly, const Color4f &facecolor, const Color4f &edgecolor);
+
+	void paint();
+	bool save(std::ostream &output) const;
+
+private:
+	struct Triangle {
+		float x[3], y[3], z[3];
+		uint8_t color[4];
+	};
+	struct Line {
+		float x[2], y[2], z[2];
+		uint8_t color[4];
+		bool depthtest;
+	};
+
+	Eigen::Vector4d toClip(const Vector3d &v) const;
+	Vector3d toScreen(const Eigen::Vector4d &clip) const;
+	void addTriangle(const Vector3d &p0, const Vector3d &p1, const Vector3d &p2, const Color4f &color);
+	void addLine(const Vector3d &p0, const Vector3d &p1, const Color4f &color, bool depthtest);
+	void rasterizeTile(int x0, int y0, int x1, int y1,
+										 const std::vector<uint32_t> &triangles, const std::vector<uint32_t> &lines);
+
+	int width;
+	int height;
+	Eigen::Matrix4d projection;
+	Eigen::Matrix4d modelview;
+	Eigen::Matrix4d mvp;
+	Color4f bgcolor;
+
+	std::vector<Triangle> triangles;
+	std::vector<Line> lines;
+	std::vector<unsigned char> pixels; // RGBA, top row first
+	std::vector<float> depth;
+};
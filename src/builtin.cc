@@ -3,6 +3,9 @@
 #include "module.h"
 #include "expression.h"
 
+#include <algorithm>
+#include <iterator>
+
 std::unordered_map<std::string, const std::vector<std::string>> Builtins::keywordList;
 
 Builtins *Builtins::instance(bool erase)
@@ -102,6 +105,22 @@ std::string Builtins::isDeprecated(const std::string &name) const
 	return {};
 }
 
+bool Builtins::isPureFunction(const std::string &name)
+{
+	static const char *impure[] = { "rands", "parent_module", "dxf_dim", "dxf_cross" };
+	const auto &functions = Builtins::instance()->functions;
+	return functions.find(name) != functions.end() &&
+		std::find(std::begin(impure), std::end(impure), name) == std::end(impure);
+}
+
+bool Builtins::isPureModule(const std::string &name)
+{
+	static const char *impure[] = { "echo", "assert" };
+	const auto &modules = Builtins::instance()->modules;
+	return modules.find(name) != modules.end() &&
+		std::find(std::begin(impure), std::end(impure), name) == std::end(impure);
+}
+
 Builtins::Builtins()
 {
 	this->assignments.emplace_back("$fn", make_shared<Literal>(0.0));
@@ -18,6 +18,10 @@ public:
 	static void init(const std::string &name, class AbstractFunction *function, const std::vector<std::string> &calltipList);
 	void initialize();
 	std::string isDeprecated(const std::string &name) const;
+	// Whether the given builtin function exists, and its results only depend on its arguments
+	static bool isPureFunction(const std::string &name);
+	// Whether the given builtin module exists, and doesn't print messages of its own
+	static bool isPureModule(const std::string &name);
 
 	const AssignmentList &getAssignments() const { return this->assignments; }
 	const FunctionContainer &getFunctions() const { return this->functions; }
@@ -45,32 +45,62 @@
 #pragma once
 
 #include <unordered_map>
+#include <map>
+#include <functional>
+#include <cstdint>
 #include <boost/format.hpp>
 #include "printutils.h"
 
+/*!
+	Cache with a limited total cost, typically the memory size of the objects.
+
+	Each object may also be given a benefit, i.e. the cost of recreating it
+	(typically the time it took to compute). When the cache is full, objects
+	are evicted using the GreedyDual-Size algorithm: the object with the lowest
+	priority L + benefit/cost is evicted first, where L is the priority of the
+	last evicted object. Priorities are refreshed on access, so objects
+	which are cheap to recreate relative to their size, or which haven't been
+	used for a while, go first. Among equal priorities (e.g. if no benefits are
+	given), the least recently used object is evicted.
+
+	Optionally, a compactor may be given, which is offered each object before
+	it is evicted. If it manages to shrink the object (e.g. by serializing it),
+	the object stays cached at its new cost. The user of the cache is
+	responsible for restoring the object and reporting its new cost using
+	setCost().
+*/
 template <class Key, class T>
 class Cache
 {
 	struct Node {
-		inline Node() : keyPtr(nullptr), t(nullptr), c(0), p(nullptr), n(nullptr) {}
-		inline Node(T *data, size_t cost) : keyPtr(nullptr), t(data), c(cost), p(nullptr), n(nullptr) {}
-		const Key *keyPtr; T *t; size_t c; Node *p,*n;
+		inline Node() : keyPtr(nullptr), t(nullptr), c(0), b(0), h(0), s(0), z(false) {}
+		inline Node(T *data, size_t cost, double benefit) : keyPtr(nullptr), t(data), c(cost), b(benefit), h(0), s(0), z(false) {}
+		const Key *keyPtr; T *t; size_t c; double b, h; uint64_t s; bool z;
 	};
 	typedef typename std::unordered_map<Key, Node> map_type;
 	typedef typename map_type::iterator iterator_type;
 	typedef typename map_type::value_type value_type;
+	// Eviction order: (priority, access sequence number)
+	typedef std::pair<double, uint64_t> priority_type;
 
 	std::unordered_map<Key, Node> hash;
-	Node *f, *l;
-	void *unused;
+	std::map<priority_type, Node *> queue;
 	size_t mx, total;
-
+	double inflation, benefit;
+	uint64_t sequence;
+	size_t hits, evictions;
+	std::function<size_t(T &)> compactor;
+
+	inline void touch(Node &n) {
+		if (n.s) queue.erase(priority_type(n.h, n.s));
+		n.h = inflation + n.b / (n.c > 0 ? n.c : 1);
+		n.s = ++sequence;
+		queue.emplace(priority_type(n.h, n.s), &n);
+	}
 	inline void unlink(Node &n) {
-		if (n.p) n.p->n = n.n;
-		if (n.n) n.n->p = n.p;
-		if (l == &n) l = n.p;
-		if (f == &n) f = n.n;
+		queue.erase(priority_type(n.h, n.s));
 		total -= n.c;
+		benefit -= n.b;
 		T *obj = n.t;
 		hash.erase(*n.keyPtr);
 		delete obj;
@@ -80,39 +110,48 @@ class Cache
 		if (i == hash.end()) return nullptr;
 
 		Node &n = i->second;
-		if (f != &n) {
-			if (n.p) n.p->n = n.n;
-			if (n.n) n.n->p = n.p;
-			if (l == &n) l = n.p;
-			n.p = nullptr;
-			n.n = f;
-			f->p = &n;
-			f = &n;
-		}
+		touch(n);
+		hits++;
 		return n.t;
 	}
 
 public:
 	inline explicit Cache(size_t maxCost = 100)
-		: f(nullptr), l(nullptr), unused(nullptr), mx(maxCost), total(0) { }
+		: mx(maxCost), total(0), inflation(0), benefit(0), sequence(0), hits(0), evictions(0) { }
 	inline ~Cache() { clear(); }
 
 	inline size_t maxCost() const { return mx; }
 	void setMaxCost(size_t m) { mx = m; trim(mx); }
 	inline size_t totalCost() const { return total; }
+	inline double totalBenefit() const { return benefit; }
+	inline size_t hitCount() const { return hits; }
+	inline size_t evictionCount() const { return evictions; }
+
+	/*!
+		Sets a function which is called with an object about to be evicted.
+		It should return the new, lower, cost if it compacted the object, or
+		the current cost if the object should be evicted.
+	*/
+	void setCompactor(const std::function<size_t(T &)> &c) { compactor = c; }
+	bool setCost(const Key &key, size_t cost);
 
 	inline size_t size() const { return hash.size(); }
 	inline bool empty() const { return hash.empty(); }
 
 	void clear() {
-		while (f) { delete f->t; f = f->n; }
-		hash.clear(); l = nullptr; total = 0;
+		for (auto &item : hash) delete item.second.t;
+		hash.clear(); queue.clear(); total = 0; inflation = 0; benefit = 0;
 	}
 
-	bool insert(const Key &key, T *object, size_t cost);
+	bool insert(const Key &key, T *object, size_t cost, double benefit = 0);
 	T *object(const Key &key) const { return const_cast<Cache<Key,T>*>(this)->relink(key); }
 	inline bool contains(const Key &key) const { return hash.find(key) != hash.end(); }
 	T *operator[](const Key &key) const { return object(key); }
+	// Like object(), but doesn't count as a hit or change the eviction order
+	T *peek(const Key &key) const {
+		auto i = hash.find(key);
+		return i == hash.end() ? nullptr : i->second.t;
+	}
 
 	bool remove(const Key &key);
 	T *take(const Key &key);
@@ -139,7 +178,7 @@ inline T *Cache<Key,T>::take(const Key &key)
 	iterator_type i = hash.find(key);
 	if (i == hash.end()) return 0;
 
-	Node &n = *i;
+	Node &n = i->second;
 	T *t = n.t;
 	n.t = 0;
 	unlink(n);
@@ -147,7 +186,7 @@ inline T *Cache<Key,T>::take(const Key &key)
 }
 
 template <class Key, class T>
-bool Cache<Key,T>::insert(const Key &akey, T *aobject, size_t acost)
+bool Cache<Key,T>::insert(const Key &akey, T *aobject, size_t acost, double abenefit)
 {
 	remove(akey);
 	if (acost > mx) {
@@ -155,29 +194,61 @@ bool Cache<Key,T>::insert(const Key &akey, T *aobject, size_t acost)
 		return false;
 	}
 	trim(mx - acost);
-	Node node(aobject, acost);
+	Node node(aobject, acost, abenefit);
 	hash[akey] = node;
 	iterator_type i = hash.find(akey);
 	total += acost;
+	benefit += abenefit;
 	Node *n = &i->second;
 	n->keyPtr = &i->first;
-	if (f) f->p = n;
-	n->n = f;
-	f = n;
-	if (!l) l = f;
+	touch(*n);
 	return true;
 }
 
+/*!
+	Updates the cost of an object, e.g. after a compacted object has been
+	restored. May evict other objects, or the object itself.
+	Returns false if the object is no longer in the cache.
+*/
+template <class Key, class T>
+bool Cache<Key,T>::setCost(const Key &key, size_t cost)
+{
+	iterator_type i = hash.find(key);
+	if (i == hash.end()) return false;
+
+	Node &n = i->second;
+	total = total - n.c + cost;
+	n.c = cost;
+	n.z = false;
+	touch(n);
+	if (cost > mx) {
+		unlink(n);
+		return false;
+	}
+	trim(mx);
+	return contains(key);
+}
+
 template <class Key, class T>
 void Cache<Key,T>::trim(size_t m)
 {
-	Node *n = l;
-	while (n && total > m) {
-		Node *u = n;
-		n = n->p;
+	while (!queue.empty() && total > m) {
+		Node *u = queue.begin()->second;
+		inflation = u->h;
+		if (compactor && !u->z) {
+			u->z = true;
+			size_t cost = compactor(*u->t);
+			if (cost < u->c) {
+				total -= u->c - cost;
+				u->c = cost;
+				touch(*u);
+				continue;
+			}
+		}
 #ifdef DEBUG
-		PRINTB("Trimming cache: %1% (%2% bytes)", u->keyPtr->substr(0, 40) % u->c);
+		PRINTB("Trimming cache: %1% (%2% bytes, %3% s)", u->keyPtr->substr(0, 40) % u->c % u->b);
 #endif
+		evictions++;
 		unlink(*u);
 	}
 }
@@ -0,0 +1,180 @@
+// Inexact CSG operations on triangle meshes, used for fast renders.
+// See GeometryEvaluator::applyToChildren3D().
+
+#ifdef ENABLE_CGAL
+
+#include "cgalutils.h"
+#include "polyset.h"
+#include "polyset-utils.h"
+#include "printutils.h"
+#include "Reindexer.h"
+#include "node.h"
+
+#include "cgal.h"
+#pragma push_macro("NDEBUG")
+#undef NDEBUG
+#include <CGAL/version.h>
+#if CGAL_VERSION_NR >= CGAL_VERSION_NUMBER(4,10,0)
+#include <CGAL/Surface_mesh.h>
+#include <CGAL/boost/graph/helpers.h>
+#include <CGAL/Polygon_mesh_processing/corefinement.h>
+#include <CGAL/Polygon_mesh_processing/orientation.h>
+#include <CGAL/Polygon_mesh_processing/self_intersections.h>
+#define ENABLE_COREFINEMENT
+#endif
+#pragma pop_macro("NDEBUG")
+
+#ifdef ENABLE_COREFINEMENT
+
+namespace PMP = CGAL::Polygon_mesh_processing;
+// Lazy exact kernel: predicates and constructions are evaluated using
+// interval arithmetic, and only fall back to exact numbers when needed.
+typedef CGAL::Epeck KernelEpeck;
+typedef CGAL::Surface_mesh<KernelEpeck::Point_3> SurfaceMesh;
+
+namespace {
+
+	/*!
+		Creates a closed triangle mesh bounding a volume from the given PolySet.
+		Returns false if that's not possible, e.g. if the PolySet is not manifold
+		or intersects itself. Such meshes cannot be handled by corefinement.
+	*/
+	bool createMeshFromPolySet(const PolySet &ps, SurfaceMesh &mesh)
+	{
+		PolySet ps_tri(3, ps.convexValue());
+		PolysetUtils::tessellate_faces(ps, ps_tri);
+
+		Reindexer<Vector3d> vertices;
+		std::vector<SurfaceMesh::Vertex_index> indices;
+		for (const auto &p : ps_tri.polygons) {
+			SurfaceMesh::Vertex_index face[3];
+			for (int i = 0; i < 3; i++) {
+				size_t idx = vertices.lookup(p[i]);
+				if (idx == indices.size()) {
+					indices.push_back(mesh.add_vertex(KernelEpeck::Point_3(p[i][0], p[i][1], p[i][2])));
+				}
+				face[i] = indices[idx];
+			}
+			if (mesh.add_face(face[0], face[1], face[2]) == SurfaceMesh::null_face()) return false;
+		}
+
+		if (!CGAL::is_closed(mesh) || PMP::does_self_intersect(mesh)) return false;
+		if (!PMP::is_outward_oriented(mesh)) PMP::reverse_face_orientations(mesh);
+		return true;
+	}
+
+	bool createMeshFromGeometry(const Geometry &geom, SurfaceMesh &mesh)
+	{
+		if (auto ps = dynamic_cast<const PolySet *>(&geom)) {
+			return createMeshFromPolySet(*ps, mesh);
+		}
+		if (auto N = dynamic_cast<const CGAL_Nef_polyhedron *>(&geom)) {
+			PolySet ps(3);
+			if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, ps)) return false;
+			return createMeshFromPolySet(ps, mesh);
+		}
+		return false;
+	}
+
+	void createPolySetFromMesh(const SurfaceMesh &mesh, PolySet &ps)
+	{
+		for (auto f : mesh.faces()) {
+			ps.append_poly();
+			for (auto v : CGAL::vertices_around_face(mesh.halfedge(f), mesh)) {
+				const auto &p = mesh.point(v);
+				ps.append_vertex(CGAL::to_double(p.x()), CGAL::to_double(p.y()), CGAL::to_double(p.z()));
+			}
+		}
+	}
+
+}
+
+#endif // ENABLE_COREFINEMENT
+
+namespace CGALUtils {
+
+	/*!
+		Applies a union, intersection or difference using corefinement of
+		triangle meshes with a lazy exact kernel. This is a lot faster than
+		Nef polyhedra, but the result is rounded to doubles and is only
+		approximately correct in degenerate cases.
+
+		Returns nullptr if any of the children cannot be represented as a
+		closed, non-self-intersecting mesh or if corefinement fails, in which
+		case the caller should fall back to applyOperator().
+	*/
+	PolySet *applyOperatorInexact(const Geometry::Geometries &children, OpenSCADOperator op)
+	{
+#ifdef ENABLE_COREFINEMENT
+		if (op != OpenSCADOperator::UNION &&
+				op != OpenSCADOperator::INTERSECTION &&
+				op != OpenSCADOperator::DIFFERENCE) return nullptr;
+
+		SurfaceMesh result;
+		bool first = true;
+		CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+		try {
+			for (const auto &item : children) {
+				const auto &chgeom = item.second;
+				if (chgeom->isEmpty()) {
+					// Intersecting something with nothing results in nothing
+					if (op == OpenSCADOperator::INTERSECTION ||
+							(op == OpenSCADOperator::DIFFERENCE && first)) {
+						CGAL::set_error_behaviour(old_behaviour);
+						return new PolySet(3);
+					}
+					continue;
+				}
+
+				SurfaceMesh mesh;
+				if (!createMeshFromGeometry(*chgeom, mesh)) {
+					CGAL::set_error_behaviour(old_behaviour);
+					return nullptr;
+				}
+				if (first) {
+					result = mesh;
+					first = false;
+					continue;
+				}
+
+				SurfaceMesh out;
+				bool ok = false;
+				switch (op) {
+				case OpenSCADOperator::UNION:
+					ok = PMP::corefine_and_compute_union(result, mesh, out);
+					break;
+				case OpenSCADOperator::INTERSECTION:
+					ok = PMP::corefine_and_compute_intersection(result, mesh, out);
+					break;
+				case OpenSCADOperator::DIFFERENCE:
+					ok = PMP::corefine_and_compute_difference(result, mesh, out);
+					break;
+				default:
+					break;
+				}
+				if (!ok) {
+					CGAL::set_error_behaviour(old_behaviour);
+					return nullptr;
+				}
+				result = out;
+				if (item.first) item.first->progress_report();
+			}
+		}
+		catch (const CGAL::Failure_exception &e) {
+			PRINTDB("CGAL error in CGALUtils::applyOperatorInexact: %s", e.what());
+			CGAL::set_error_behaviour(old_behaviour);
+			return nullptr;
+		}
+		CGAL::set_error_behaviour(old_behaviour);
+
+		auto ps = new PolySet(3);
+		createPolySetFromMesh(result, *ps);
+		return ps;
+#else
+		return nullptr;
+#endif
+	}
+
+}
+
+#endif // ENABLE_CGAL
@@ -10,6 +10,10 @@
 CGALWorker::CGALWorker()
 {
 	this->tree = nullptr;
+	this->inexact = false;
+	this->background = false;
+	this->cancelled = false;
+	this->running = false;
 	this->thread = new QThread();
 	if (this->thread->stackSize() < 1024*1024) this->thread->setStackSize(1024*1024);
 	connect(this->thread, SIGNAL(started()), this, SLOT(work()));
@@ -21,17 +25,57 @@ CGALWorker::~CGALWorker()
 	delete this->thread;
 }
 
-void CGALWorker::start(const Tree &tree)
+void CGALWorker::start(const Tree &tree, bool inexact)
 {
 	this->tree = &tree;
+	this->inexact = inexact;
+	this->background = false;
+	this->cancelled = false;
+	this->running = true;
 	this->thread->start();
 }
 
+/*!
+	Evaluates the geometry of the given tree at low priority, for the sole
+	purpose of filling the geometry caches. The nodes of the tree must stay
+	alive until the render is done, see cancel() and isRunning().
+*/
+void CGALWorker::startBackground(const Tree &tree)
+{
+	// The thread of a previous render may still be about to quit after done()
+	this->thread->wait();
+	this->backgroundtree.reset(new Tree(tree.root()));
+	this->backgroundtree->setDocumentPath(tree.getDocumentPath());
+	this->tree = this->backgroundtree.get();
+	this->inexact = false;
+	this->background = true;
+	this->cancelled = false;
+	this->running = true;
+	this->thread->start(QThread::LowestPriority);
+}
+
+void CGALWorker::cancel()
+{
+	this->cancelled = true;
+}
+
+void CGALWorker::wait()
+{
+	this->thread->wait();
+}
+
 void CGALWorker::work()
 {
 	shared_ptr<const Geometry> root_geom;
+	// Background renders are also cancelled between the CGAL operations of a
+	// node, and their messages are discarded: the user is only previewing
+	if (this->background) {
+		progress_set_cancel_flag(&this->cancelled);
+		set_muted_thread(true);
+	}
 	try {
-		GeometryEvaluator evaluator(*this->tree);
+		GeometryEvaluator evaluator(*this->tree, this->inexact);
+		evaluator.setCancelFlag(&this->cancelled);
 		root_geom = evaluator.evaluateGeometry(*this->tree->root(), true);
 	}
 	catch (const ProgressCancelException &e) {
@@ -40,7 +84,10 @@ void CGALWorker::work()
 	catch (const HardWarningException &e) {
 		PRINT("Rendering cancelled on first warning.");
 	}
+	progress_set_cancel_flag(nullptr);
+	set_muted_thread(false);
 
+	this->running = false;
 	emit done(root_geom);
 	thread->quit();
 }
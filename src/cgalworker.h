@@ -1,6 +1,7 @@
 #pragma once
 
 #include <QObject>
+#include <atomic>
 #include "memory.h"
 
 class CGALWorker : public QObject
@@ -10,8 +11,16 @@ public:
 	CGALWorker();
 	~CGALWorker();
 
+	// Asks a running render to stop at the next node. Returns immediately.
+	void cancel();
+	// Whether a render is running. Cleared right before done() is emitted.
+	bool isRunning() const { return this->running; }
+	// Blocks until a running render has finished or stopped
+	void wait();
+
 public slots:
-	void start(const class Tree &tree);
+	void start(const class Tree &tree, bool inexact = false);
+	void startBackground(const class Tree &tree);
 
 protected slots:
 	void work();
@@ -23,4 +32,11 @@ protected:
 
 	class QThread *thread;
 	const class Tree *tree;
+	bool inexact;
+	// Background renders are quiet, run at low priority and use their own
+	// copy of the tree, so the GUI thread can keep using its tree.
+	bool background;
+	shared_ptr<class Tree> backgroundtree;
+	std::atomic<bool> cancelled;
+	std::atomic<bool> running;
 };
@@ -3,7 +3,8 @@
 #include "annotation.h"
 #include <string>
 #include <vector>
-#include <boost/range/adaptor/reversed.hpp>
+#include <algorithm>
+#include <iterator>
 // gcc 4.8 and earlier have issues with std::regex see
 // #2291 and https://stackoverflow.com/questions/12530406/is-gcc-4-8-or-earlier-buggy-about-regular-expressions
 // therefor, we use boost::regex
@@ -16,6 +17,26 @@ struct GroupInfo {
 
 typedef std::vector <GroupInfo> GroupList;
 
+/*
+  Offsets of the first character of each line, so lines can be located
+  without scanning the text from its beginning. Element 0 is line 1.
+*/
+typedef std::vector<size_t> LineIndex;
+
+static LineIndex indexLines(const std::string &fulltext)
+{
+	LineIndex lineStarts{0};
+	for (size_t i = fulltext.find('\n'); i != std::string::npos; i = fulltext.find('\n', i + 1)) {
+		lineStarts.push_back(i + 1);
+	}
+	return lineStarts;
+}
+
+static size_t lineStart(const std::string &fulltext, const LineIndex &lineStarts, int line)
+{
+	return size_t(line) <= lineStarts.size() ? lineStarts[line - 1] : fulltext.length();
+}
+
 /*
   Finds line to break stop parsing parsing parameters
 
@@ -80,19 +101,14 @@ static int getLineToStop( const std::string &fulltext){
   Finds the given line in the given source code text, and
   extracts the comment (excluding the "//" prefix)
 */
-static std::string getComment(const std::string &fulltext, int line)
+static std::string getComment(const std::string &fulltext, const LineIndex &lineStarts, int line)
 {
 	if (line < 1) return "";
 
 	// Locate line
-	unsigned int start = 0;
-	for (; start<fulltext.length() ; start++) {
-		if (line <= 1) break;
-		if (fulltext[start] == '\n') line--;
-	}
-
-	int end = start + 1;
-	while (fulltext[end] != '\n') end++;
+	size_t start = lineStart(fulltext, lineStarts, line);
+	size_t end = fulltext.find('\n', start);
+	if (end == std::string::npos) end = fulltext.length();
 
 	std::string comment = fulltext.substr(start, end - start);
 
@@ -123,15 +139,11 @@ static std::string getComment(const std::string &fulltext, int line)
    Extracts a parameter description from comment on the given line.
    Returns description, without any "//"
 */
-static std::string getDescription(const std::string &fulltext, int line)
+static std::string getDescription(const std::string &fulltext, const LineIndex &lineStarts, int line)
 {
 	if (line < 1) return "";
 
-	unsigned int start = 0;
-	for (; start<fulltext.length() ; start++) {
-		if (line <= 1) break;
-		if (fulltext[start] == '\n') line--;
-	}
+	size_t start = lineStart(fulltext, lineStarts, line);
 
 	// not a valid description
 	if (fulltext.compare(start, 2, "//") != 0) return "";
@@ -144,7 +156,7 @@ static std::string getDescription(const std::string &fulltext, int line)
 	std::string retString = "";
 
 	// go till the end of the line
-	while (fulltext[start] != '\n') {
+	while (start < fulltext.length() && fulltext[start] != '\n') {
 		// replace // with space
 		if (fulltext.compare(start, 2, "//") == 0) {
 			retString += " ";
@@ -264,6 +276,7 @@ void CommentParser::collectParameters(const std::string& fulltext, FileModule *r
 	// Get all groups of parameters
 	GroupList groupList = collectGroups(fulltext);
 	int parseTill=getLineToStop(fulltext);
+	LineIndex lineStarts = indexLines(fulltext);
 	// Extract parameters for all literal assignments
 	for (auto &assignment : root_module->scope.assignments) {
 		if (!assignment.expr.get()->isLiteral()) continue; // Only consider literals
@@ -281,7 +294,7 @@ void CommentParser::collectParameters(const std::string& fulltext, FileModule *r
 		AnnotationList *annotationList = new AnnotationList();
  
 		// Extracting the parameter comment
-		std::string comment = getComment(fulltext, firstLine);
+		std::string comment = getComment(fulltext, lineStarts, firstLine);
 		// getting the node for parameter annotation
 		shared_ptr<Expression> params = CommentParser::parser(comment.c_str());
 		if (!params) {
@@ -292,21 +305,21 @@ void CommentParser::collectParameters(const std::string& fulltext, FileModule *r
 		annotationList->push_back(Annotation("Parameter", params));
 
 		//extracting the description
-		std::string descr = getDescription(fulltext, firstLine - 1);
+		std::string descr = getDescription(fulltext, lineStarts, firstLine - 1);
 		if (descr != "") {
 			//creating node for description
 			shared_ptr<Expression> expr(new Literal(ValuePtr(std::string(descr.c_str()))));
 			annotationList->push_back(Annotation("Description", expr));
 		}
 
-		// Look for the group to which the given assignment belong
-		for (const auto &groupInfo :boost::adaptors::reverse(groupList)){
-			if (groupInfo.lineNo < firstLine) {
-				//creating node for description
-				shared_ptr<Expression> expr(new Literal(ValuePtr(groupInfo.commentString)));
-				annotationList->push_back(Annotation("Group", expr));
-				break;
-			}
+		// Look for the group to which the given assignment belong, i.e. the
+		// last one before it. Groups are collected in order of their line.
+		auto group = std::lower_bound(groupList.begin(), groupList.end(), firstLine,
+			[](const GroupInfo &groupInfo, int line) { return groupInfo.lineNo < line; });
+		if (group != groupList.begin()) {
+			//creating node for description
+			shared_ptr<Expression> expr(new Literal(ValuePtr(std::prev(group)->commentString)));
+			annotationList->push_back(Annotation("Group", expr));
 		}
 		assignment.addAnnotations(annotationList);
 	}
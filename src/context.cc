@@ -33,9 +33,16 @@
 #include "ModuleInstantiation.h"
 #include "builtin.h"
 #include "printutils.h"
+#include "stackcheck.h"
+#include <algorithm>
 #include <boost/filesystem.hpp>
 namespace fs = boost::filesystem;
 
+namespace {
+	// The private context stack of a worker thread, see Context::WorkerScope
+	thread_local Context::Stack *worker_stack = nullptr;
+}
+
 // $children is not a config_variable. config_variables have dynamic scope, 
 // meaning they are passed down the call chain implicitly.
 // $children is simply misnamed and shouldn't have included the '$'.
@@ -44,17 +51,31 @@ static bool is_config_variable(const std::string &name)
 	return name[0] == '$' && name != "$children";
 }
 
+// The config variables with a slot in every context, see Context::SpecialVariableSlot
+static const char *special_variable_names[] = { "$fn", "$fa", "$fs", "$t" };
+static_assert(sizeof(special_variable_names) / sizeof(special_variable_names[0]) == Context::NUM_SPECIAL_VARIABLES,
+							"special_variable_names doesn't match the number of slots");
+
+// Returns the slot of the given config variable, or -1 if it has none
+static int special_variable_slot(const std::string &name)
+{
+	for (size_t i = 0; i < Context::NUM_SPECIAL_VARIABLES; i++) {
+		if (name == special_variable_names[i]) return i;
+	}
+	return -1;
+}
+
 /*!
 	Initializes this context. Optionally initializes a context for an 
 	external library. Note that if parent is null, a new stack will be
 	created, and all children will share the root parent's stack.
 */
 Context::Context(const Context *parent)
-	: parent(parent)
+	: parent(parent), lookuprecorder(nullptr)
 {
 	if (parent) {
 		assert(parent->ctx_stack && "Parent context stack was null!");
-		this->ctx_stack = parent->ctx_stack;
+		this->ctx_stack = worker_stack ? worker_stack : parent->ctx_stack;
 		this->document_path = parent->document_path;
 	}
 	else {
@@ -62,6 +83,7 @@ Context::Context(const Context *parent)
 		this->document_path = std::make_shared<std::string>();
 	}
 
+	if (!this->ctx_stack->empty()) this->special_variables = this->ctx_stack->back()->special_variables;
 	this->ctx_stack->push_back(this);
 }
 
@@ -93,10 +115,33 @@ void Context::setVariables(const EvalContext *evalctx, const AssignmentList &arg
 
 void Context::set_variable(const std::string &name, const ValuePtr &value)
 {
-	if (is_config_variable(name)) this->config_variables[name] = value;
+	if (is_config_variable(name)) {
+		auto &stored = this->config_variables[name];
+		stored = value;
+		int slot = special_variable_slot(name);
+		if (slot >= 0 && this->special_variables[slot].owner != this) setSpecialVariable(slot, &stored);
+	}
 	else this->variables[name] = value;
 }
 
+/*!
+	Makes the given slot refer to the value set in this context, for this
+	context and the contexts above it on the stack which inherited the slot.
+*/
+void Context::setSpecialVariable(size_t slot, const ValuePtr *value)
+{
+	const SpecialVariableSlot set(this, value);
+	this->special_variables[slot] = set;
+	// Usually this is the topmost context
+	auto it = std::find(this->ctx_stack->rbegin(), this->ctx_stack->rend(), this);
+	if (it == this->ctx_stack->rend()) return;
+	for (auto above = it.base(); above != this->ctx_stack->end(); above++) {
+		auto &inherited = (*above)->special_variables[slot];
+		if (inherited.owner == *above) break;
+		inherited = set;
+	}
+}
+
 void Context::set_variable(const std::string &name, const Value &value)
 {
 	set_variable(name, ValuePtr(value));
@@ -149,26 +194,44 @@ ValuePtr Context::lookup_variable(const std::string &name, bool silent, const Lo
 		return ValuePtr::undefined;
 	}
 	if (is_config_variable(name)) {
-		for (int i = this->ctx_stack->size()-1; i >= 0; i--) {
-			const auto &confvars = ctx_stack->at(i)->config_variables;
-			if (confvars.find(name) != confvars.end()) {
-				return confvars.find(name)->second;
+		int slot = special_variable_slot(name);
+		if (slot >= 0) {
+			const auto &found = this->ctx_stack->back()->special_variables[slot];
+			if (found.owner) {
+				found.owner->recordLookup(name, *found.value);
+				return *found.value;
+			}
+		}
+		else {
+			for (int i = this->ctx_stack->size()-1; i >= 0; i--) {
+				const auto &confvars = ctx_stack->at(i)->config_variables;
+				if (confvars.find(name) != confvars.end()) {
+					const auto &value = confvars.find(name)->second;
+					ctx_stack->at(i)->recordLookup(name, value);
+					return value;
+				}
 			}
 		}
+		if (!this->ctx_stack->empty()) this->ctx_stack->front()->recordLookup(name, ValuePtr::undefined);
 		if (!silent) {
 			PRINTB("WARNING: Ignoring unknown variable '%s', %s.", name % loc.toRelativeString(this->documentPath()));
 		}
 		return ValuePtr::undefined;
 	}
 	if (!this->parent && this->constants.find(name) != this->constants.end()) {
-		return this->constants.find(name)->second;
+		const auto &value = this->constants.find(name)->second;
+		recordLookup(name, value);
+		return value;
 	}
 	if (this->variables.find(name) != this->variables.end()) {
-		return this->variables.find(name)->second;
+		const auto &value = this->variables.find(name)->second;
+		recordLookup(name, value);
+		return value;
 	}
 	if (this->parent) {
 		return this->parent->lookup_variable(name, silent, loc);
 	}
+	recordLookup(name, ValuePtr::undefined);
 	if (!silent) {
 		PRINTB("WARNING: Ignoring unknown variable '%s', %s.", name % loc.toRelativeString(this->documentPath()));
 	}
@@ -199,6 +262,30 @@ bool Context::has_local_variable(const std::string &name) const
 	return variables.find(name) != variables.end();
 }
 
+bool Context::isRecordingLookups() const
+{
+	for (const auto ctx : *this->ctx_stack) {
+		if (ctx->lookuprecorder) return true;
+	}
+	return false;
+}
+
+Context::WorkerScope::WorkerScope(const Context *context)
+	: stack(*context->ctx_stack), prevstack(worker_stack), prevworker(is_worker_thread()),
+		prevstackcheck(new StackCheck(StackCheck::inst()))
+{
+	worker_stack = &this->stack;
+	set_worker_thread(true);
+	StackCheck::inst().reset(STACK_LIMIT_WORKER);
+}
+
+Context::WorkerScope::~WorkerScope()
+{
+	StackCheck::inst() = *this->prevstackcheck;
+	set_worker_thread(this->prevworker);
+	worker_stack = this->prevstack;
+}
+
 /**
  * This is separated because PRINTB uses quite a lot of stack space
  * and the methods using it evaluate_function() and instantiate_module()
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <map>
 #include <string>
 #include <vector>
@@ -7,11 +8,16 @@
 #include "value.h"
 #include "Assignment.h"
 #include "memory.h"
+#include <memory>
 
 class Context
 {
 public:
 	typedef std::vector<const Context*> Stack;
+	typedef std::unordered_map<std::string, ValuePtr> ValueMap;
+
+	// Number of builtin special variables with a slot in every context
+	static const size_t NUM_SPECIAL_VARIABLES = 4;
 
 	Context(const Context *parent = nullptr);
 	virtual ~Context();
@@ -35,6 +41,33 @@ public:
 
 	bool has_local_variable(const std::string &name) const;
 
+	// Adds every variable lookup_variable() finds in this context to the given
+	// map, with its value. Lookups of unknown variables are recorded by the
+	// root context. Pass nullptr to stop recording.
+	void setLookupRecorder(ValueMap *recorder) const { this->lookuprecorder = recorder; }
+	// Whether any context on the stack records lookups
+	bool isRecordingLookups() const;
+
+	/*!
+		Prepares the calling thread for evaluating expressions on behalf of the
+		thread owning the given context, while it exists. Contexts created
+		meanwhile use a private copy of the context stack, and the thread is
+		marked as a worker thread, see check_worker_thread(). The owning thread
+		must wait for the evaluation to finish.
+	*/
+	class WorkerScope
+	{
+	public:
+		WorkerScope(const Context *context);
+		~WorkerScope();
+
+	private:
+		Stack stack;
+		Stack *prevstack;
+		bool prevworker;
+		std::unique_ptr<class StackCheck> prevstackcheck;
+	};
+
 	void setDocumentPath(const std::string &path) { this->document_path = std::make_shared<std::string>(path); }
 	const std::string &documentPath() const { return *this->document_path; }
 	std::string getAbsolutePath(const std::string &filename) const;
@@ -44,8 +77,27 @@ public:
 protected:
 	const Context *parent;
 	Stack *ctx_stack;
+	mutable ValueMap *lookuprecorder;
+
+	void recordLookup(const std::string &name, const ValuePtr &value) const {
+		if (this->lookuprecorder) this->lookuprecorder->emplace(name, value);
+	}
+
+	/*!
+		The value of a builtin special variable like $fn as lookup_variable()
+		finds it from this context: in the topmost context of the stack up to
+		this one which sets it. Contexts inherit the slots of the context below
+		them on the stack, so the primitives don't have to search the stack.
+	*/
+	struct SpecialVariableSlot {
+		SpecialVariableSlot(const Context *owner = nullptr, const ValuePtr *value = nullptr) : owner(owner), value(value) {}
+		const Context *owner; // nullptr if not set anywhere
+		const ValuePtr *value; // In the config_variables of owner
+	};
+	mutable std::array<SpecialVariableSlot, NUM_SPECIAL_VARIABLES> special_variables;
+
+	void setSpecialVariable(size_t slot, const ValuePtr *value);
 
-	typedef std::unordered_map<std::string, ValuePtr> ValueMap;
 	ValueMap constants;
 	ValueMap variables;
 	ValueMap config_variables;
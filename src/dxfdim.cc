@@ -46,6 +46,9 @@ namespace fs = boost::filesystem;
 
 ValuePtr builtin_dxf_dim(const Context *ctx, const EvalContext *evalctx)
 {
+	// Uses a cache shared by all threads
+	check_worker_thread();
+
 	std::string rawFilename;
 	std::string filename;
 	std::string layername;
@@ -157,6 +160,9 @@ ValuePtr builtin_dxf_dim(const Context *ctx, const EvalContext *evalctx)
 
 ValuePtr builtin_dxf_cross(const Context *ctx, const EvalContext *evalctx)
 {
+	// Uses a cache shared by all threads
+	check_worker_thread();
+
 	std::string filename;
 	std::string rawFilename;
 	std::string layername;
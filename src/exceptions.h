@@ -56,3 +56,10 @@ public:
 	HardWarningException(const std::string &what_arg) : EvaluationException(what_arg) {}
 	~HardWarningException() throw() {}
 };
+
+// Thrown on worker threads by work which must happen on the main thread, see check_worker_thread()
+class WorkerThreadException : public std::runtime_error {
+public:
+	WorkerThreadException() : std::runtime_error("Not possible on a worker thread") {}
+	~WorkerThreadException() throw() {}
+};
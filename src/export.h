@@ -42,6 +42,7 @@ void export_nef3(const shared_ptr<const Geometry> &geom, std::ostream &output);
 
 enum class Previewer { OPENCSG, THROWNTOGETHER };
 enum class RenderType { GEOMETRY, CGAL, OPENCSG, THROWNTOGETHER };
+enum class Rasterizer { OPENGL, SOFTWARE };
 
 struct ExportFileFormatOptions {
 	const std::map<const std::string, FileFormat> exportFileFormats{
@@ -69,6 +70,7 @@ struct ViewOption {
 struct ViewOptions {
 	Previewer previewer{Previewer::OPENCSG};
 	RenderType renderer{RenderType::OPENCSG};
+	Rasterizer rasterizer{Rasterizer::OPENGL};
 
 	std::map<std::string, bool> flags{
 		{"axes", false},
@@ -5,6 +5,8 @@
 #include <stdio.h>
 #include "polyset.h"
 #include "rendersettings.h"
+#include "colormap.h"
+#include "SoftwareRasterizer.h"
 
 #ifdef ENABLE_CGAL
 #include "CGALRenderer.h"
@@ -17,15 +19,76 @@ static void setupCamera(Camera &cam, const BoundingBox &bbox)
 	if (cam.viewall) cam.viewAll(bbox);
 }
 
+/*!
+	Renders the geometry like CGALRenderer does, using SoftwareRasterizer
+	instead of an OpenGL context.
+*/
+static bool export_png_software(const shared_ptr<const Geometry> &root_geom, const ViewOptions& options, Camera camera, std::ostream &output)
+{
+	PRINTD("export_png_software geom");
+	if (options["axes"] || options["scales"] || options["crosshairs"]) {
+		PRINT("WARNING: Axes, scale markers and crosshairs are not supported by the software rasterizer");
+	}
+
+	auto colorscheme = ColorMap::inst()->findColorScheme(RenderSettings::inst()->colorscheme);
+	if (!colorscheme) colorscheme = &ColorMap::inst()->defaultColorScheme();
+
+	// Nef polyhedrons are drawn using the CGAL colors, PolySets using the material
+	// color, just like CGALRenderer does.
+	shared_ptr<const Geometry> geom = root_geom;
+	auto facecolor = ColorMap::getColor(*colorscheme, RenderColor::OPENCSG_FACE_FRONT_COLOR);
+	if (auto N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(root_geom)) {
+		geom.reset();
+		if (N->getDimension() == 3 && !N->isEmpty()) {
+			auto ps = new PolySet(3);
+			if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *ps)) {
+				PRINT("EXPORT-ERROR: Nef->PolySet failed");
+				delete ps;
+				return false;
+			}
+			geom.reset(ps);
+		}
+		facecolor = ColorMap::getColor(*colorscheme, RenderColor::CGAL_FACE_FRONT_COLOR);
+	}
+
+	BoundingBox bbox = geom ? geom->getBoundingBox() : BoundingBox();
+	setupCamera(camera, bbox);
+
+	SoftwareRasterizer rasterizer(camera);
+	rasterizer.setBackgroundColor(ColorMap::getColor(*colorscheme, RenderColor::BACKGROUND_COLOR));
+	if (auto ps = dynamic_pointer_cast<const PolySet>(geom)) {
+		if (!options["wireframe"]) rasterizer.drawSurface(*ps, facecolor);
+		if (options["edges"] || options["wireframe"]) {
+			rasterizer.drawEdges(*ps, ColorMap::getColor(*colorscheme, RenderColor::CGAL_EDGE_FRONT_COLOR));
+		}
+	}
+	else if (auto poly = dynamic_pointer_cast<const Polygon2d>(geom)) {
+		rasterizer.drawPolygon2d(*poly,
+														 ColorMap::getColor(*colorscheme, RenderColor::CGAL_FACE_2D_COLOR),
+														 ColorMap::getColor(*colorscheme, RenderColor::CGAL_EDGE_2D_COLOR));
+	}
+	rasterizer.paint();
+	return rasterizer.save(output);
+}
+
 bool export_png(const shared_ptr<const Geometry> &root_geom, const ViewOptions& options, Camera camera, std::ostream &output)
 {
 	PRINTD("export_png geom");
+#ifdef NULLGL
+	// The NULL offscreen context can be created, but draws nothing
+	return export_png_software(root_geom, options, camera, output);
+#else
+	if (options.rasterizer == Rasterizer::SOFTWARE) {
+		return export_png_software(root_geom, options, camera, output);
+	}
+
 	OffscreenView *glview;
 	try {
 		glview = new OffscreenView(camera.pixel_width, camera.pixel_height);
 	} catch (int error) {
 		fprintf(stderr,"Can't create OpenGL OffscreenView. Code: %i.\n", error);
-		return false;
+		fprintf(stderr,"Falling back to the software rasterizer.\n");
+		return export_png_software(root_geom, options, camera, output);
 	}
 	CGALRenderer cgalRenderer(root_geom);
 
@@ -43,6 +106,7 @@ bool export_png(const shared_ptr<const Geometry> &root_geom, const ViewOptions&
 	glview->paintGL();
 	glview->save(output);
 	return true;
+#endif
 }
 
 #ifdef ENABLE_OPENCSG
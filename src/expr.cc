@@ -36,6 +36,10 @@
 #include "exceptions.h"
 #include "feature.h"
 #include "printutils.h"
+#include "ASTCache.h"
+#include "parallel.h"
+#include "FunctionProgram.h"
+#include "ExpressionOptimizer.h"
 #include <boost/bind.hpp>
 
 #include <boost/assign/std/vector.hpp>
@@ -71,6 +75,64 @@ namespace {
 		EvalContext ctx(context, assignment_list, loc);
 		ctx.assignTo(*context);
 	}
+
+	// Loops with fewer iterations are evaluated sequentially
+	const size_t PARALLEL_MIN_ITERATIONS = 10000;
+
+	/*
+		Evaluates expr for the loop variable set to each of the given number of
+		values, in worker threads. The evaluation is speculative: returns false
+		if anything had to happen on the calling thread instead, like printing a
+		warning, so the caller can repeat the loop sequentially.
+	*/
+	template <typename GetValue>
+	bool evaluate_parallel(const Context *context, const std::string &it_name, size_t count,
+												 GetValue getValue, const Expression &expr, Value::VectorType &vec)
+	{
+		if (count < PARALLEL_MIN_ITERATIONS || is_worker_thread() || context->isRecordingLookups()) return false;
+
+		Value::VectorType results(count);
+		std::atomic<bool> failed(false);
+		parallel_for_chunks(count, PARALLEL_MIN_ITERATIONS / 4, [&](size_t begin, size_t end) {
+			Context::WorkerScope scope(context);
+			try {
+				Context c(context);
+				for (size_t i = begin; i < end && !failed; i++) {
+					c.set_variable(it_name, getValue(i));
+					results[i] = expr.evaluate(&c);
+				}
+			}
+			catch (...) {
+				failed = true;
+			}
+		});
+		if (failed) return false;
+		vec = std::move(results);
+		return true;
+	}
+
+	/*
+		Evaluates the hoisted subexpressions of a loop body, see HoistedLookup,
+		and sets them as variables of the given context. The evaluation is
+		speculative like above: returns false if anything would print, leaving
+		the subexpressions to be evaluated with each iteration instead.
+	*/
+	bool evaluate_hoisted(const AssignmentList &hoisted, Context &context)
+	{
+		bool worker = is_worker_thread();
+		set_worker_thread(true);
+		try {
+			for (const auto &assignment : hoisted) {
+				context.set_variable(assignment.name, assignment.expr->evaluate(&context));
+			}
+		}
+		catch (...) {
+			set_worker_thread(worker);
+			return false;
+		}
+		set_worker_thread(worker);
+		return true;
+	}
 }
 
 namespace /* anonymous*/ {
@@ -87,6 +149,35 @@ namespace /* anonymous*/ {
 
 }
 
+void ReferenceCollector::addVariable(const std::string &name)
+{
+	if (std::find(this->bound.begin(), this->bound.end(), name) == this->bound.end()) {
+		this->variables.insert(name);
+	}
+}
+
+void ReferenceCollector::collect(const shared_ptr<Expression> &expr)
+{
+	if (expr) expr->collectReferences(*this);
+}
+
+void ReferenceCollector::collectSequentially(const AssignmentList &assignments)
+{
+	for (const auto &assignment : assignments) {
+		collect(assignment.expr);
+		bind(assignment.name);
+		if (!assignment.name.empty()) this->assignedNames.insert(assignment.name);
+	}
+}
+
+void ReferenceCollector::collect(const AssignmentList &assignments)
+{
+	for (const auto &assignment : assignments) {
+		collect(assignment.expr);
+		if (!assignment.name.empty()) this->assignedNames.insert(assignment.name);
+	}
+}
+
 bool Expression::isLiteral() const
 {
     return false;
@@ -136,6 +227,29 @@ void UnaryOp::print(std::ostream &stream, const std::string &) const
 	stream << opString() << *this->expr;
 }
 
+void UnaryOp::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::UnaryOp);
+	writer.write(this->loc);
+	writer.write(int64_t(this->op));
+	writer.write(this->expr);
+}
+
+void UnaryOp::collectReferences(ReferenceCollector &refs) const
+{
+	refs.collect(this->expr);
+}
+
+void UnaryOp::optimize(ExpressionOptimizer &optimizer)
+{
+	optimizer.optimize(this->expr);
+}
+
+bool UnaryOp::compile(FunctionCompiler &compiler, bool) const
+{
+	return compiler.compileUnaryOp(this->op, this->expr);
+}
+
 BinaryOp::BinaryOp(Expression *left, BinaryOp::Op op, Expression *right, const Location &loc) :
 	Expression(loc), op(op), left(left), right(right)
 {
@@ -242,6 +356,33 @@ void BinaryOp::print(std::ostream &stream, const std::string &) const
 	stream << "(" << *this->left << " " << opString() << " " << *this->right << ")";
 }
 
+void BinaryOp::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::BinaryOp);
+	writer.write(this->loc);
+	writer.write(int64_t(this->op));
+	writer.write(this->left);
+	writer.write(this->right);
+}
+
+void BinaryOp::collectReferences(ReferenceCollector &refs) const
+{
+	refs.collect(this->left);
+	refs.collect(this->right);
+}
+
+void BinaryOp::optimize(ExpressionOptimizer &optimizer)
+{
+	optimizer.optimize(this->left);
+	// The right operand of logical operators isn't always evaluated
+	optimizer.optimize(this->right, this->op == Op::LogicalAnd || this->op == Op::LogicalOr);
+}
+
+bool BinaryOp::compile(FunctionCompiler &compiler, bool) const
+{
+	return compiler.compileBinaryOp(this->op, this->left, this->right);
+}
+
 TernaryOp::TernaryOp(Expression *cond, Expression *ifexpr, Expression *elseexpr, const Location &loc)
 	: Expression(loc), cond(cond), ifexpr(ifexpr), elseexpr(elseexpr)
 {
@@ -263,6 +404,34 @@ void TernaryOp::print(std::ostream &stream, const std::string &) const
 	stream << "(" << *this->cond << " ? " << *this->ifexpr << " : " << *this->elseexpr << ")";
 }
 
+void TernaryOp::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::TernaryOp);
+	writer.write(this->loc);
+	writer.write(this->cond);
+	writer.write(this->ifexpr);
+	writer.write(this->elseexpr);
+}
+
+void TernaryOp::collectReferences(ReferenceCollector &refs) const
+{
+	refs.collect(this->cond);
+	refs.collect(this->ifexpr);
+	refs.collect(this->elseexpr);
+}
+
+void TernaryOp::optimize(ExpressionOptimizer &optimizer)
+{
+	optimizer.optimize(this->cond);
+	optimizer.optimize(this->ifexpr, true);
+	optimizer.optimize(this->elseexpr, true);
+}
+
+bool TernaryOp::compile(FunctionCompiler &compiler, bool tail) const
+{
+	return compiler.compileTernaryOp(this->cond, this->ifexpr, this->elseexpr, tail);
+}
+
 ArrayLookup::ArrayLookup(Expression *array, Expression *index, const Location &loc)
 	: Expression(loc), array(array), index(index)
 {
@@ -277,18 +446,68 @@ void ArrayLookup::print(std::ostream &stream, const std::string &) const
 	stream << *array << "[" << *index << "]";
 }
 
+void ArrayLookup::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::ArrayLookup);
+	writer.write(this->loc);
+	writer.write(this->array);
+	writer.write(this->index);
+}
+
+void ArrayLookup::collectReferences(ReferenceCollector &refs) const
+{
+	refs.collect(this->array);
+	refs.collect(this->index);
+}
+
+void ArrayLookup::optimize(ExpressionOptimizer &optimizer)
+{
+	optimizer.optimize(this->array);
+	optimizer.optimize(this->index);
+}
+
 Literal::Literal(const ValuePtr &val, const Location &loc) : Expression(loc), value(val)
 {
 }
 
+Literal::Literal(const ValuePtr &val, const shared_ptr<Expression> &source)
+	: Expression(source->location()), value(val), source(source)
+{
+}
+
 ValuePtr Literal::evaluate(const class Context *) const
 {
 	return this->value;
 }
 
-void Literal::print(std::ostream &stream, const std::string &) const
+void Literal::print(std::ostream &stream, const std::string &indent) const
+{
+	if (this->source) this->source->print(stream, indent);
+	else stream << *this->value;
+}
+
+void Literal::serialize(ASTWriter &writer) const
+{
+	if (this->source) {
+		this->source->serialize(writer);
+		return;
+	}
+	writer.write(ASTTag::Literal);
+	writer.write(this->loc);
+	writer.write(this->value);
+}
+
+void Literal::collectReferences(ReferenceCollector &) const
+{
+}
+
+bool Literal::compile(FunctionCompiler &compiler, bool) const
+{
+	return compiler.compileLiteral(this->value);
+}
+
+void Literal::optimize(ExpressionOptimizer &)
 {
-    stream << *this->value;
 }
 
 Range::Range(Expression *begin, Expression *end, const Location &loc)
@@ -330,6 +549,29 @@ void Range::print(std::ostream &stream, const std::string &) const
 	stream << "]";
 }
 
+void Range::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::Range);
+	writer.write(this->loc);
+	writer.write(this->begin);
+	writer.write(this->step);
+	writer.write(this->end);
+}
+
+void Range::collectReferences(ReferenceCollector &refs) const
+{
+	refs.collect(this->begin);
+	refs.collect(this->step);
+	refs.collect(this->end);
+}
+
+void Range::optimize(ExpressionOptimizer &optimizer)
+{
+	optimizer.optimize(this->begin);
+	optimizer.optimize(this->step);
+	optimizer.optimize(this->end);
+}
+
 bool Range::isLiteral() const {
     if(!this->step){ 
         if( begin->isLiteral() && end->isLiteral())
@@ -365,7 +607,7 @@ ValuePtr Vector::evaluate(const Context *context) const
 	for(const auto &e : this->children) {
 		ValuePtr tmpval = e->evaluate(context);
 		if (isListComprehension(e)) {
-			const Value::VectorType result = tmpval->toVector();
+			const Value::VectorType &result = tmpval->toVector();
 			for (size_t i = 0;i < result.size();i++) {
 				vec.push_back(result[i]);
 			}
@@ -373,7 +615,7 @@ ValuePtr Vector::evaluate(const Context *context) const
 			vec.push_back(tmpval);
 		}
 	}
-	return ValuePtr(vec);
+	return ValuePtr(std::move(vec));
 }
 
 void Vector::print(std::ostream &stream, const std::string &) const
@@ -386,6 +628,24 @@ void Vector::print(std::ostream &stream, const std::string &) const
 	stream << "]";
 }
 
+void Vector::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::Vector);
+	writer.write(this->loc);
+	writer.write(int64_t(this->children.size()));
+	for (const auto &e : this->children) writer.write(e);
+}
+
+void Vector::collectReferences(ReferenceCollector &refs) const
+{
+	for (const auto &e : this->children) refs.collect(e);
+}
+
+void Vector::optimize(ExpressionOptimizer &optimizer)
+{
+	for (auto &e : this->children) optimizer.optimize(e);
+}
+
 Lookup::Lookup(const std::string &name, const Location &loc) : Expression(loc), name(name)
 {
 }
@@ -405,6 +665,58 @@ void Lookup::print(std::ostream &stream, const std::string &) const
 	stream << this->name;
 }
 
+void Lookup::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::Lookup);
+	writer.write(this->loc);
+	writer.write(this->name);
+}
+
+void Lookup::collectReferences(ReferenceCollector &refs) const
+{
+	refs.addVariable(this->name);
+}
+
+void Lookup::optimize(ExpressionOptimizer &)
+{
+}
+
+bool Lookup::compile(FunctionCompiler &compiler, bool) const
+{
+	return compiler.compileLookup(this->name);
+}
+
+HoistedLookup::HoistedLookup(const std::string &name, const shared_ptr<Expression> &expr)
+	: Expression(expr->location()), name(name), expr(expr)
+{
+}
+
+ValuePtr HoistedLookup::evaluate(const Context *context) const
+{
+	// Undefined if the loop couldn't evaluate it up front
+	ValuePtr value = context->lookup_variable(this->name, true);
+	return value->isUndefined() ? this->expr->evaluate(context) : value;
+}
+
+void HoistedLookup::print(std::ostream &stream, const std::string &indent) const
+{
+	this->expr->print(stream, indent);
+}
+
+void HoistedLookup::serialize(ASTWriter &writer) const
+{
+	this->expr->serialize(writer);
+}
+
+void HoistedLookup::collectReferences(ReferenceCollector &refs) const
+{
+	refs.collect(this->expr);
+}
+
+void HoistedLookup::optimize(ExpressionOptimizer &)
+{
+}
+
 MemberLookup::MemberLookup(Expression *expr, const std::string &member, const Location &loc)
 	: Expression(loc), expr(expr), member(member)
 {
@@ -431,6 +743,24 @@ void MemberLookup::print(std::ostream &stream, const std::string &) const
 	stream << *this->expr << "." << this->member;
 }
 
+void MemberLookup::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::MemberLookup);
+	writer.write(this->loc);
+	writer.write(this->expr);
+	writer.write(this->member);
+}
+
+void MemberLookup::collectReferences(ReferenceCollector &refs) const
+{
+	refs.collect(this->expr);
+}
+
+void MemberLookup::optimize(ExpressionOptimizer &optimizer)
+{
+	optimizer.optimize(this->expr);
+}
+
 FunctionCall::FunctionCall(const std::string &name, 
 													 const AssignmentList &args, const Location &loc)
 	: Expression(loc), name(name), arguments(args)
@@ -466,24 +796,29 @@ static void NOINLINE print_trace(const FunctionCall *val, const Context *ctx){
 */
 void FunctionCall::prepareTailCallContext(const Context *context, Context *tailCallContext, const AssignmentList &definition_arguments)
 {
-	if (this->resolvedArguments.empty()) {
+	auto args = std::atomic_load(&this->tailCallArguments);
+	if (!args) {
+		auto newargs = std::make_shared<TailCallArguments>();
 		// Figure out parameter names
 		EvalContext ec(context, this->arguments, this->loc);
-		this->resolvedArguments = ec.resolveArguments(definition_arguments, {}, false);
+		newargs->resolved = ec.resolveArguments(definition_arguments, {}, false);
 		// Assign default values for unspecified parameters
 		for (const auto &arg : definition_arguments) {
-			if (this->resolvedArguments.find(arg.name) == this->resolvedArguments.end()) {
-				this->defaultArguments.emplace_back(arg.name, arg.expr ? arg.expr->evaluate(context) : ValuePtr::undefined);
+			if (newargs->resolved.find(arg.name) == newargs->resolved.end()) {
+				newargs->defaults.emplace_back(arg.name, arg.expr ? arg.expr->evaluate(context) : ValuePtr::undefined);
 			}
 		}
+		args = newargs;
+		// Without given parameters, the defaults are evaluated for every call
+		if (!newargs->resolved.empty()) std::atomic_store(&this->tailCallArguments, args);
 	}
 
 	std::vector<std::pair<std::string, ValuePtr>> variables;
-	variables.reserve(this->defaultArguments.size() + this->resolvedArguments.size());
+	variables.reserve(args->defaults.size() + args->resolved.size());
 	// Set default values for unspecified parameters
-	variables.insert(variables.begin(), this->defaultArguments.begin(), this->defaultArguments.end());
+	variables.insert(variables.begin(), args->defaults.begin(), args->defaults.end());
 	// Set the given parameters
-	for (const auto &ass : this->resolvedArguments) {
+	for (const auto &ass : args->resolved) {
 		variables.emplace_back(ass.first, ass.second->evaluate(context));
 	}
 	// Apply to tailCallContext
@@ -518,6 +853,30 @@ void FunctionCall::print(std::ostream &stream, const std::string &) const
 	stream << this->name << "(" << this->arguments << ")";
 }
 
+void FunctionCall::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::FunctionCall);
+	writer.write(this->loc);
+	writer.write(this->name);
+	writer.write(this->arguments);
+}
+
+void FunctionCall::collectReferences(ReferenceCollector &refs) const
+{
+	refs.functions.insert(this->name);
+	refs.collect(this->arguments);
+}
+
+void FunctionCall::optimize(ExpressionOptimizer &optimizer)
+{
+	optimizer.optimize(this->arguments);
+}
+
+bool FunctionCall::compile(FunctionCompiler &compiler, bool tail) const
+{
+	return compiler.compileCall(this->name, this->arguments, tail);
+}
+
 Expression * FunctionCall::create(const std::string &funcname, const AssignmentList &arglist, Expression *expr, const Location &loc)
 {
 	if (funcname == "assert") {
@@ -561,6 +920,27 @@ void Assert::print(std::ostream &stream, const std::string &) const
 	if (this->expr) stream << " " << *this->expr;
 }
 
+void Assert::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::Assert);
+	writer.write(this->loc);
+	writer.write(this->arguments);
+	writer.write(this->expr);
+}
+
+void Assert::collectReferences(ReferenceCollector &refs) const
+{
+	refs.sideEffects = true;
+	refs.collect(this->arguments);
+	refs.collect(this->expr);
+}
+
+void Assert::optimize(ExpressionOptimizer &optimizer)
+{
+	optimizer.optimize(this->arguments);
+	optimizer.optimize(this->expr);
+}
+
 Echo::Echo(const AssignmentList &args, Expression *expr, const Location &loc)
 	: Expression(loc), arguments(args), expr(expr)
 {
@@ -588,6 +968,27 @@ void Echo::print(std::ostream &stream, const std::string &) const
 	if (this->expr) stream << " " << *this->expr;
 }
 
+void Echo::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::Echo);
+	writer.write(this->loc);
+	writer.write(this->arguments);
+	writer.write(this->expr);
+}
+
+void Echo::collectReferences(ReferenceCollector &refs) const
+{
+	refs.sideEffects = true;
+	refs.collect(this->arguments);
+	refs.collect(this->expr);
+}
+
+void Echo::optimize(ExpressionOptimizer &optimizer)
+{
+	optimizer.optimize(this->arguments);
+	optimizer.optimize(this->expr);
+}
+
 Let::Let(const AssignmentList &args, Expression *expr, const Location &loc)
 	: Expression(loc), arguments(args), expr(expr)
 {
@@ -612,6 +1013,35 @@ void Let::print(std::ostream &stream, const std::string &) const
 	stream << "let(" << this->arguments << ") " << *expr;
 }
 
+void Let::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::Let);
+	writer.write(this->loc);
+	writer.write(this->arguments);
+	writer.write(this->expr);
+}
+
+void Let::collectReferences(ReferenceCollector &refs) const
+{
+	size_t numBound = refs.numBound();
+	refs.collectSequentially(this->arguments);
+	refs.collect(this->expr);
+	refs.unbind(numBound);
+}
+
+void Let::optimize(ExpressionOptimizer &optimizer)
+{
+	size_t numBound = optimizer.numBound();
+	optimizer.optimizeSequentially(this->arguments);
+	optimizer.optimize(this->expr);
+	optimizer.unbind(numBound);
+}
+
+bool Let::compile(FunctionCompiler &compiler, bool tail) const
+{
+	return compiler.compileLet(this->arguments, this->expr, tail);
+}
+
 ListComprehension::ListComprehension(const Location &loc) : Expression(loc)
 {
 }
@@ -645,6 +1075,29 @@ void LcIf::print(std::ostream &stream, const std::string &) const
     }
 }
 
+void LcIf::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::LcIf);
+	writer.write(this->loc);
+	writer.write(this->cond);
+	writer.write(this->ifexpr);
+	writer.write(this->elseexpr);
+}
+
+void LcIf::collectReferences(ReferenceCollector &refs) const
+{
+	refs.collect(this->cond);
+	refs.collect(this->ifexpr);
+	refs.collect(this->elseexpr);
+}
+
+void LcIf::optimize(ExpressionOptimizer &optimizer)
+{
+	optimizer.optimize(this->cond);
+	optimizer.optimize(this->ifexpr, true);
+	optimizer.optimize(this->elseexpr, true);
+}
+
 LcEach::LcEach(Expression *expr, const Location &loc) : ListComprehension(loc), expr(expr)
 {
 }
@@ -666,7 +1119,7 @@ ValuePtr LcEach::evaluate(const Context *context) const
             }
         }
     } else if (v->type() == Value::ValueType::VECTOR) {
-        Value::VectorType vector = v->toVector();
+        const Value::VectorType &vector = v->toVector();
         for (size_t i = 0; i < v->toVector().size(); i++) {
             vec.push_back(vector[i]);
         }
@@ -681,7 +1134,7 @@ ValuePtr LcEach::evaluate(const Context *context) const
     if (isListComprehension(this->expr)) {
         return ValuePtr(flatten(vec));
     } else {
-        return ValuePtr(vec);
+        return ValuePtr(std::move(vec));
     }
 }
 
@@ -690,6 +1143,23 @@ void LcEach::print(std::ostream &stream, const std::string &) const
     stream << "each (" << *this->expr << ")";
 }
 
+void LcEach::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::LcEach);
+	writer.write(this->loc);
+	writer.write(this->expr);
+}
+
+void LcEach::collectReferences(ReferenceCollector &refs) const
+{
+	refs.collect(this->expr);
+}
+
+void LcEach::optimize(ExpressionOptimizer &optimizer)
+{
+	optimizer.optimize(this->expr);
+}
+
 LcFor::LcFor(const AssignmentList &args, Expression *expr, const Location &loc)
 	: ListComprehension(loc), arguments(args), expr(expr)
 {
@@ -707,7 +1177,31 @@ ValuePtr LcFor::evaluate(const Context *context) const
     const std::string &it_name = for_context.getArgName(0);
     ValuePtr it_values = for_context.getArgValue(0, &assign_context);
 
-    Context c(context);
+    // Hoisted subexpressions are only evaluated if the loop body is, so they
+    // print nothing which it wouldn't
+    bool empty;
+    switch (it_values->type()) {
+    case Value::ValueType::RANGE: {
+        uint32_t steps = it_values->toRange().numValues();
+        empty = steps == 0 || steps >= 1000000;
+        break;
+    }
+    case Value::ValueType::VECTOR:
+        empty = it_values->toVector().empty();
+        break;
+    case Value::ValueType::STRING:
+        empty = it_values->toString().empty();
+        break;
+    default:
+        empty = it_values->type() == Value::ValueType::UNDEFINED;
+    }
+    Context hoisted_context(context);
+    const Context *loop_context = context;
+    if (!this->hoisted.empty() && !empty && evaluate_hoisted(this->hoisted, hoisted_context)) {
+        loop_context = &hoisted_context;
+    }
+
+    Context c(loop_context);
 
     if (it_values->type() == Value::ValueType::RANGE) {
         RangeType range = it_values->toRange();
@@ -715,15 +1209,28 @@ ValuePtr LcFor::evaluate(const Context *context) const
         if (steps >= 1000000) {
             PRINTB("WARNING: Bad range parameter in for statement: too many elements (%lu), %s", steps % loc.toRelativeString(context->documentPath()));
         } else {
-            for (RangeType::iterator it = range.begin();it != range.end();it++) {
-                c.set_variable(it_name, ValuePtr(*it));
-                vec.push_back(this->expr->evaluate(&c));
+            // Iterate to get the values, as accumulating the steps may round differently than computing them
+            std::vector<double> values;
+            if (steps >= PARALLEL_MIN_ITERATIONS) {
+                values.reserve(steps);
+                for (RangeType::iterator it = range.begin();it != range.end();it++) values.push_back(*it);
+            }
+            if (!evaluate_parallel(loop_context, it_name, values.size(),
+                                   [&](size_t i) { return ValuePtr(values[i]); }, *this->expr, vec)) {
+                for (RangeType::iterator it = range.begin();it != range.end();it++) {
+                    c.set_variable(it_name, ValuePtr(*it));
+                    vec.push_back(this->expr->evaluate(&c));
+                }
             }
         }
     } else if (it_values->type() == Value::ValueType::VECTOR) {
-        for (size_t i = 0; i < it_values->toVector().size(); i++) {
-            c.set_variable(it_name, it_values->toVector()[i]);
-            vec.push_back(this->expr->evaluate(&c));
+        const auto &values = it_values->toVector();
+        if (!evaluate_parallel(loop_context, it_name, values.size(),
+                               [&](size_t i) { return values[i]; }, *this->expr, vec)) {
+            for (size_t i = 0; i < values.size(); i++) {
+                c.set_variable(it_name, values[i]);
+                vec.push_back(this->expr->evaluate(&c));
+            }
         }
     } else if (it_values->type() == Value::ValueType::STRING) {
         utf8_split(it_values->toString(), [&](ValuePtr v) {
@@ -738,7 +1245,7 @@ ValuePtr LcFor::evaluate(const Context *context) const
     if (isListComprehension(this->expr)) {
         return ValuePtr(flatten(vec));
     } else {
-        return ValuePtr(vec);
+        return ValuePtr(std::move(vec));
     }
 }
 
@@ -747,6 +1254,28 @@ void LcFor::print(std::ostream &stream, const std::string &) const
     stream << "for(" << this->arguments << ") (" << *this->expr << ")";
 }
 
+void LcFor::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::LcFor);
+	writer.write(this->loc);
+	writer.write(this->arguments);
+	writer.write(this->expr);
+}
+
+void LcFor::collectReferences(ReferenceCollector &refs) const
+{
+	size_t numBound = refs.numBound();
+	refs.collect(this->arguments);
+	for (const auto &arg : this->arguments) refs.bind(arg.name);
+	refs.collect(this->expr);
+	refs.unbind(numBound);
+}
+
+void LcFor::optimize(ExpressionOptimizer &optimizer)
+{
+	optimizer.optimizeLoop(this->arguments, this->expr, this->hoisted);
+}
+
 LcForC::LcForC(const AssignmentList &args, const AssignmentList &incrargs, Expression *cond, Expression *expr, const Location &loc)
 	: ListComprehension(loc), arguments(args), incr_arguments(incrargs), cond(cond), expr(expr)
 {
@@ -777,7 +1306,7 @@ ValuePtr LcForC::evaluate(const Context *context) const
     if (isListComprehension(this->expr)) {
         return ValuePtr(flatten(vec));
     } else {
-        return ValuePtr(vec);
+        return ValuePtr(std::move(vec));
     }
 }
 
@@ -790,6 +1319,38 @@ void LcForC::print(std::ostream &stream, const std::string &) const
         << ") " << *this->expr;
 }
 
+void LcForC::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::LcForC);
+	writer.write(this->loc);
+	writer.write(this->arguments);
+	writer.write(this->incr_arguments);
+	writer.write(this->cond);
+	writer.write(this->expr);
+}
+
+void LcForC::collectReferences(ReferenceCollector &refs) const
+{
+	size_t numBound = refs.numBound();
+	refs.collectSequentially(this->arguments);
+	refs.collect(this->cond);
+	refs.collectSequentially(this->incr_arguments);
+	refs.collect(this->expr);
+	refs.unbind(numBound);
+}
+
+void LcForC::optimize(ExpressionOptimizer &optimizer)
+{
+	size_t numBound = optimizer.numBound();
+	optimizer.optimizeSequentially(this->arguments);
+	optimizer.optimize(this->cond);
+	optimizer.optimize(this->expr, true);
+	optimizer.optimizeSequentially(this->incr_arguments, true);
+	optimizer.unbind(numBound);
+	// The number of iterations is only known when evaluating
+	optimizer.preventFolding();
+}
+
 LcLet::LcLet(const AssignmentList &args, Expression *expr, const Location &loc)
 	: ListComprehension(loc), arguments(args), expr(expr)
 {
@@ -807,6 +1368,30 @@ void LcLet::print(std::ostream &stream, const std::string &) const
     stream << "let(" << this->arguments << ") (" << *this->expr << ")";
 }
 
+void LcLet::serialize(ASTWriter &writer) const
+{
+	writer.write(ASTTag::LcLet);
+	writer.write(this->loc);
+	writer.write(this->arguments);
+	writer.write(this->expr);
+}
+
+void LcLet::collectReferences(ReferenceCollector &refs) const
+{
+	size_t numBound = refs.numBound();
+	refs.collectSequentially(this->arguments);
+	refs.collect(this->expr);
+	refs.unbind(numBound);
+}
+
+void LcLet::optimize(ExpressionOptimizer &optimizer)
+{
+	size_t numBound = optimizer.numBound();
+	optimizer.optimizeSequentially(this->arguments);
+	optimizer.optimize(this->expr);
+	optimizer.unbind(numBound);
+}
+
 void evaluate_assert(const Context &context, const class EvalContext *evalctx)
 {
 	AssignmentList args;
@@ -4,10 +4,43 @@
 
 #include <string>
 #include <vector>
+#include <unordered_set>
 #include "value.h"
 #include "memory.h"
 #include "Assignment.h"
 
+/*!
+	Collects the variables and functions an expression refers to, excluding
+	the variables bound by let() and list comprehensions within it.
+	See Expression::collectReferences().
+*/
+class ReferenceCollector
+{
+public:
+	std::unordered_set<std::string> variables;
+	std::unordered_set<std::string> functions;
+	// Names of all assignments within the expression, including named arguments
+	std::unordered_set<std::string> assignedNames;
+	// Whether the expression contains echo() or assert()
+	bool sideEffects = false;
+
+	void addVariable(const std::string &name);
+	void collect(const shared_ptr<class Expression> &expr);
+	// Collects the expressions of the given assignments, with the names of
+	// the assignments bound when collecting the ones following them
+	void collectSequentially(const AssignmentList &assignments);
+	void collect(const AssignmentList &assignments);
+
+	// Binding names is scoped: save the number of bound names before binding
+	// more, and restore it when leaving the binding expression
+	size_t numBound() const { return this->bound.size(); }
+	void bind(const std::string &name) { this->bound.push_back(name); }
+	void unbind(size_t numBound) { this->bound.resize(numBound); }
+
+private:
+	std::vector<std::string> bound;
+};
+
 class Expression : public ASTNode
 {
 public:
@@ -15,6 +48,14 @@ public:
 	~Expression() {}
 	virtual bool isLiteral() const;
 	virtual ValuePtr evaluate(const class Context *context) const = 0;
+	// Writes this expression to an on-disk AST cache, see ASTCache
+	virtual void serialize(class ASTWriter &writer) const = 0;
+	virtual void collectReferences(ReferenceCollector &refs) const = 0;
+	// Simplifies the subexpressions of this expression, see ExpressionOptimizer
+	virtual void optimize(class ExpressionOptimizer &optimizer) = 0;
+	// Compiles this expression into the bytecode of a numeric function, see
+	// FunctionProgram. Returns false if it can't be compiled.
+	virtual bool compile(class FunctionCompiler &, bool) const { return false; }
 };
 
 class UnaryOp : public Expression
@@ -28,6 +69,10 @@ public:
 	UnaryOp(Op op, Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
+	bool compile(class FunctionCompiler &compiler, bool tail) const override;
 
 private:
 	const char *opString() const;
@@ -58,6 +103,10 @@ public:
 	BinaryOp(Expression *left, Op op, Expression *right, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
+	bool compile(class FunctionCompiler &compiler, bool tail) const override;
 
 private:
 	const char *opString() const;
@@ -74,6 +123,10 @@ public:
 	const shared_ptr<Expression> &evaluateStep(const Context *context) const;
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
+	bool compile(class FunctionCompiler &compiler, bool tail) const override;
 private:
 	shared_ptr<Expression> cond;
 	shared_ptr<Expression> ifexpr;
@@ -86,6 +139,9 @@ public:
 	ArrayLookup(Expression *array, Expression *index, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
 private:
 	shared_ptr<Expression> array;
 	shared_ptr<Expression> index;
@@ -95,11 +151,19 @@ class Literal : public Expression
 {
 public:
 	Literal(const ValuePtr &val, const Location &loc = Location::NONE);
+	// The value of the given constant expression, which is still used for
+	// printing and serializing, see ExpressionOptimizer
+	Literal(const ValuePtr &val, const shared_ptr<Expression> &source);
 	ValuePtr evaluate(const class Context *) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
-	bool isLiteral() const override { return true;}
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
+	bool compile(class FunctionCompiler &compiler, bool tail) const override;
+	bool isLiteral() const override { return !this->source || this->source->isLiteral(); }
 private:
 	ValuePtr value;
+	shared_ptr<Expression> source;
 };
 
 class Range : public Expression
@@ -109,6 +173,9 @@ public:
 	Range(Expression *begin, Expression *step, Expression *end, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
 	bool isLiteral() const override;
 private:
 	shared_ptr<Expression> begin;
@@ -122,6 +189,9 @@ public:
 	Vector(const Location &loc);
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
 	void push_back(Expression *expr);
 	bool isLiteral() const override;
 private:
@@ -135,8 +205,33 @@ public:
 	ValuePtr evaluate(const class Context *context) const override;
 	ValuePtr evaluateSilently(const class Context *context) const;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
+	bool compile(class FunctionCompiler &compiler, bool tail) const override;
+private:
+	std::string name;
+};
+
+/*!
+	A subexpression of a list comprehension for loop body which doesn't
+	depend on the loop variable. The loop evaluates it once and provides the
+	value under the given name, see LcFor::evaluate(). Prints and serializes
+	as the subexpression.
+*/
+class HoistedLookup : public Expression
+{
+public:
+	HoistedLookup(const std::string &name, const shared_ptr<Expression> &expr);
+	ValuePtr evaluate(const class Context *context) const override;
+	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
+	bool isLiteral() const override { return this->expr->isLiteral(); }
 private:
 	std::string name;
+	shared_ptr<Expression> expr;
 };
 
 class MemberLookup : public Expression
@@ -145,6 +240,9 @@ public:
 	MemberLookup(Expression *expr, const std::string &member, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
 private:
 	shared_ptr<Expression> expr;
 	std::string member;
@@ -157,12 +255,23 @@ public:
 	void prepareTailCallContext(const Context *context, Context *tailCallContext, const AssignmentList &definition_arguments);
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
+	bool compile(class FunctionCompiler &compiler, bool tail) const override;
 	static Expression * create(const std::string &funcname, const AssignmentList &arglist, Expression *expr, const Location &loc);
 public:
 	std::string name;
 	AssignmentList arguments;
-	AssignmentMap resolvedArguments;
-	std::vector<std::pair<std::string, ValuePtr>> defaultArguments; // Only the ones not mentioned in 'resolvedArguments'
+
+private:
+	// Parameters of a tail call, found on the first call. Replaced atomically,
+	// as calls can be evaluated by several threads, see LcFor::evaluate().
+	struct TailCallArguments {
+		AssignmentMap resolved;
+		std::vector<std::pair<std::string, ValuePtr>> defaults; // Only the ones not mentioned in 'resolved'
+	};
+	shared_ptr<const TailCallArguments> tailCallArguments;
 };
 
 class Assert : public Expression
@@ -172,6 +281,9 @@ public:
 	const shared_ptr<Expression> &evaluateStep(const Context *context) const;
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
 private:
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
@@ -184,6 +296,9 @@ public:
 	const shared_ptr<Expression> &evaluateStep(const Context *context) const;
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
 private:
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
@@ -196,6 +311,10 @@ public:
 	const shared_ptr<Expression> &evaluateStep(Context *context) const;
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
+	bool compile(class FunctionCompiler &compiler, bool tail) const override;
 private:
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
@@ -214,6 +333,9 @@ public:
 	LcIf(Expression *cond, Expression *ifexpr, Expression *elseexpr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
 private:
 	shared_ptr<Expression> cond;
 	shared_ptr<Expression> ifexpr;
@@ -226,9 +348,14 @@ public:
 	LcFor(const AssignmentList &args, Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
 private:
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
+	// Subexpressions of expr evaluated once per loop, see HoistedLookup
+	AssignmentList hoisted;
 };
 
 class LcForC : public ListComprehension
@@ -237,6 +364,9 @@ public:
 	LcForC(const AssignmentList &args, const AssignmentList &incrargs, Expression *cond, Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
 private:
 	AssignmentList arguments;
 	AssignmentList incr_arguments;
@@ -250,6 +380,9 @@ public:
 	LcEach(Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
 private:
 	shared_ptr<Expression> expr;
 };
@@ -260,6 +393,9 @@ public:
 	LcLet(const AssignmentList &args, Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+	void serialize(class ASTWriter &writer) const override;
+	void collectReferences(ReferenceCollector &refs) const override;
+	void optimize(class ExpressionOptimizer &optimizer) override;
 private:
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
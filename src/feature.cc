@@ -20,6 +20,15 @@ Feature::list_t Feature::feature_list;
  * context.
  */
 const Feature Feature::ExperimentalInputDriverDBus("input-driver-dbus", "Enable DBus input drivers (requires restart)");
+const Feature Feature::ExperimentalDisjointUnion("disjoint-union", "Skip CGAL for unions of objects with non-overlapping bounding boxes");
+const Feature Feature::ExperimentalCompactCGALCache("compact-cgal-cache", "Keep evicted CGAL cache entries in serialized form instead of dropping them");
+const Feature Feature::ExperimentalInexactRender("inexact-render", "Use fast, floating point CSG operations for interactive renders. Export requires an exact render.");
+const Feature Feature::ExperimentalBackgroundRender("background-render", "Render the design in the background after each preview, so a following render (F6) is faster");
+const Feature Feature::ExperimentalIncrementalInstantiation("incremental-instantiation", "When only customizer parameters or special variables like $t change, re-instantiate just the top level statements depending on them");
+const Feature Feature::ExperimentalFunctionMemoization("function-memoization", "Remember the results of user functions which only depend on their arguments, instead of evaluating repeated calls again");
+const Feature Feature::ExperimentalCompiledFunctions("compiled-functions", "Compile numeric user functions to bytecode when first called, for faster evaluation of repeated and recursive calls");
+const Feature Feature::ExperimentalConstantFolding("constant-folding", "Evaluate constant expressions once after parsing, and parts of list comprehensions not depending on the loop variable once per loop");
+const Feature Feature::ExperimentalGeometryDeduplication("geometry-deduplication", "Share identical geometries between cache entries and drop identical children of unions. Hashes every vertex, so it only pays off for designs with many repeated parts");
 
 Feature::Feature(const std::string &name, const std::string &description)
 	: enabled(false), name(name), description(description)
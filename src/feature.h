@@ -15,6 +15,15 @@ public:
 	typedef list_t::iterator iterator;
 
         static const Feature ExperimentalInputDriverDBus;
+        static const Feature ExperimentalDisjointUnion;
+        static const Feature ExperimentalCompactCGALCache;
+        static const Feature ExperimentalInexactRender;
+        static const Feature ExperimentalBackgroundRender;
+        static const Feature ExperimentalIncrementalInstantiation;
+        static const Feature ExperimentalFunctionMemoization;
+        static const Feature ExperimentalCompiledFunctions;
+        static const Feature ExperimentalConstantFolding;
+        static const Feature ExperimentalGeometryDeduplication;
 
 	const std::string& get_name() const;
 	const std::string& get_description() const;
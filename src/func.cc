@@ -110,6 +110,9 @@ ValuePtr builtin_sign(const Context *ctx, const EvalContext *evalctx)
 
 ValuePtr builtin_rands(const Context *ctx, const EvalContext *evalctx)
 {
+	// The random number generators are shared by all threads
+	check_worker_thread();
+
 	size_t n = evalctx->numArgs();
 	if (n == 3 || n == 4) {
 		ValuePtr v0 = evalctx->getArgValue(0);
@@ -26,18 +26,137 @@
 
 #include "function.h"
 #include "evalcontext.h"
+#include "modcontext.h"
 #include "expression.h"
+#include "builtin.h"
+#include "feature.h"
 #include "printutils.h"
+#include "FunctionProgram.h"
 
 #include <typeinfo>
 #include <forward_list>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <boost/functional/hash.hpp>
+
+namespace {
+	// Limits on the memo of each function
+	const size_t MEMO_MAX_ENTRIES = 10000;
+	const size_t MEMO_MAX_KEY_ELEMENTS = 1000;
+
+	// Set while a call whose bytecode recursed too deep is evaluated from the
+	// AST, for the rest of its call chain
+	thread_local bool bytecode_too_deep = false;
+
+	// Special variables are passed down the call chain, see Context::lookup_variable()
+	bool is_special_variable(const std::string &name)
+	{
+		return !name.empty() && name[0] == '$';
+	}
+
+	uint64_t double_bits(double d)
+	{
+		uint64_t bits;
+		std::memcpy(&bits, &d, sizeof(bits));
+		return bits;
+	}
+
+	/*
+		Numbers are hashed and compared by their bits, so the results for
+		0 and -0 are kept apart. Returns false if the key gets too large.
+	*/
+	bool hash_value(const Value &v, size_t &seed, size_t &numElements)
+	{
+		if (++numElements > MEMO_MAX_KEY_ELEMENTS) return false;
+		boost::hash_combine(seed, int(v.type()));
+		switch (v.type()) {
+		case Value::ValueType::BOOL:
+			boost::hash_combine(seed, v.toBool());
+			break;
+		case Value::ValueType::NUMBER:
+			boost::hash_combine(seed, double_bits(v.toDouble()));
+			break;
+		case Value::ValueType::STRING:
+			boost::hash_combine(seed, v.toString());
+			break;
+		case Value::ValueType::VECTOR:
+			for (const auto &e : v.toVector()) {
+				if (!hash_value(*e, seed, numElements)) return false;
+			}
+			break;
+		case Value::ValueType::RANGE: {
+			RangeType range = v.toRange();
+			boost::hash_combine(seed, double_bits(range.begin_value()));
+			boost::hash_combine(seed, double_bits(range.step_value()));
+			boost::hash_combine(seed, double_bits(range.end_value()));
+			break;
+		}
+		default:
+			break;
+		}
+		return true;
+	}
+
+	bool identical(const Value &a, const Value &b)
+	{
+		if (a.type() != b.type()) return false;
+		switch (a.type()) {
+		case Value::ValueType::NUMBER:
+			return double_bits(a.toDouble()) == double_bits(b.toDouble());
+		case Value::ValueType::VECTOR: {
+			const auto &va = a.toVector();
+			const auto &vb = b.toVector();
+			if (va.size() != vb.size()) return false;
+			for (size_t i = 0; i < va.size(); i++) {
+				if (va[i] != vb[i] && !identical(*va[i], *vb[i])) return false;
+			}
+			return true;
+		}
+		default:
+			return a == b;
+		}
+	}
+}
+
+/*!
+	Results of earlier calls of a UserFunction, keyed by the values of its
+	parameters and of the outside variables it refers to.
+*/
+class FunctionMemo
+{
+public:
+	struct Key {
+		std::vector<ValuePtr> values;
+		size_t hash = 0;
+		size_t numElements = 0;
+
+		// Returns false if the key got too large to be worth memoizing
+		bool add(const ValuePtr &value) {
+			this->values.push_back(value);
+			return hash_value(*value, this->hash, this->numElements);
+		}
+		bool operator==(const Key &other) const {
+			if (this->values.size() != other.values.size()) return false;
+			for (size_t i = 0; i < this->values.size(); i++) {
+				if (!identical(*this->values[i], *other.values[i])) return false;
+			}
+			return true;
+		}
+	};
+	struct KeyHash {
+		size_t operator()(const Key &key) const { return key.hash; }
+	};
+
+	std::unordered_map<Key, ValuePtr, KeyHash> results;
+};
 
 AbstractFunction::~AbstractFunction()
 {
 }
 
 UserFunction::UserFunction(const char *name, AssignmentList &definition_arguments, shared_ptr<Expression> expr, const Location &loc)
-	: ASTNode(loc), name(name), definition_arguments(definition_arguments), expr(expr)
+	: ASTNode(loc), name(name), definition_arguments(definition_arguments), expr(expr), memoization(Memoization::Unknown)
 {
 }
 
@@ -45,12 +164,134 @@ UserFunction::~UserFunction()
 {
 }
 
+/*!
+	Decides which of the functions defined in one scope have results depending
+	only on their arguments and on variables from outside, so they can be
+	memoized. This excludes functions which echo(), assert(), refer to special
+	variables, or call functions other than the pure builtins and memoizable
+	functions of the same scope. Calls to other functions of the same scope are
+	resolved within the scope, as ModuleContext::evaluate_function() does.
+*/
+void UserFunction::analyzeMemoization(const LocalScope::FunctionContainer &functions)
+{
+	std::unordered_map<const UserFunction *, ReferenceCollector> references;
+	for (const auto &f : functions) {
+		auto &refs = references[f.second];
+		for (const auto &arg : f.second->definition_arguments) refs.bind(arg.name);
+		refs.collect(f.second->expr);
+
+		bool memoizable = !refs.sideEffects;
+		for (const auto &arg : f.second->definition_arguments) {
+			if (is_special_variable(arg.name)) memoizable = false;
+		}
+		for (const auto &variable : refs.variables) {
+			if (is_special_variable(variable)) memoizable = false;
+		}
+		for (const auto &function : refs.functions) {
+			if (functions.find(function) != functions.end()) continue;
+			if (!Builtins::isPureFunction(function)) memoizable = false;
+		}
+		f.second->memoization = memoizable ? Memoization::Enabled : Memoization::Disabled;
+		f.second->memoVariables.assign(refs.variables.begin(), refs.variables.end());
+	}
+
+	// Propagate through calls within the scope until nothing changes, as
+	// functions may be mutually recursive
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (const auto &f : functions) {
+			if (f.second->memoization == Memoization::Disabled) continue;
+			auto &variables = references[f.second].variables;
+			for (const auto &function : references[f.second].functions) {
+				auto callee = functions.find(function);
+				if (callee == functions.end() || callee->second == f.second) continue;
+				if (callee->second->memoization == Memoization::Disabled) {
+					f.second->memoization = Memoization::Disabled;
+					changed = true;
+					break;
+				}
+				for (const auto &variable : references[callee->second].variables) {
+					if (variables.insert(variable).second) {
+						f.second->memoVariables.push_back(variable);
+						changed = true;
+					}
+				}
+			}
+		}
+	}
+}
+
+bool UserFunction::isMemoizable(const Context *ctx) const
+{
+	if (this->memoization == Memoization::Unknown) {
+		// Functions are only called from the context of the scope defining them
+		auto modctx = dynamic_cast<const ModuleContext *>(ctx);
+		if (modctx && modctx->functions_p) {
+			analyzeMemoization(*modctx->functions_p);
+		}
+		if (this->memoization == Memoization::Unknown) this->memoization = Memoization::Disabled;
+	}
+	return this->memoization == Memoization::Enabled;
+}
+
 ValuePtr UserFunction::evaluate(const Context *ctx, const EvalContext *evalctx) const
 {
 	if (!expr) return ValuePtr::undefined;
 	Context c_next(ctx); // Context for next tail call
 	c_next.setVariables(evalctx, definition_arguments);
 
+	// Look for the result of an earlier call with the same arguments, if the
+	// result only depends on them and on the given outside variables
+	FunctionMemo::Key memoKey;
+	// The memo isn't shared with worker threads
+	bool memoize = Feature::ExperimentalFunctionMemoization.is_enabled() && !is_worker_thread() && isMemoizable(ctx);
+	if (memoize) {
+		for (const auto &arg : definition_arguments) {
+			if (!memoKey.add(c_next.lookup_variable(arg.name, true))) memoize = false;
+		}
+		for (const auto &variable : memoVariables) {
+			// Unknown variables would cause a warning for every call
+			auto value = ctx->lookup_variable(variable, true);
+			if (value->isUndefined() || !memoKey.add(value)) memoize = false;
+		}
+	}
+	if (memoize) {
+		if (!this->memo) this->memo.reset(new FunctionMemo);
+		auto found = this->memo->results.find(memoKey);
+		if (found != this->memo->results.end()) return found->second;
+	}
+
+	ValuePtr result;
+	auto status = FunctionProgram::Status::Unsupported;
+	if (Feature::ExperimentalCompiledFunctions.is_enabled() && !bytecode_too_deep) {
+		std::call_once(this->compiled, [&]() { this->program = FunctionProgram::compile(*this, ctx, c_next); });
+		if (this->program) status = this->program->run(ctx, c_next, result);
+	}
+	if (status == FunctionProgram::Status::TooDeep) {
+		// Each nested call would otherwise run the bytecode into the same limit
+		bytecode_too_deep = true;
+		try {
+			result = evaluateAST(ctx, c_next);
+		} catch (...) {
+			bytecode_too_deep = false;
+			throw;
+		}
+		bytecode_too_deep = false;
+	}
+	else if (status != FunctionProgram::Status::Done) {
+		result = evaluateAST(ctx, c_next);
+	}
+
+	if (memoize) {
+		if (this->memo->results.size() >= MEMO_MAX_ENTRIES) this->memo->results.clear();
+		this->memo->results.emplace(std::move(memoKey), result);
+	}
+	return result;
+}
+
+ValuePtr UserFunction::evaluateAST(const Context *ctx, Context &c_next) const
+{
 	// Outer loop: to allow tail calls
 	unsigned int counter = 0;
 	ValuePtr result;
@@ -117,7 +358,6 @@ ValuePtr UserFunction::evaluate(const Context *ctx, const EvalContext *evalctx)
 			throw RecursionException::create("function", this->name,loc);
 		}
 	}
-
 	return result;
 }
 
@@ -7,6 +7,9 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 class AbstractFunction
 {
@@ -47,4 +50,20 @@ public:
 
 	ValuePtr evaluate(const Context *ctx, const EvalContext *evalctx) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
+
+private:
+	ValuePtr evaluateAST(const Context *ctx, Context &c_next) const;
+	bool isMemoizable(const Context *ctx) const;
+	static void analyzeMemoization(const std::unordered_map<std::string, UserFunction*> &functions);
+
+	// Whether results can be memoized, found when first called, see isMemoizable()
+	enum class Memoization { Unknown, Enabled, Disabled };
+	mutable Memoization memoization;
+	// Variables from outside the function the result depends on
+	mutable std::vector<std::string> memoVariables;
+	// Results of earlier calls
+	mutable std::unique_ptr<class FunctionMemo> memo;
+	// Bytecode, compiled when first called if possible
+	mutable std::once_flag compiled;
+	mutable std::unique_ptr<class FunctionProgram> program;
 };
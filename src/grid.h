@@ -7,6 +7,7 @@
 
 #include <cstdint> // int64_t
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 
 //const double GRID_COARSE = 0.001;
@@ -109,7 +110,7 @@ public:
 		Vector3l key;
 		createGridVertex(v, key);
 		typename GridContainer::iterator iter = db.find(key);
-		if (iter == db.end()) {
+		if (iter == db.end() && nearOccupied(key)) {
 			float dist = 10.0f; // > max possible distance
 			for (int64_t jx = key[0] - 1; jx <= key[0] + 1; jx++) {
 				for (int64_t jy = key[1] - 1; jy <= key[1] + 1; jy++) {
@@ -131,6 +132,7 @@ public:
 		if (iter == db.end()) { // Not found: insert using key
 			data = db.size();
 			db[key] = data;
+			blocks.insert(blockKey(key));
 		}
 		else {
 			// If found return existing data
@@ -147,12 +149,14 @@ public:
 	}
 
 	bool has(const Vector3d &v, T *data = nullptr) {
-		Vector3l key = createGridVertex(v);
+		Vector3l key;
+		createGridVertex(v, key);
 		typename GridContainer::iterator pos = db.find(key);
 		if (pos != db.end()) {
 			if (data) *data = pos->second;
 			return true;
 		}
+		if (!nearOccupied(key)) return false;
 		for (int64_t jx = key[0] - 1; jx <= key[0] + 1; jx++)
 			for (int64_t jy = key[1] - 1; jy <= key[1] + 1; jy++)
 				for (int64_t jz = key[2] - 1; jz <= key[2] + 1; jz++) {
@@ -169,4 +173,31 @@ public:
 		return align(v);
 	}
 
+private:
+	/*
+		Cells are grouped into blocks of 2^BLOCK_SHIFT cells per side, and blocks
+		holds every block containing at least one vertex. A vertex missing from db
+		only needs its 26 neighbouring cells probed if one of the (usually one, at
+		most eight) blocks overlapping them is occupied. Except for very dense
+		meshes, this replaces 27 lookups per new vertex by one or two.
+	*/
+	static const int BLOCK_SHIFT = 4;
+	std::unordered_set<Key> blocks;
+
+	static Key blockKey(const Key &key) {
+		return Key(key[0] >> BLOCK_SHIFT, key[1] >> BLOCK_SHIFT, key[2] >> BLOCK_SHIFT);
+	}
+
+	bool nearOccupied(const Key &key) const {
+		Key lo = blockKey(Key(key[0] - 1, key[1] - 1, key[2] - 1));
+		Key hi = blockKey(Key(key[0] + 1, key[1] + 1, key[2] + 1));
+		for (int64_t bx = lo[0]; bx <= hi[0]; bx++) {
+			for (int64_t by = lo[1]; by <= hi[1]; by++) {
+				for (int64_t bz = lo[2]; bz <= hi[2]; bz++) {
+					if (blocks.count(Key(bx, by, bz))) return true;
+				}
+			}
+		}
+		return false;
+	}
 };
@@ -10,9 +10,26 @@ namespace fs = boost::filesystem;
 
 std::unordered_set<std::string> dependencies;
 const char *make_command = nullptr;
+thread_local std::unordered_set<std::string> *dep_recorder = nullptr;
 
+std::unordered_set<std::string> *set_dep_recorder(std::unordered_set<std::string> *recorder)
+{
+	auto previous = dep_recorder;
+	dep_recorder = recorder;
+	return previous;
+}
+
+/*!
+	Workers can't touch the dependencies shared by all threads, so they only
+	record the file, for the main thread to handle it again later.
+*/
 void handle_dep(const std::string &filename)
 {
+	if (dep_recorder) dep_recorder->insert(filename);
+	if (is_worker_thread()) {
+		if (dep_recorder) return;
+		check_worker_thread();
+	}
 	fs::path filepath(filename);
 	std::string dep = boost::regex_replace(filepath.generic_string(), boost::regex("\\ "), "\\\\ ");
 	if (dependencies.find(dep) != dependencies.end()) {
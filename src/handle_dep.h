@@ -1,7 +1,12 @@
 #pragma once
 
 #include <string>
+#include <unordered_set>
 
 extern const char *make_command;
 void handle_dep(const std::string &filename);
+// Adds every file subsequently passed to handle_dep() on the calling thread
+// to the given set. Pass nullptr to stop recording. Returns the previous
+// recorder. On worker threads, files are only recorded, see handle_dep().
+std::unordered_set<std::string> *set_dep_recorder(std::unordered_set<std::string> *recorder);
 bool write_deps(const std::string &filename, const std::string &output_file);
@@ -56,6 +56,7 @@
 #include "ProgressWidget.h"
 #include "ThrownTogetherRenderer.h"
 #include "CSGTreeNormalizer.h"
+#include "feature.h"
 #include "QGLView.h"
 #ifdef Q_OS_MAC
 #include "CocoaUtils.h"
@@ -236,9 +237,13 @@ MainWindow::MainWindow(const QStringList &filenames)
 	this->cgalworker = new CGALWorker();
 	connect(this->cgalworker, SIGNAL(done(shared_ptr<const Geometry>)),
 					this, SLOT(actionRenderDone(shared_ptr<const Geometry>)));
+	this->backgroundworker = new CGALWorker();
+	connect(this->backgroundworker, SIGNAL(done(shared_ptr<const Geometry>)),
+					this, SLOT(backgroundRenderDone(shared_ptr<const Geometry>)));
 #endif
 
 #ifdef ENABLE_CGAL
+	this->root_geom_inexact = false;
 	this->cgalRenderer = nullptr;
 #endif
 #ifdef ENABLE_OPENCSG
@@ -749,6 +754,11 @@ void MainWindow::updateReorderMode(bool reorderMode)
 
 MainWindow::~MainWindow()
 {
+#ifdef ENABLE_CGAL
+	// closeEvent() defers closing until the background render has stopped, so
+	// this doesn't block
+	this->backgroundworker->wait();
+#endif
 	// If root_module is not null then it will be the same as parsed_module,
 	// so no need to delete it.
 	delete parsed_module;
@@ -900,6 +910,10 @@ void MainWindow::updateTVal()
 */
 void MainWindow::compile(bool reload, bool forcedone, bool rebuildParameterWidget)
 {
+	// Compiling may replace the tree the background render is working on.
+	// Rather than blocking the GUI until the render stops, compile once it has.
+	if (deferUntilBackgroundRenderDone([=]() { compile(reload, forcedone, rebuildParameterWidget); })) return;
+
 	OpenSCAD::hardwarnings = Preferences::inst()->getValue("advanced/enableHardwarnings").toBool();
 	OpenSCAD::parameterCheck = Preferences::inst()->getValue("advanced/enableParameterCheck").toBool();
 	OpenSCAD::rangeCheck = Preferences::inst()->getValue("advanced/enableParameterRangeCheck").toBool();
@@ -933,6 +947,15 @@ void MainWindow::compile(bool reload, bool forcedone, bool rebuildParameterWidge
 				}
 			}
 		}
+		else if (Feature::ExperimentalIncrementalInstantiation.is_enabled() &&
+						 this->root_module && activeEditor == customizerEditor &&
+						 activeEditor->toPlainText() == this->last_compiled_doc) {
+			// Only customizer parameters or special variables like $t can have
+			// changed. Keep the AST, so instantiateRoot() can reuse the nodes which
+			// don't depend on them.
+			this->parameterWidget->applyParameters(this->root_module);
+			forcedone = true;
+		}
 		else {
 			shouldcompiletoplevel = true;
 		}
@@ -967,6 +990,8 @@ void MainWindow::compile(bool reload, bool forcedone, bool rebuildParameterWidge
 				this->deps_mtime = mtime;
 				PRINTB("Used file cache size: %d files", ModuleCache::instance()->size());
 				didcompile = true;
+				// Nodes may refer to the replaced modules
+				this->toplevel_nodes.clear();
 			}
 		}
 
@@ -1088,8 +1113,9 @@ void MainWindow::instantiateRoot()
 	delete this->thrownTogetherRenderer;
 	this->thrownTogetherRenderer = nullptr;
 
-	// Remove previous CSG tree
-	delete this->absolute_root_node;
+	// Remove previous CSG tree. Its nodes are deleted after instantiation,
+	// since the new tree may reuse some of them.
+	auto previous_root = this->absolute_root_node;
 	this->absolute_root_node = nullptr;
 
 	this->csgRoot.reset();
@@ -1107,14 +1133,29 @@ void MainWindow::instantiateRoot()
 		PRINT("Compiling design (CSG Tree generation)...");
 		this->processEvents();
 
-		AbstractNode::resetIndexCounter();
+		const bool incremental = Feature::ExperimentalIncrementalInstantiation.is_enabled();
+		if (!incremental) this->toplevel_nodes.clear();
+		// Reused nodes keep their indices, so keep counting to keep them unique
+		if (this->toplevel_nodes.empty()) AbstractNode::resetIndexCounter();
 
 		// split these two lines - gcc 4.7 bug
 		auto mi = ModuleInstantiation( "group" );
 		this->root_inst = mi;
 
 		FileContext filectx(&top_ctx);
-		this->absolute_root_node = this->root_module->instantiateWithFileContext(&filectx, &this->root_inst, nullptr);
+		if (incremental) {
+			this->absolute_root_node = this->root_module->instantiateWithFileContext(&filectx, &this->root_inst, nullptr, &this->toplevel_nodes);
+			if (previous_root) {
+				// Reused nodes now belong to the new tree
+				auto &children = previous_root->children;
+				for (const auto &toplevel : this->toplevel_nodes) {
+					children.erase(std::remove(children.begin(), children.end(), toplevel.node), children.end());
+				}
+			}
+		}
+		else {
+			this->absolute_root_node = this->root_module->instantiateWithFileContext(&filectx, &this->root_inst, nullptr);
+		}
 		this->updateCamera(filectx);
 		
 		if (this->absolute_root_node) {
@@ -1127,6 +1168,10 @@ void MainWindow::instantiateRoot()
 			this->tree.setRoot(this->root_node);
 		}
 	}
+	else {
+		this->toplevel_nodes.clear();
+	}
+	delete previous_root;
 
 	if (!this->root_node) {
 		if (parser_error_pos < 0) {
@@ -1707,6 +1752,7 @@ void MainWindow::parseTopLevelDocument(bool rebuildParameterWidget)
 
 	auto fnameba = activeEditor->filepath.toLocal8Bit();
 	const char* fname = activeEditor->filepath.isEmpty() ? "" : fnameba;
+	this->toplevel_nodes.clear();
 	delete this->parsed_module;
 	this->root_module = parse(this->parsed_module, fulltext, fname, fname, false) ? this->parsed_module : nullptr;
 
@@ -1775,7 +1821,10 @@ void MainWindow::actionReloadRenderPreview()
 
 void MainWindow::csgReloadRender()
 {
-	if (this->root_node) compileCSG();
+	if (this->root_node) {
+		compileCSG();
+		startBackgroundRender();
+	}
 
 	// Go to non-CGAL view mode
 	if (viewActionThrownTogether->isChecked()) {
@@ -1818,7 +1867,10 @@ void MainWindow::actionRenderPreview(bool rebuildParameterWidget)
 
 void MainWindow::csgRender()
 {
-	if (this->root_node) compileCSG();
+	if (this->root_node) {
+		compileCSG();
+		if (!animate_timer->isActive()) startBackgroundRender();
+	}
 
 	// Go to non-CGAL view mode
 	if (viewActionThrownTogether->isChecked()) {
@@ -2035,15 +2087,76 @@ void MainWindow::cgalRender()
 	delete this->cgalRenderer;
 	this->cgalRenderer = nullptr;
 	this->root_geom.reset();
+	this->root_geom_inexact = Feature::ExperimentalInexactRender.is_enabled();
 
-	PRINT("Rendering Polygon Mesh using CGAL...");
+	if (this->root_geom_inexact) PRINT("Rendering Polygon Mesh using inexact CSG operations...");
+	else PRINT("Rendering Polygon Mesh using CGAL...");
 
 	this->progresswidget = new ProgressWidget(this);
 	connect(this->progresswidget, SIGNAL(requestShow()), this, SLOT(showProgress()));
 
 	progress_report_prep(this->root_node, report_func, this);
 
-	this->cgalworker->start(this->tree);
+	this->cgalworker->start(this->tree, this->root_geom_inexact);
+}
+
+#endif /* ENABLE_CGAL */
+
+/*!
+	Speculatively renders the design just previewed, so the geometry caches
+	are warm when the user renders (F6) it. The render runs until it's done,
+	the design is edited or recompiled, or the caches are flushed.
+
+	Note that the previewed tree is evaluated with $preview = true, so parts
+	of a design depending on $preview will not be reused by the real render.
+*/
+void MainWindow::startBackgroundRender()
+{
+#ifdef ENABLE_CGAL
+	if (!Feature::ExperimentalBackgroundRender.is_enabled() || !this->root_node) return;
+	if (this->backgroundworker->isRunning()) return;
+	this->backgroundworker->startBackground(this->tree);
+#endif
+}
+
+/*!
+	Asks the background render to stop, without waiting for it.
+	Called whenever the design is edited.
+*/
+void MainWindow::cancelBackgroundRender()
+{
+#ifdef ENABLE_CGAL
+	this->backgroundworker->cancel();
+#endif
+}
+
+/*!
+	If the background render is running, asks it to stop, and calls the given
+	function once it has. Returns whether the call was deferred. Anything
+	modifying the node tree or the geometry caches must be deferred this way,
+	since the render can take a while to stop within a CGAL operation, and the
+	GUI must stay responsive meanwhile.
+*/
+bool MainWindow::deferUntilBackgroundRenderDone(const std::function<void()> &continuation)
+{
+#ifdef ENABLE_CGAL
+	if (this->backgroundworker->isRunning()) {
+		this->backgroundworker->cancel();
+		this->afterBackgroundRender.push_back(continuation);
+		return true;
+	}
+#endif
+	return false;
+}
+
+#ifdef ENABLE_CGAL
+
+void MainWindow::backgroundRenderDone(shared_ptr<const Geometry>)
+{
+	// The continuations may start another background render and defer again
+	auto continuations = std::move(this->afterBackgroundRender);
+	this->afterBackgroundRender.clear();
+	for (const auto &continuation : continuations) continuation();
 }
 
 void MainWindow::actionRenderDone(shared_ptr<const Geometry> root_geom)
@@ -2277,6 +2390,12 @@ bool MainWindow::canExport(unsigned int dim)
 		}
 	}
 
+	if (this->root_geom_inexact) {
+		PRINT("UI-ERROR: Current top level object was rendered using inexact CSG operations. Disable the \"inexact-render\" feature and render again (F6) to export.");
+		clearCurrentOutput();
+		return false;
+	}
+
 	if (this->root_geom->getDimension() != dim) {
 		PRINTB("UI-ERROR: Current top level object is not a %dD object.", dim);
 		clearCurrentOutput();
@@ -2416,6 +2535,7 @@ void MainWindow::actionCopyViewport()
 
 void MainWindow::actionFlushCaches()
 {
+	if (deferUntilBackgroundRenderDone([this]() { actionFlushCaches(); })) return;
 	GeometryCache::instance()->clear();
 #ifdef ENABLE_CGAL
 	CGALCache::instance()->clear();
@@ -2846,6 +2966,10 @@ void MainWindow::helpFontInfo()
 
 void MainWindow::closeEvent(QCloseEvent *event)
 {
+	if (this->closeDeferred) {
+		event->accept();
+		return;
+	}
 	if (tabManager->shouldClose()) {
 		QSettingsCached settings;
 		settings.setValue("window/size", size());
@@ -2859,6 +2983,13 @@ void MainWindow::closeEvent(QCloseEvent *event)
 		this->consoleDock->disableSettingsUpdate();
 		this->parameterDock->disableSettingsUpdate();
 
+		// The background render uses the nodes deleted with this window
+		if (deferUntilBackgroundRenderDone([this]() { close(); })) {
+			this->closeDeferred = true;
+			hide();
+			event->ignore();
+			return;
+		}
 		event->accept();
 	} else {
 		event->ignore();
@@ -199,6 +199,15 @@ ValuePtr FileContext::evaluate_function(const std::string &name,
 	return ModuleContext::evaluate_function(name, evalctx);
 }
 
+bool FileContext::usesFunction(const std::string &name) const
+{
+	for (const auto &m : *this->usedlibs_p) {
+		auto usedmod = ModuleCache::instance()->lookup(m);
+		if (usedmod && usedmod->scope.functions.find(name) != usedmod->scope.functions.end()) return true;
+	}
+	return false;
+}
+
 AbstractNode *FileContext::instantiate_module(const ModuleInstantiation &inst, EvalContext *evalctx) const
 {
 	const auto foundm = this->findLocalModule(inst.name());
@@ -46,6 +46,8 @@ public:
 																		 const EvalContext *evalctx) const override;
 	AbstractNode *instantiate_module(const ModuleInstantiation &inst, 
 																					 EvalContext *evalctx) const override;
+	// Whether one of the libraries included by use<> defines the given function
+	bool usesFunction(const std::string &name) const;
 
 private:
 	const FileModule::ModuleContainer *usedlibs_p;
@@ -30,6 +30,9 @@ public:
 	AbstractNode(const class ModuleInstantiation *mi);
 	~AbstractNode();
 	virtual std::string toString() const;
+	/*! The text of this node within ID strings, which identify its geometry in
+	    the caches. Defaults to toString(), but may abbreviate large arguments. */
+	virtual std::string toIdString() const { return toString(); }
 	/*! The 'OpenSCAD name' of this node, defaults to classname, but can be 
 	    overloaded to provide specialization for e.g. CSG nodes, primitive nodes etc.
 	    Used for human-readable output. */
@@ -148,7 +148,7 @@ Response NodeDumper::visit(State &state, const AbstractNode &node)
 		if (this->idString) {
 			
 			static const boost::regex re("[^\\s\\\"]+|\\\"(?:[^\\\"\\\\]|\\\\.)*\\\"");
-			const auto name = STR(node);
+			const auto name = node.toIdString();
 			boost::sregex_token_iterator it(name.begin(), name.end(), re, 0);
 			std::copy(it, boost::sregex_token_iterator(), std::ostream_iterator<std::string>(this->dumpstream));
 		
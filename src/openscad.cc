@@ -30,6 +30,7 @@
 #include "FileModule.h"
 #include "ModuleInstantiation.h"
 #include "builtincontext.h"
+#include "modcontext.h"
 #include "value.h"
 #include "export.h"
 #include "builtin.h"
@@ -46,11 +47,14 @@
 #include "FontCache.h"
 #include "OffscreenView.h"
 #include "GeometryEvaluator.h"
+#include "parallel.h"
+#include "ASTCache.h"
 
 #include"parameter/parameterset.h"
 #include <string>
 #include <vector>
 #include <fstream>
+#include <algorithm>
 
 #ifdef ENABLE_CGAL
 #include "CGAL_Nef_polyhedron.h"
@@ -79,6 +83,11 @@
 #define snprintf _snprintf
 #endif
 
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 using std::string;
@@ -104,6 +113,7 @@ public:
 		*thisp << msg << "\n";
 	}
 	~Echostream() {
+		set_output_handler(nullptr, nullptr);
 		this->close();
 	}
 };
@@ -269,14 +279,11 @@ void set_render_color_scheme(const std::string color_scheme, const bool exit_if_
 	}
 }
 
-int cmdline(const char *deps_output_file, const std::string &filename, const char *output_file, const fs::path &original_path, const std::string &parameterFile, const std::string &setName, const ViewOptions& viewOptions, Camera camera, const std::string &export_format)
+int cmdline(const char *deps_output_file, const std::string &filename, const char *output_file, const fs::path &original_path, const std::string &parameterFile, const std::string &setName, const ViewOptions& viewOptions, Camera camera, const std::string &export_format, unsigned int animate_frames)
 {
 	Tree tree;
 	boost::filesystem::path doc(filename);
 	tree.setDocumentPath(doc.remove_filename().string());
-#ifdef ENABLE_CGAL
-	GeometryEvaluator geomevaluator(tree);
-#endif
 
 	ExportFileFormatOptions exportFileFormatOptions;
 	FileFormat curFormat;
@@ -302,6 +309,10 @@ int cmdline(const char *deps_output_file, const std::string &filename, const cha
 	}
 
 	curFormat = exportFileFormatOptions.exportFileFormats.at(formatName);
+#ifdef ENABLE_CGAL
+	// Like interactive renders, rendered png images may use inexact CSG operations
+	GeometryEvaluator geomevaluator(tree, curFormat == FileFormat::PNG && Feature::ExperimentalInexactRender.is_enabled());
+#endif
 	std::string filename_str = fs::path(output_file_str).generic_string();
 	new_output_file = filename_str.c_str();
 
@@ -314,16 +325,10 @@ int cmdline(const char *deps_output_file, const std::string &filename, const cha
 #ifdef DEBUG
 	PRINTDB("BuiltinContext:\n%s", top_ctx.dump(nullptr, nullptr));
 #endif
-	shared_ptr<Echostream> echostream;
-	if (curFormat == FileFormat::ECHO) {
-		echostream.reset(new Echostream(new_output_file));
-	}
-
 	FileModule *root_module;
 	ModuleInstantiation root_inst("group");
-	AbstractNode *root_node;
-	AbstractNode *absolute_root_node;
-	shared_ptr<const Geometry> root_geom;
+	AbstractNode *root_node = nullptr;
+	AbstractNode *absolute_root_node = nullptr;
 
 	handle_dep(filename);
 
@@ -344,7 +349,7 @@ int cmdline(const char *deps_output_file, const std::string &filename, const cha
 	}
 
 	// add parameter to AST
-	CommentParser::collectParameters(text.c_str(), root_module);
+	CommentParser::collectParameters(text, root_module);
 	if (!parameterFile.empty() && !setName.empty()) {
 		ParameterSet param;
 		param.readParameterSet(parameterFile);
@@ -358,131 +363,241 @@ int cmdline(const char *deps_output_file, const std::string &filename, const cha
 	fs::current_path(fparent);
 	top_ctx.setDocumentPath(fparent.string());
 
-	AbstractNode::resetIndexCounter();
-	absolute_root_node = root_module->instantiate(&top_ctx, &root_inst, nullptr);
-
-	// Do we have an explicit root node (! modifier)?
-	if (!(root_node = find_root_tag(absolute_root_node))) {
-		root_node = absolute_root_node;
-	}
-	tree.setRoot(root_node);
-
-	if (deps_output_file) {
-		fs::current_path(original_path);
-		std::string deps_out(deps_output_file);
-		std::string geom_out(output_file);
-		int result = write_deps(deps_out, geom_out);
-		if (!result) {
-			PRINT("error writing deps");
-			return 1;
+	// Animation frames only differ in $t, so with incremental instantiation
+	// they reuse the top level nodes of the previous frame which don't depend on it
+	const bool incremental = animate_frames > 0 && Feature::ExperimentalIncrementalInstantiation.is_enabled();
+	FileModule::TopLevelNodes toplevel_nodes;
+
+	// Instantiates the design and exports it to the given file
+	bool deps_written = false;
+	auto export_design = [&](const char *design_output_file) -> int {
+		shared_ptr<Echostream> echostream;
+		if (curFormat == FileFormat::ECHO) {
+			echostream.reset(new Echostream(design_output_file));
 		}
-	}
-
-	if (curFormat == FileFormat::CSG) {
-		fs::current_path(original_path);
-		std::ofstream fstream(new_output_file);
-		if (!fstream.is_open()) {
-			PRINTB("Can't open file \"%s\" for export", new_output_file);
+		shared_ptr<const Geometry> root_geom;
+
+		fs::current_path(fparent);
+		if (incremental) {
+			// Reused nodes keep their indices, so keep counting to keep them unique
+			if (toplevel_nodes.empty()) AbstractNode::resetIndexCounter();
+			auto previous_root = absolute_root_node;
+			FileContext filectx(&top_ctx);
+			absolute_root_node = root_module->instantiateWithFileContext(&filectx, &root_inst, nullptr, &toplevel_nodes);
+			if (previous_root) {
+				// Reused nodes now belong to the new tree
+				auto &children = previous_root->children;
+				for (const auto &toplevel : toplevel_nodes) {
+					children.erase(std::remove(children.begin(), children.end(), toplevel.node), children.end());
+				}
+				delete previous_root;
+			}
 		}
 		else {
-			fs::current_path(fparent); // Force exported filenames to be relative to document path
-			fstream << tree.getString(*root_node, "\t") << "\n";
-			fstream.close();
+			AbstractNode::resetIndexCounter();
+			absolute_root_node = root_module->instantiate(&top_ctx, &root_inst, nullptr);
 		}
-	}
-	else if (curFormat == FileFormat::AST) {
-		fs::current_path(original_path);
-		std::ofstream fstream(new_output_file);
-		if (!fstream.is_open()) {
-			PRINTB("Can't open file \"%s\" for export", new_output_file);
+
+		// Do we have an explicit root node (! modifier)?
+		if (!(root_node = find_root_tag(absolute_root_node))) {
+			root_node = absolute_root_node;
 		}
-		else {
-			fs::current_path(fparent); // Force exported filenames to be relative to document path
-			fstream << root_module->dump("");
-			fstream.close();
+		tree.setRoot(root_node);
+
+		if (deps_output_file && !deps_written) {
+			deps_written = true;
+			fs::current_path(original_path);
+			std::string deps_out(deps_output_file);
+			std::string geom_out(output_file);
+			int result = write_deps(deps_out, geom_out);
+			if (!result) {
+				PRINT("error writing deps");
+				return 1;
+			}
 		}
-	}
-	else if (curFormat == FileFormat::TERM) {
-		CSGTreeEvaluator csgRenderer(tree);
-		auto root_raw_term = csgRenderer.buildCSGTree(*root_node);
 
-		fs::current_path(original_path);
-		std::ofstream fstream(new_output_file);
-		if (!fstream.is_open()) {
-			PRINTB("Can't open file \"%s\" for export", new_output_file);
+		if (curFormat == FileFormat::CSG) {
+			fs::current_path(original_path);
+			std::ofstream fstream(design_output_file);
+			if (!fstream.is_open()) {
+				PRINTB("Can't open file \"%s\" for export", design_output_file);
+			}
+			else {
+				fs::current_path(fparent); // Force exported filenames to be relative to document path
+				fstream << tree.getString(*root_node, "\t") << "\n";
+				fstream.close();
+			}
 		}
-		else {
-			if (!root_raw_term)
-				fstream << "No top-level CSG object\n";
+		else if (curFormat == FileFormat::AST) {
+			fs::current_path(original_path);
+			std::ofstream fstream(design_output_file);
+			if (!fstream.is_open()) {
+				PRINTB("Can't open file \"%s\" for export", design_output_file);
+			}
 			else {
-				fstream << root_raw_term->dump() << "\n";
+				fs::current_path(fparent); // Force exported filenames to be relative to document path
+				fstream << root_module->dump("");
+				fstream.close();
 			}
-			fstream.close();
 		}
-	}
-	else {
-#ifdef ENABLE_CGAL
-		if ((curFormat == FileFormat::ECHO || curFormat == FileFormat::PNG) && (viewOptions.renderer == RenderType::OPENCSG || viewOptions.renderer == RenderType::THROWNTOGETHER)) {
-			// echo or OpenCSG png -> don't necessarily need geometry evaluation
-		} else {
-			// Force creation of CGAL objects (for testing)
-			root_geom = geomevaluator.evaluateGeometry(*tree.root(), true);
-			if (!root_geom) root_geom.reset(new CGAL_Nef_polyhedron());
-			if (viewOptions.renderer == RenderType::CGAL && root_geom->getDimension() == 3) {
-				auto N = dynamic_cast<const CGAL_Nef_polyhedron*>(root_geom.get());
-				if (!N) {
-					N = CGALUtils::createNefPolyhedronFromGeometry(*root_geom);
-					root_geom.reset(N);
-					PRINT("Converted to Nef polyhedron");
+		else if (curFormat == FileFormat::TERM) {
+			CSGTreeEvaluator csgRenderer(tree);
+			auto root_raw_term = csgRenderer.buildCSGTree(*root_node);
+
+			fs::current_path(original_path);
+			std::ofstream fstream(design_output_file);
+			if (!fstream.is_open()) {
+				PRINTB("Can't open file \"%s\" for export", design_output_file);
+			}
+			else {
+				if (!root_raw_term)
+					fstream << "No top-level CSG object\n";
+				else {
+					fstream << root_raw_term->dump() << "\n";
 				}
+				fstream.close();
 			}
 		}
+		else {
+#ifdef ENABLE_CGAL
+			if ((curFormat == FileFormat::ECHO || curFormat == FileFormat::PNG) && (viewOptions.renderer == RenderType::OPENCSG || viewOptions.renderer == RenderType::THROWNTOGETHER)) {
+				// echo or OpenCSG png -> don't necessarily need geometry evaluation
+			} else {
+				// Force creation of CGAL objects (for testing)
+				root_geom = geomevaluator.evaluateGeometry(*tree.root(), true);
+				if (!root_geom) root_geom.reset(new CGAL_Nef_polyhedron());
+				if (viewOptions.renderer == RenderType::CGAL && root_geom->getDimension() == 3) {
+					auto N = dynamic_cast<const CGAL_Nef_polyhedron*>(root_geom.get());
+					if (!N) {
+						N = CGALUtils::createNefPolyhedronFromGeometry(*root_geom);
+						root_geom.reset(N);
+						PRINT("Converted to Nef polyhedron");
+					}
+				}
+			}
 
-		fs::current_path(original_path);
+			fs::current_path(original_path);
+
+			if(curFormat == FileFormat::STL ||
+				curFormat == FileFormat::OFF ||
+				curFormat == FileFormat::AMF ||
+				curFormat == FileFormat::_3MF ||
+				curFormat == FileFormat::NEFDBG ||
+				curFormat == FileFormat::NEF3 )
+			{
+				if(!checkAndExport(root_geom, 3, curFormat, design_output_file)) {
+					return 1;
+				}
+			}
 
-		if(curFormat == FileFormat::STL ||
-			curFormat == FileFormat::OFF ||
-			curFormat == FileFormat::AMF ||
-			curFormat == FileFormat::_3MF ||
-			curFormat == FileFormat::NEFDBG ||
-			curFormat == FileFormat::NEF3 )
-		{
-			if(!checkAndExport(root_geom, 3, curFormat, new_output_file)) {
-				return 1;
+			if(curFormat == FileFormat::DXF || curFormat == FileFormat::SVG) {
+				if (!checkAndExport(root_geom, 2, curFormat, design_output_file)) {
+					return 1;
+				}
 			}
-		}
 
-		if(curFormat == FileFormat::DXF || curFormat == FileFormat::SVG) {
-			if (!checkAndExport(root_geom, 2, curFormat, new_output_file)) {
-				return 1;
+			if (curFormat == FileFormat::PNG) {
+				auto success = true;
+				std::ofstream fstream(design_output_file,std::ios::out|std::ios::binary);
+				if (!fstream.is_open()) {
+					PRINTB("Can't open file \"%s\" for export", design_output_file);
+					success = false;
+				}
+				else {
+					if (viewOptions.renderer == RenderType::CGAL || viewOptions.renderer == RenderType::GEOMETRY) {
+						success = export_png(root_geom, viewOptions, camera, fstream);
+					} else {
+						success = export_preview_png(tree, viewOptions, camera, fstream);
+					}
+					fstream.close();
+				}
+				return success ? 0 : 1;
 			}
-		}
 
-		if (curFormat == FileFormat::PNG) {
-			auto success = true;
-			std::ofstream fstream(new_output_file,std::ios::out|std::ios::binary);
-			if (!fstream.is_open()) {
-				PRINTB("Can't open file \"%s\" for export", new_output_file);
-				success = false;
+#else
+			PRINT("OpenSCAD has been compiled without CGAL support!\n");
+			return 1;
+#endif
+		}
+		return 0;
+	};
+
+	if (animate_frames == 0) {
+		int rc = export_design(new_output_file);
+		if (rc == 0) delete root_node;
+		return rc;
+	}
+
+	// Exports frame i of the animation, with $t = i / animate_frames,
+	// to <output>NNNNN.<suffix>
+	auto export_frame = [&](unsigned int frame) -> int {
+		const fs::path output_path(output_file_str);
+		const auto frame_file = (output_path.parent_path() / (output_path.stem().string() +
+			str(boost::format("%05d") % frame) + output_path.extension().string())).generic_string();
+		top_ctx.set_variable("$t", ValuePtr(double(frame) / animate_frames));
+		int rc = export_design(frame_file.c_str());
+		tree.setRoot(nullptr);
+		// The next frame deletes it after taking the nodes it reuses
+		if (!incremental) {
+			delete absolute_root_node;
+			absolute_root_node = root_node = nullptr;
+		}
+		return rc;
+	};
+
+	// The first frame is rendered up front, which fills the geometry caches
+	// with all subtrees which don't depend on $t. With fork(), the remaining
+	// frames are then distributed over worker processes, which all inherit
+	// these caches. Exporting png using OpenGL isn't safe across fork(), so
+	// such animations are rendered sequentially.
+	int rc = export_frame(0);
+	if (rc != 0) return rc;
+#ifndef _WIN32
+	// Previews are always drawn with OpenGL, see --rasterizer
+	const bool usesOpenGL = curFormat == FileFormat::PNG && (preview || viewOptions.rasterizer != Rasterizer::SOFTWARE);
+	const unsigned int jobs = usesOpenGL ? 1 : std::min(parallel_thread_count(), animate_frames - 1);
+	if (jobs > 1) {
+		std::cout.flush();
+		std::cerr.flush();
+		fflush(nullptr);
+		std::vector<pid_t> workers;
+		for (unsigned int job = 0; job < jobs; job++) {
+			const pid_t pid = fork();
+			if (pid == 0) {
+				int workerrc = 0;
+				try {
+					for (unsigned int frame = 1 + job; frame < animate_frames; frame += jobs) {
+						workerrc = std::max(workerrc, export_frame(frame));
+					}
+				} catch (const HardWarningException &) {
+					workerrc = 1;
+				}
+				std::cout.flush();
+				std::cerr.flush();
+				fflush(nullptr);
+				_exit(workerrc);
 			}
-			else {
-				if (viewOptions.renderer == RenderType::CGAL || viewOptions.renderer == RenderType::GEOMETRY) {
-					success = export_png(root_geom, viewOptions, camera, fstream);
-				} else {
-					success = export_preview_png(tree, viewOptions, camera, fstream);
+			if (pid < 0) {
+				PRINT("Could not start animation worker process, rendering its frames sequentially.");
+				for (unsigned int frame = 1 + job; frame < animate_frames; frame += jobs) {
+					rc = std::max(rc, export_frame(frame));
 				}
-				fstream.close();
 			}
-			return success ? 0 : 1;
+			else {
+				workers.push_back(pid);
+			}
 		}
-
-#else
-		PRINT("OpenSCAD has been compiled without CGAL support!\n");
-		return 1;
+		for (const auto pid : workers) {
+			int status;
+			if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) rc = 1;
+		}
+		return rc;
+	}
 #endif
+	for (unsigned int frame = 1; frame < animate_frames; frame++) {
+		rc = std::max(rc, export_frame(frame));
 	}
-	delete root_node;
-	return 0;
+	return rc;
 }
 
 #ifdef OPENSCAD_QTGUI
@@ -845,7 +960,9 @@ int main(int argc, char **argv)
 		("viewall", "adjust camera to fit object")
 		("imgsize", po::value<string>(), "=width,height of exported png")
 		("render", po::value<string>()->implicit_value(""), "for full geometry evaluation when exporting png")
+		("rasterizer", po::value<string>(), "=opengl|software -rasterizer used for exporting rendered png, software doesn't need an OpenGL context")
 		("preview", po::value<string>()->implicit_value(""), "[=throwntogether] -for ThrownTogether preview png")
+		("animate", po::value<unsigned int>(), "=n -export n animation frames with $t = 0, 1/n, ..., (n-1)/n, numbering the output file name with the frame")
 		("view", po::value<CommaSeparatedVector>(), ("=view options: " + boost::join(viewOptions.names(), " | ")).c_str())
 		("projection", po::value<string>(), "=(o)rtho or (p)erspective when exporting png")
 		("csglimit", po::value<unsigned int>(), "=n -stop rendering at n CSG elements when exporting png")
@@ -859,6 +976,7 @@ int main(int argc, char **argv)
 		("m,m", po::value<string>(), "make_cmd -runs make_cmd file if file is missing")
 		("quiet,q", "quiet mode (don't print anything *except* errors)")
 		("hardwarnings", "Stop on the first warning")
+		("ast-cache", po::value<string>(), "=dir -keep parsed library files in dir for reuse by later runs")
 		("check-parameters", po::value<string>(), "=true/false, configure the parameter check for user modules and functions")
 		("check-parameter-ranges", po::value<string>(), "=true/false, configure the parameter range check for builtin modules")
 		("debug", po::value<string>(), "special debug info")
@@ -900,6 +1018,10 @@ int main(int argc, char **argv)
 	if (vm.count("hardwarnings")) {
 		OpenSCAD::hardwarnings = true;
 	}
+
+	if (vm.count("ast-cache")) {
+		ASTCache::setDirectory(vm["ast-cache"].as<string>());
+	}
 	
 	std::map<std::string, bool*> flags;
 	flags.insert(std::make_pair("check-parameters",&OpenSCAD::parameterCheck));
@@ -929,6 +1051,19 @@ int main(int argc, char **argv)
 		else viewOptions.renderer = RenderType::GEOMETRY;
 	}
 
+	if (vm.count("rasterizer")) {
+		const auto &rasterizer = vm["rasterizer"].as<string>();
+		if (rasterizer == "software") {
+			viewOptions.rasterizer = Rasterizer::SOFTWARE;
+			// The software rasterizer draws the rendered geometry only
+			if (vm.count("preview")) PRINT("WARNING: --rasterizer=software is ignored for preview png export, use --render");
+			else if (!vm.count("render")) viewOptions.renderer = RenderType::GEOMETRY;
+		}
+		else if (rasterizer != "opengl") {
+			PRINTB("Unknown --rasterizer '%s' ignored. Use -h to list available options.", rasterizer);
+		}
+	}
+
 	viewOptions.previewer = (viewOptions.renderer == RenderType::THROWNTOGETHER) ? Previewer::THROWNTOGETHER : Previewer::OPENCSG;
 	if (vm.count("view")) {
 		const auto &viewOptionValues = vm["view"].as<CommaSeparatedVector>();
@@ -1018,6 +1153,15 @@ int main(int argc, char **argv)
 		}
 	}
 
+	unsigned int animate_frames = 0;
+	if (vm.count("animate")) {
+		animate_frames = vm["animate"].as<unsigned int>();
+		if (animate_frames == 0) {
+			PRINT("--animate needs at least one frame");
+			exit(1);
+		}
+	}
+
 	currentdir = fs::current_path().generic_string();
 
 	Camera camera = get_camera(vm);
@@ -1037,7 +1181,7 @@ int main(int argc, char **argv)
 				rc = info();
 			}
 			else {
-				rc = cmdline(deps_output_file, inputFiles[0], output_file, original_path, parameterFile, parameterSet, viewOptions, camera, export_format);
+				rc = cmdline(deps_output_file, inputFiles[0], output_file, original_path, parameterFile, parameterSet, viewOptions, camera, export_format, animate_frames);
 			}
 		} catch (const HardWarningException &) {
 			rc = 1;
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+/*!
+	Number of worker threads to use for data-parallel loops.
+	Falls back to 1 if the hardware concurrency cannot be determined.
+*/
+inline unsigned int parallel_thread_count()
+{
+	unsigned int n = std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+/*!
+	Splits the index range [0, count) into contiguous chunks and calls
+	func(begin, end) for each chunk, one chunk per worker thread.
+	The calling thread processes the first chunk itself.
+
+	Ranges smaller than 2*mingrain are processed serially on the calling thread.
+	func must not touch unsynchronized shared state (including PRINT*()).
+	The first exception thrown by any chunk is rethrown after all threads have joined.
+*/
+template <typename Func>
+void parallel_for_chunks(size_t count, size_t mingrain, Func func)
+{
+	if (count == 0) return;
+	size_t nthreads = std::min<size_t>(parallel_thread_count(), count / std::max<size_t>(mingrain, 1));
+	if (nthreads <= 1) {
+		func(size_t(0), count);
+		return;
+	}
+
+	const size_t chunksize = (count + nthreads - 1) / nthreads;
+	std::vector<std::exception_ptr> errors(nthreads);
+	std::vector<std::thread> threads;
+	threads.reserve(nthreads - 1);
+	for (size_t t = 1; t < nthreads; t++) {
+		size_t begin = t * chunksize;
+		size_t end = std::min(count, begin + chunksize);
+		if (begin >= end) break;
+		threads.emplace_back([&func, &errors, t, begin, end]() {
+			try {
+				func(begin, end);
+			} catch (...) {
+				errors[t] = std::current_exception();
+			}
+		});
+	}
+	try {
+		func(size_t(0), std::min(count, chunksize));
+	} catch (...) {
+		errors[0] = std::current_exception();
+	}
+	for (auto &thread : threads) thread.join();
+	for (const auto &error : errors) {
+		if (error) std::rethrow_exception(error);
+	}
+}
+
+/*!
+	Calls func(i) for every i in [0, count), handing out indices dynamically
+	to the worker threads. Use this instead of parallel_for_chunks() when the
+	cost of individual items varies a lot.
+*/
+template <typename Func>
+void parallel_for_each_index(size_t count, Func func)
+{
+	std::atomic<size_t> next(0);
+	parallel_for_chunks(std::min<size_t>(count, parallel_thread_count()), 1, [&](size_t, size_t) {
+		for (size_t i = next++; i < count; i = next++) func(i);
+	});
+}
@@ -43,6 +43,7 @@
 #include "expression.h"
 #include "value.h"
 #include "function.h"
+#include "ExpressionOptimizer.h"
 #include "printutils.h"
 #include "memory.h"
 #include <sstream>
@@ -52,36 +53,77 @@
 namespace fs = boost::filesystem;
 
 #define YYMAXDEPTH 20000
-#define LOC(loc) Location(loc.first_line, loc.first_column, loc.last_line, loc.last_column, sourcefile())
+#define LOC(loc) Location(loc.first_line, loc.first_column, loc.last_line, loc.last_column, state->sourcefile())
 #ifdef DEBUG
-static Location debug_location(const std::string& info, const struct YYLTYPE& loc);
-#define LOCD(str, loc) debug_location(str, loc)
+#define LOCD(str, loc) debug_location(str, loc, state)
 #else
 #define LOCD(str, loc) LOC(loc)
 #endif
 
-int parser_error_pos = -1;
+thread_local int parser_error_pos = -1;
+%}
 
-int parserlex(void);
-void yyerror(char const *s);
+%code requires {
+#include <stdio.h>
+#include <memory>
+#include <stack>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
 
-int lexerget_lineno(void);
-std::shared_ptr<fs::path> sourcefile(void);
-void lexer_set_parser_sourcefile(const fs::path& path);
-int lexerlex_destroy(void);
-int lexerlex(void);
+struct ParserState;
+}
 
-std::stack<LocalScope *> scope_stack;
-FileModule *rootmodule;
+%code provides {
+/*!
+	State of a single parse() call, shared by the parser and the lexer.
+	Nothing else is shared between calls, so several files can be parsed
+	at the same time on different threads.
+*/
+struct ParserState {
+	// Filename of the source file currently being lexed
+	std::shared_ptr<boost::filesystem::path> sourcefile() const {
+		return this->filename_stack.empty() ? this->parser_sourcefile : this->filename_stack.back();
+	}
+
+	void *scanner = nullptr;
+	class FileModule *rootmodule = nullptr;
+	std::stack<class LocalScope *> scope_stack;
+	boost::filesystem::path mainFilePath;
+	std::string main_file_folder;
+	bool fileEnded = false;
+
+	// Lexer state, see lexer.l
+	const char *input_buffer = nullptr; // The rest of the in-memory source
+	std::string stringcontents;
+	std::shared_ptr<boost::filesystem::path> parser_sourcefile;
+	std::vector<std::shared_ptr<boost::filesystem::path>> filename_stack;
+	std::vector<YYLTYPE> loc_stack;
+	std::vector<FILE *> openfiles;
+	std::vector<std::string> openfilenames;
+	std::string filename;
+	std::string filepath;
+};
 
-extern void lexerdestroy();
-extern FILE *lexerin;
-const char *parser_input_buffer;
-static fs::path mainFilePath;
-static std::string main_file_folder;
+int parserlex(YYSTYPE *lvalp, YYLTYPE *llocp, ParserState *state);
+void parsererror(YYLTYPE *llocp, ParserState *state, char const *s);
+}
 
-bool fileEnded=false;
-%}
+%code {
+int lexerlex(YYSTYPE *lvalp, YYLTYPE *llocp, void *scanner);
+int lexerlex_init_extra(ParserState *state, void **scanner);
+int lexerlex_destroy(void *scanner);
+int lexerget_lineno(void *scanner);
+void lexerdestroy(ParserState *state);
+
+#ifdef DEBUG
+static Location debug_location(const std::string& info, const YYLTYPE& loc, const ParserState *state);
+#endif
+}
+
+%define api.pure
+%parse-param {ParserState *state}
+%lex-param {ParserState *state}
 
 %initial-action
 {
@@ -177,7 +219,7 @@ input:    /* empty */
         | input
           TOK_USE
             {
-              rootmodule->registerUse(std::string($2), LOC(@2));
+              state->rootmodule->registerUse(std::string($2), LOC(@2));
               free($2);
             }
         | input statement
@@ -188,32 +230,32 @@ statement:
         | '{' inner_input '}'
         | module_instantiation
             {
-              if ($1) scope_stack.top()->addChild($1);
+              if ($1) state->scope_stack.top()->addChild($1);
             }
         | assignment
         | TOK_MODULE TOK_ID '(' arguments_decl optional_commas ')'
             {
               UserModule *newmodule = new UserModule($2, LOCD("module", @$));
               newmodule->definition_arguments = *$4;
-              scope_stack.top()->addModule($2, newmodule);
-              scope_stack.push(&newmodule->scope);
+              state->scope_stack.top()->addModule($2, newmodule);
+              state->scope_stack.push(&newmodule->scope);
               free($2);
               delete $4;
             }
           statement
             {
-                scope_stack.pop();
+                state->scope_stack.pop();
             }
         | TOK_FUNCTION TOK_ID '(' arguments_decl optional_commas ')' '=' expr ';'
             {
               UserFunction *func = new UserFunction($2, *$4, shared_ptr<Expression>($8), LOCD("function", @$));
-              scope_stack.top()->addFunction(func);
+              state->scope_stack.top()->addFunction(func);
               free($2);
               delete $4;
             }
         | TOK_EOT
             {
-                fileEnded=true;
+                state->fileEnded=true;
             }
         ;
 
@@ -226,15 +268,15 @@ assignment:
           TOK_ID '=' expr ';'
             {
                 bool found = false;
-                for (auto &assignment : scope_stack.top()->assignments) {
+                for (auto &assignment : state->scope_stack.top()->assignments) {
                     if (assignment.name == $1) {
-                        auto mainFile = mainFilePath.string();
+                        auto mainFile = state->mainFilePath.string();
                         auto prevFile = assignment.location().fileName();
                         auto currFile = LOC(@$).fileName();
                         
-                        const auto uncPathCurr = boostfs_uncomplete(currFile, mainFilePath.parent_path());
-                        const auto uncPathPrev = boostfs_uncomplete(prevFile, mainFilePath.parent_path());
-                        if(fileEnded){
+                        const auto uncPathCurr = boostfs_uncomplete(currFile, state->mainFilePath.parent_path());
+                        const auto uncPathPrev = boostfs_uncomplete(prevFile, state->mainFilePath.parent_path());
+                        if(state->fileEnded){
                             //assignments via commandline
                         }else if(prevFile==mainFile && currFile == mainFile){
                             //both assignments in the mainFile
@@ -268,7 +310,7 @@ assignment:
                     }
                 }
                 if (!found) {
-                  scope_stack.top()->addAssignment(Assignment($1, shared_ptr<Expression>($3), LOCD("assignment", @$)));
+                  state->scope_stack.top()->addAssignment(Assignment($1, shared_ptr<Expression>($3), LOCD("assignment", @$)));
                 }
                 free($1);
             }
@@ -298,11 +340,11 @@ module_instantiation:
         | single_module_instantiation
             {
                 $<inst>$ = $1;
-                scope_stack.push(&$1->scope);
+                state->scope_stack.push(&$1->scope);
             }
           child_statement
             {
-                scope_stack.pop();
+                state->scope_stack.pop();
                 $$ = $<inst>2;
             }
         | ifelse_statement
@@ -318,11 +360,11 @@ ifelse_statement:
             }
         | if_statement TOK_ELSE
             {
-                scope_stack.push(&$1->else_scope);
+                state->scope_stack.push(&$1->else_scope);
             }
           child_statement
             {
-                scope_stack.pop();
+                state->scope_stack.pop();
                 $$ = $1;
             }
         ;
@@ -330,12 +372,12 @@ ifelse_statement:
 if_statement:
           TOK_IF '(' expr ')'
             {
-                $<ifelse>$ = new IfElseModuleInstantiation(shared_ptr<Expression>($3), main_file_folder, LOCD("if", @$));
-                scope_stack.push(&$<ifelse>$->scope);
+                $<ifelse>$ = new IfElseModuleInstantiation(shared_ptr<Expression>($3), state->main_file_folder, LOCD("if", @$));
+                state->scope_stack.push(&$<ifelse>$->scope);
             }
           child_statement
             {
-                scope_stack.pop();
+                state->scope_stack.pop();
                 $$ = $<ifelse>5;
             }
         ;
@@ -351,7 +393,7 @@ child_statement:
         | '{' child_statements '}'
         | module_instantiation
             {
-                if ($1) scope_stack.top()->addChild($1);
+                if ($1) state->scope_stack.top()->addChild($1);
             }
         ;
 
@@ -368,7 +410,7 @@ module_id:
 single_module_instantiation:
           module_id '(' arguments_call ')'
             {
-                $$ = new ModuleInstantiation($1, *$3, main_file_folder, LOCD("modulecall", @$));
+                $$ = new ModuleInstantiation($1, *$3, state->main_file_folder, LOCD("modulecall", @$));
                 free($1);
                 delete $3;
             }
@@ -675,20 +717,20 @@ argument_call:
 
 %%
 
-int parserlex(void)
+int parserlex(YYSTYPE *lvalp, YYLTYPE *llocp, ParserState *state)
 {
-  return lexerlex();
+  return lexerlex(lvalp, llocp, state->scanner);
 }
 
-void yyerror (char const *s)
+void yyerror(YYLTYPE *, ParserState *state, char const *s)
 {
   // FIXME: We leak memory on parser errors...
   PRINTB("ERROR: Parser error in file %s, line %d: %s\n",
-         (*sourcefile()) % lexerget_lineno() % s);
+         (*state->sourcefile()) % lexerget_lineno(state->scanner) % s);
 }
 
 #ifdef DEBUG
-static Location debug_location(const std::string& info, const YYLTYPE& loc)
+static Location debug_location(const std::string& info, const YYLTYPE& loc, const ParserState *state)
 {
 	auto location = LOC(loc);
 	PRINTDB("%3d, %3d - %3d, %3d | %s", loc.first_line % loc.first_column % loc.last_line % loc.last_column % info);
@@ -698,37 +740,42 @@ static Location debug_location(const std::string& info, const YYLTYPE& loc)
 
 bool parse(FileModule *&module, const std::string& text, const std::string &filename, const std::string &mainFile, int debug)
 {
+  ParserState state;
   fs::path parser_sourcefile = fs::path(fs::absolute(fs::path(filename)).generic_string());
-  main_file_folder = parser_sourcefile.parent_path().string();
-  lexer_set_parser_sourcefile(parser_sourcefile);
-  mainFilePath = fs::absolute(fs::path(mainFile));
-
-  lexerin = NULL;
+  state.main_file_folder = parser_sourcefile.parent_path().string();
+  state.parser_sourcefile = std::make_shared<fs::path>(parser_sourcefile);
+  state.mainFilePath = fs::absolute(fs::path(mainFile));
+  state.input_buffer = text.c_str();
   parser_error_pos = -1;
-  parser_input_buffer = text.c_str();
-  fileEnded=false;
 
-  rootmodule = new FileModule(main_file_folder, parser_sourcefile.filename().string());
-  scope_stack.push(&rootmodule->scope);
-  //        PRINTB_NOCACHE("New module: %s %p", "root" % rootmodule);
+  state.rootmodule = new FileModule(state.main_file_folder, parser_sourcefile.filename().string());
+  state.scope_stack.push(&state.rootmodule->scope);
+  //        PRINTB_NOCACHE("New module: %s %p", "root" % state.rootmodule);
 
-  parserdebug = debug;
+  lexerlex_init_extra(&state, &state.scanner);
+  // Shared by all parsers, so only written when actually changed
+  if (parserdebug != debug) parserdebug = debug;
   int parserretval = -1;
   try{
-     parserretval = parserparse();
+     parserretval = parserparse(&state);
   }catch (const HardWarningException &e) {
-    yyerror("stop on first warning");
+    yyerror(nullptr, &state, "stop on first warning");
+  }catch (...) {
+    // E.g. WorkerThreadException, when parsing on a worker thread
+    lexerdestroy(&state);
+    lexerlex_destroy(state.scanner);
+    delete state.rootmodule;
+    throw;
   }
 
-  lexerdestroy();
-  lexerlex_destroy();
+  lexerdestroy(&state);
+  lexerlex_destroy(state.scanner);
 
-  module = rootmodule;
+  module = state.rootmodule;
   if (parserretval != 0) return false;
 
   parser_error_pos = -1;
-  parser_input_buffer = nullptr;
-  scope_stack.pop();
 
+  ExpressionOptimizer::optimize(*state.rootmodule);
   return true;
 }
@@ -5,7 +5,7 @@
 
 namespace fs = boost::filesystem;
 
-extern int parser_error_pos;
+extern thread_local int parser_error_pos;
 
 /**
  * Initialize library path.
@@ -5,6 +5,7 @@
 #include "GeometryUtils.h"
 #include "Reindexer.h"
 #include "grid.h"
+#include "parallel.h"
 #ifdef ENABLE_CGAL
 #include "cgalutils.h"
 #endif
@@ -41,6 +42,25 @@ namespace PolysetUtils {
 	 the polyhedron() input.
 */
 	
+	/* Triangulates a convex face as a fan around its first vertex.
+		 Returns false, leaving triangles untouched, if any of the fan triangles
+		 would be degenerate (e.g. due to collinear vertices), in which case
+		 the face should be tessellated the general way.
+	*/
+	static bool fan_triangulate(const std::vector<Vector3f> &verts, const IndexedFace &face,
+															std::vector<IndexedTriangle> &triangles)
+	{
+		const auto &p0 = verts[face[0]];
+		for (size_t i = 1; i + 1 < face.size(); i++) {
+			auto n = (verts[face[i]] - p0).cross(verts[face[i + 1]] - p0);
+			if (n.squaredNorm() == 0.0f) return false;
+		}
+		for (size_t i = 1; i + 1 < face.size(); i++) {
+			triangles.emplace_back(face[0], face[i], face[i + 1]);
+		}
+		return true;
+	}
+
 /* Given a 3D PolySet with near planar polygonal faces, tessellate the
 	 faces. As of writing, our only tessellation method is triangulation
 	 using CGAL's Constrained Delaunay algorithm. This code assumes the input
@@ -77,26 +97,36 @@ namespace PolysetUtils {
 			}
 		}
 
-		// Tessellate indexed mesh
+		// Tessellate indexed mesh. Faces are independent, so they are tessellated
+		// in parallel into per-face triangle lists, which are then appended
+		// in the original face order.
 		const auto& verts = allVertices.getArray();
-		std::vector<IndexedTriangle> allTriangles;
-		for (const auto &faces : polygons) {
-			std::vector<IndexedTriangle> triangles;
-			auto err = false;
-			if (faces[0].size() == 3) {
-				triangles.emplace_back(faces[0][0], faces[0][1], faces[0][2]);
-			}
-			else {
-				err = GeometryUtils::tessellatePolygonWithHoles(verts, faces, triangles, nullptr);
-			}
-			if (!err) {
-				for (const auto &t : triangles) {
-					outps.append_poly();
-					outps.append_vertex(verts[t[0]]);
-					outps.append_vertex(verts[t[1]]);
-					outps.append_vertex(verts[t[2]]);
+		const bool convex(inps.convexValue());
+		std::vector<std::vector<IndexedTriangle>> facetriangles(polygons.size());
+		std::vector<char> faceerrors(polygons.size(), false);
+		// Debug output from the tessellator is not thread safe
+		const size_t mingrain = OpenSCAD::debug == "" ? 64 : polygons.size();
+		parallel_for_chunks(polygons.size(), mingrain, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				const auto &faces = polygons[i];
+				auto &triangles = facetriangles[i];
+				if (faces[0].size() == 3) {
+					triangles.emplace_back(faces[0][0], faces[0][1], faces[0][2]);
+				}
+				else if (!(convex && faces.size() == 1 && fan_triangulate(verts, faces[0], triangles))) {
+					faceerrors[i] = GeometryUtils::tessellatePolygonWithHoles(verts, faces, triangles, nullptr);
 				}
 			}
+		});
+
+		for (size_t i = 0; i < polygons.size(); i++) {
+			if (faceerrors[i]) continue;
+			for (const auto &t : facetriangles[i]) {
+				outps.append_poly();
+				outps.append_vertex(verts[t[0]]);
+				outps.append_vertex(verts[t[1]]);
+				outps.append_vertex(verts[t[2]]);
+			}
 		}
 		if (degeneratePolygons > 0) PRINT("WARNING: PolySet has degenerate polygons");
 	}
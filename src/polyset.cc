@@ -149,11 +149,36 @@ size_t PolySet::memsize() const
 void PolySet::append(const PolySet &ps)
 {
 	this->polygons.insert(this->polygons.end(), ps.polygons.begin(), ps.polygons.end());
-	if (!dirty && !this->bbox.isNull()) {
+	// A clean, null bounding box belongs to an empty PolySet
+	if (!dirty) {
 		this->bbox.extend(ps.getBoundingBox());
 	}
 }
 
+/*!
+	Appends the polygons of ps transformed by each of the given matrices in
+	turn, with the same result as appending a copy of ps which was passed to
+	transform() with each matrix, but without the copy.
+*/
+void PolySet::append(const PolySet &ps, const Transform3d *matrices, size_t count)
+{
+	bool mirrored = false;
+	for (size_t i = 0; i < count; i++) {
+		if (matrices[i].matrix().determinant() < 0) mirrored = !mirrored;
+	}
+	for (const auto &p : ps.polygons) {
+		this->polygons.push_back(p);
+		auto &poly = this->polygons.back();
+		for (size_t i = 0; i < count; i++) {
+			for (auto &v : poly) {
+				v = matrices[i] * v;
+			}
+		}
+		if (mirrored) std::reverse(poly.begin(), poly.end());
+	}
+	this->dirty = true;
+}
+
 void PolySet::transform(const Transform3d &mat)
 {
 	// If mirroring transform, flip faces to avoid the object to end up being inside-out
@@ -39,6 +39,7 @@ public:
 	void insert_vertex(const Vector3d &v);
 	void insert_vertex(const Vector3f &v);
 	void append(const PolySet &ps);
+	void append(const PolySet &ps, const Transform3d *matrices, size_t count);
 
 	void render_surface(Renderer::csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo = nullptr) const;
 	void render_edges(Renderer::csgmode_e csgmode) const;
@@ -37,7 +37,12 @@
 #include <sstream>
 #include <assert.h>
 #include <cmath>
+#include <mutex>
+#include <unordered_map>
+#include <cstring>
 #include <boost/assign/std/vector.hpp>
+#include <boost/format.hpp>
+#include <boost/functional/hash.hpp>
 #include "ModuleInstantiation.h"
 using namespace boost::assign; // bring 'operator+=()' into scope
 
@@ -68,7 +73,8 @@ class PrimitiveNode : public LeafNode
 public:
 	VISITABLE();
 	PrimitiveNode(const ModuleInstantiation *mi, primitive_type_e type, const std::string &docPath) : LeafNode(mi), document_path(docPath), type(type) { }
-	std::string toString() const override;
+	std::string toString() const override { return toString(false); }
+	std::string toIdString() const override { return toString(true); }
 	std::string name() const override {
 		switch (this->type) {
 		case primitive_type_e::CUBE:
@@ -106,6 +112,9 @@ public:
 	int convexity;
 	ValuePtr points, paths, faces;
 	const Geometry *createGeometry() const override;
+
+private:
+	std::string toString(bool compact) const;
 };
 
 /**
@@ -344,12 +353,43 @@ struct point2d {
 	double x, y;
 };
 
-static void generate_circle(point2d *circle, double r, int fragments)
+/*!
+	Returns the points of a unit circle with the given number of fragments.
+	Tables are computed once per fragment count and shared, since models
+	tend to use the same few fragment counts for lots of circles, cylinders
+	and sphere rings.
+*/
+static shared_ptr<const std::vector<point2d>> unit_circle(int fragments)
 {
+	// Don't keep tables for excessive fragment counts around
+	const int max_cached_fragments = 4096;
+	static std::mutex mutex;
+	static std::unordered_map<int, shared_ptr<const std::vector<point2d>>> tables;
+
+	std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+	if (fragments <= max_cached_fragments) {
+		lock.lock();
+		auto it = tables.find(fragments);
+		if (it != tables.end()) return it->second;
+	}
+
+	auto table = make_shared<std::vector<point2d>>(fragments);
 	for (int i=0; i<fragments; i++) {
 		double phi = (360.0 * i) / fragments;
-		circle[i].x = r * cos_degrees(phi);
-		circle[i].y = r * sin_degrees(phi);
+		(*table)[i].x = cos_degrees(phi);
+		(*table)[i].y = sin_degrees(phi);
+	}
+	if (lock.owns_lock()) tables.emplace(fragments, table);
+	return table;
+}
+
+static void generate_circle(point2d *circle, double r, int fragments)
+{
+	const auto unit = unit_circle(fragments);
+	const auto *points = unit->data();
+	for (int i=0; i<fragments; i++) {
+		circle[i].x = r * points[i].x;
+		circle[i].y = r * points[i].y;
 	}
 }
 
@@ -594,11 +634,11 @@ const Geometry *PrimitiveNode::createGeometry() const
 		if (this->r1 > 0 && !std::isinf(this->r1))	{
 			auto fragments = Calc::get_fragments_from_r(this->r1, this->fn, this->fs, this->fa);
 
+			const auto unit = unit_circle(fragments);
 			Outline2d o;
 			o.vertices.resize(fragments);
 			for (int i=0; i < fragments; i++) {
-				double phi = (360.0 * i) / fragments;
-				o.vertices[i] = {this->r1 * cos_degrees(phi), this->r1 * sin_degrees(phi)};
+				o.vertices[i] = {this->r1 * (*unit)[i].x, this->r1 * (*unit)[i].y};
 			}
 			p->addOutline(o);
 		}
@@ -648,7 +688,63 @@ const Geometry *PrimitiveNode::createGeometry() const
 	return g;
 }
 
-std::string PrimitiveNode::toString() const
+namespace {
+	// Lists with more elements than this are dumped as a hash, see dump_list()
+	const size_t COMPACT_DUMP_LIMIT = 1000;
+
+	// Feeds a value into two independent 64-bit hashes: FNV-1a and boost::hash_combine
+	void hash_value(const Value &value, uint64_t &h1, size_t &h2)
+	{
+		auto add = [&](uint64_t word) {
+			for (int i = 0; i < 8; i++) {
+				h1 ^= (word >> (8 * i)) & 0xff;
+				h1 *= 1099511628211ULL;
+			}
+			boost::hash_combine(h2, word);
+		};
+
+		add(uint64_t(value.type()));
+		switch (value.type()) {
+		case Value::ValueType::NUMBER: {
+			double d = value.toDouble();
+			uint64_t word;
+			memcpy(&word, &d, sizeof(word));
+			add(word);
+			break;
+		}
+		case Value::ValueType::VECTOR:
+			add(value.toVector().size());
+			for (const auto &v : value.toVector()) hash_value(*v, h1, h2);
+			break;
+		default:
+			for (char c : value.toString()) add(uint64_t(c));
+			break;
+		}
+	}
+
+	/*!
+		Writes the given list to the stream. If compact is set, lists with many
+		elements are replaced by a 128-bit hash of their contents, which keeps the
+		ID strings of large polyhedrons and polygons, and of all their ancestors,
+		small. Such dumps cannot be evaluated again, so they are only used for
+		ID strings.
+	*/
+	void dump_list(std::ostringstream &stream, const ValuePtr &list, bool compact)
+	{
+		if (!compact || list->type() != Value::ValueType::VECTOR ||
+				list->toVector().size() <= COMPACT_DUMP_LIMIT) {
+			list->toStream(stream);
+			return;
+		}
+		uint64_t h1 = 14695981039346656037ULL;
+		size_t h2 = 0;
+		hash_value(*list, h1, h2);
+		stream << boost::format("/* %d elements, hash %016x%016x */ undef")
+			% list->toVector().size() % h1 % uint64_t(h2);
+	}
+}
+
+std::string PrimitiveNode::toString(bool compact) const
 {
 	std::ostringstream stream;
 
@@ -670,9 +766,9 @@ std::string PrimitiveNode::toString() const
 			break;
 	case primitive_type_e::POLYHEDRON:
 		stream << "(points = ";
-		this->points->toStream(stream);
+		dump_list(stream, this->points, compact);
 		stream << ", faces = ";
-		this->faces->toStream(stream);
+		dump_list(stream, this->faces, compact);
 		stream << ", convexity = " << this->convexity << ")";
 			break;
 	case primitive_type_e::SQUARE:
@@ -685,9 +781,9 @@ std::string PrimitiveNode::toString() const
 		break;
 	case primitive_type_e::POLYGON:
 		stream << "(points = ";
-		this->points->toStream(stream);
+		dump_list(stream, this->points, compact);
 		stream << ", paths = ";
-		this->paths->toStream(stream);
+		dump_list(stream, this->paths, compact);
 		stream << ", convexity = " << this->convexity << ")";
 			break;
 	default:
@@ -23,6 +23,8 @@ boost::circular_buffer<std::string> lastmessages(5);
 namespace {
 	bool no_throw;
 	bool deferred;
+	thread_local bool worker_thread = false;
+	thread_local bool muted_thread = false;
 }
 
 void set_output_handler(OutputHandlerFunc *newhandler, void *userdata)
@@ -46,6 +48,26 @@ bool would_have_thrown()
     return would_throw;
 }
 
+void set_worker_thread(bool worker)
+{
+	worker_thread = worker;
+}
+
+bool is_worker_thread()
+{
+	return worker_thread;
+}
+
+void check_worker_thread()
+{
+	if (worker_thread) throw WorkerThreadException();
+}
+
+void set_muted_thread(bool muted)
+{
+	muted_thread = muted;
+}
+
 void print_messages_push()
 {
 	print_messages_stack.push_back(std::string());
@@ -65,7 +87,8 @@ void print_messages_pop()
 
 void PRINT(const std::string &msg)
 {
-	if (msg.empty()) return;
+	if (msg.empty() || muted_thread) return;
+	check_worker_thread();
 	if (print_messages_stack.size() > 0) {
 		if (!print_messages_stack.back().empty()) {
 			print_messages_stack.back() += "\n";
@@ -77,7 +100,8 @@ void PRINT(const std::string &msg)
 
 void PRINT_NOCACHE(const std::string &msg)
 {
-	if (msg.empty()) return;
+	if (msg.empty() || muted_thread) return;
+	check_worker_thread();
 
 	if (boost::starts_with(msg, "WARNING") || boost::starts_with(msg, "ERROR") || boost::starts_with(msg, "TRACE")) {
 		size_t i;
@@ -108,7 +132,7 @@ void PRINT_NOCACHE(const std::string &msg)
 void PRINTDEBUG(const std::string &filename, const std::string &msg)
 {
 	// see printutils.h for usage instructions
-	if (OpenSCAD::debug=="") return;
+	if (OpenSCAD::debug=="" || muted_thread) return;
 	std::string shortfname = fs::path(filename).stem().generic_string();
 	std::string lowshortfname(shortfname);
 	boost::algorithm::to_lower(lowshortfname);
@@ -151,6 +175,7 @@ std::set<std::string> printedDeprecations;
 
 void printDeprecation(const std::string &str)
 {
+	if (muted_thread) return;
 	if (printedDeprecations.find(str) == printedDeprecations.end()) {
 		printedDeprecations.insert(str);
 		std::string msg = "DEPRECATED: " + str;
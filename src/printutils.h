@@ -40,6 +40,24 @@ void set_output_handler(OutputHandlerFunc *newhandler, void *userdata);
 void no_exceptions_for_warnings();
 bool would_have_thrown();
 
+/*!
+	Marks the calling thread as a worker evaluating on behalf of the main
+	thread, see Context::WorkerScope. Printing, and anything else which must
+	happen on the main thread, calls check_worker_thread(), which throws
+	WorkerThreadException on workers so the work can be redone on the main
+	thread.
+*/
+void set_worker_thread(bool worker);
+bool is_worker_thread();
+void check_worker_thread();
+
+/*!
+	Discards everything printed on the calling thread, without touching any
+	of the state shared with other threads. Used for background work whose
+	messages the user didn't ask for.
+*/
+void set_muted_thread(bool muted);
+
 extern std::list<std::string> print_messages_stack;
 void print_messages_push();
 void print_messages_pop();
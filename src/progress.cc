@@ -5,6 +5,10 @@ int progress_report_count;
 void (*progress_report_f)(const class AbstractNode*, void*, int);
 void *progress_report_userdata;
 
+namespace {
+	thread_local const std::atomic<bool> *cancel_flag = nullptr;
+}
+
 void progress_report_prep(AbstractNode *root, void (*f)(const class AbstractNode *node, void *userdata, int mark), void *userdata)
 {
 	progress_report_count = 0;
@@ -22,7 +26,16 @@ void progress_report_fin()
 
 void progress_update(const AbstractNode *node, int mark)
 {
+	if (cancel_flag) {
+		if (*cancel_flag) throw ProgressCancelException();
+		return;
+	}
 	if (progress_report_f)
 		progress_report_f(node, progress_report_userdata, mark);
 }
 
+void progress_set_cancel_flag(const std::atomic<bool> *flag)
+{
+	cancel_flag = flag;
+}
+
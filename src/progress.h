@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+
 // Reset to 0 in _prep() and increased for each Node instance in progress_prepare()
 extern int progress_report_count;
 
@@ -9,5 +11,10 @@ extern void *progress_report_userdata;
 void progress_report_prep(AbstractNode *root, void (*f)(const class AbstractNode *node, void *userdata, int mark), void *userdata);
 void progress_report_fin();
 void progress_update(const AbstractNode *node, int mark);
+// Makes progress_update() on the calling thread throw ProgressCancelException
+// once *flag becomes true, instead of reporting progress. Nodes report progress
+// between the CGAL operations on their children, so this cancels long renders
+// sooner than checking between nodes. Pass nullptr to report progress again.
+void progress_set_cancel_flag(const std::atomic<bool> *flag);
 
 class ProgressCancelException { };
@@ -6,15 +6,23 @@
 class StackCheck
 {
 public:
+	// Each thread measures its own stack
 	static StackCheck &inst()
 	{
-		static StackCheck instance;
+		static thread_local StackCheck instance;
 		return instance;
 	}
 
 	~StackCheck() {}
 	inline bool check() { return size() >= limit; }
 
+	// Measures stack usage from the caller on, up to the given limit
+	void reset(unsigned long limit) {
+		unsigned char c;
+		this->ptr = &c;
+		this->limit = limit;
+	}
+
 private:
 	StackCheck() : limit(PlatformUtils::stackLimit()) {
 		unsigned char c;
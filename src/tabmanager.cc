@@ -210,6 +210,7 @@ void TabManager::createTab(const QString &filename)
 
     connect(editor, SIGNAL(contentsChanged()), this, SLOT(updateActionUndoState())); 
     connect(editor, SIGNAL(contentsChanged()), par, SLOT(animateUpdateDocChanged())); 
+    connect(editor, SIGNAL(contentsChanged()), par, SLOT(cancelBackgroundRender()));
     connect(editor, SIGNAL(contentsChanged()), this, SLOT(setContentRenderState()));
     connect(editor, SIGNAL(modificationChanged(bool, EditorInterface *)), this, SLOT(setTabModified(bool, EditorInterface *)));
 
@@ -264,6 +264,10 @@ Value::Value(const VectorType &v) : value(v)
   //  std::cout << "creating vector\n";
 }
 
+Value::Value(VectorType &&v) : value(std::move(v))
+{
+}
+
 Value::Value(const RangeType &v) : value(v)
 {
   //  std::cout << "creating range\n";
@@ -704,10 +708,14 @@ public:
 
 	Value operator()(const Value::VectorType &op1, const Value::VectorType &op2) const {
 		Value::VectorType sum;
+		sum.reserve(std::min(op1.size(), op2.size()));
 		for (size_t i = 0; i < op1.size() && i < op2.size(); i++) {
-			sum.push_back(ValuePtr(*op1[i] + *op2[i]));
+			const double *d1 = boost::get<double>(&op1[i]->value);
+			const double *d2 = boost::get<double>(&op2[i]->value);
+			if (d1 && d2) sum.push_back(ValuePtr(*d1 + *d2));
+			else sum.push_back(ValuePtr(*op1[i] + *op2[i]));
 		}
-		return {sum};
+		return {std::move(sum)};
 	}
 };
 
@@ -729,10 +737,14 @@ public:
 
 	Value operator()(const Value::VectorType &op1, const Value::VectorType &op2) const {
 		Value::VectorType sum;
+		sum.reserve(std::min(op1.size(), op2.size()));
 		for (size_t i = 0; i < op1.size() && i < op2.size(); i++) {
-			sum.push_back(ValuePtr(*op1[i] - *op2[i]));
+			const double *d1 = boost::get<double>(&op1[i]->value);
+			const double *d2 = boost::get<double>(&op2[i]->value);
+			if (d1 && d2) sum.push_back(ValuePtr(*d1 - *d2));
+			else sum.push_back(ValuePtr(*op1[i] - *op2[i]));
 		}
-		return {sum};
+		return {std::move(sum)};
 	}
 };
 
@@ -744,32 +756,41 @@ Value Value::operator-(const Value &v) const
 Value Value::multvecnum(const Value &vecval, const Value &numval)
 {
 // Vector * Number
+	const auto &vec = vecval.toVector();
+	const double num = boost::get<double>(numval.value);
 	VectorType dstv;
-	for(const auto &val : vecval.toVector()) {
-		dstv.push_back(ValuePtr(*val * numval));
+	dstv.reserve(vec.size());
+	for(const auto &val : vec) {
+		if (const double *d = boost::get<double>(&val->value)) dstv.push_back(ValuePtr(*d * num));
+		else dstv.push_back(ValuePtr(*val * numval));
 	}
-	return {dstv};
+	return {std::move(dstv)};
 }
 
 Value Value::multmatvec(const VectorType &matrixvec, const VectorType &vectorvec)
 {
 // Matrix * Vector
+	std::vector<double> vec(vectorvec.size());
+	for (size_t j=0;j<vectorvec.size();j++) {
+		const double *d = boost::get<double>(&vectorvec[j]->value);
+		if (!d) return Value();
+		vec[j] = *d;
+	}
+
 	VectorType dstv;
-	for (size_t i=0;i<matrixvec.size();i++) {
-		if (matrixvec[i]->type() != ValueType::VECTOR || 
-				matrixvec[i]->toVector().size() != vectorvec.size()) {
-			return Value();
-		}
+	dstv.reserve(matrixvec.size());
+	for (const auto &rowval : matrixvec) {
+		const VectorType *row = boost::get<VectorType>(&rowval->value);
+		if (!row || row->size() != vec.size()) return Value();
 		double r_e = 0.0;
-		for (size_t j=0;j<matrixvec[i]->toVector().size();j++) {
-			if (matrixvec[i]->toVector()[j]->type() != ValueType::NUMBER || vectorvec[j]->type() != ValueType::NUMBER) {
-				return Value();
-			}
-			r_e += matrixvec[i]->toVector()[j]->toDouble() * vectorvec[j]->toDouble();
+		for (size_t j=0;j<vec.size();j++) {
+			const double *d = boost::get<double>(&(*row)[j]->value);
+			if (!d) return Value();
+			r_e += *d * vec[j];
 		}
 		dstv.push_back(ValuePtr(r_e));
 	}
-	return {dstv};
+	return {std::move(dstv)};
 }
 
 Value Value::multvecmat(const VectorType &vectorvec, const VectorType &matrixvec)
@@ -813,10 +834,10 @@ Value Value::operator*(const Value &v) const
 			// Vector dot product.
 			auto r = 0.0;
 			for (size_t i=0;i<vec1.size();i++) {
-				if (vec1[i]->type() != ValueType::NUMBER || vec2[i]->type() != ValueType::NUMBER) {
-					return Value::undefined;
-				}
-				r += (vec1[i]->toDouble() * vec2[i]->toDouble());
+				const double *d1 = boost::get<double>(&vec1[i]->value);
+				const double *d2 = boost::get<double>(&vec2[i]->value);
+				if (!d1 || !d2) return Value::undefined;
+				r += *d1 * *d2;
 			}
 			return Value(r);
 		} else if (vec1[0]->type() == ValueType::VECTOR && vec2[0]->type() == ValueType::NUMBER &&
@@ -847,11 +868,14 @@ Value Value::operator/(const Value &v) const
   }
   else if (this->type() == ValueType::VECTOR && v.type() == ValueType::NUMBER) {
     const auto &vec = this->toVector();
+    const double num = v.toDouble();
     VectorType dstv;
+    dstv.reserve(vec.size());
     for (const auto &vecval : vec) {
-      dstv.push_back(ValuePtr(*vecval / v));
+      if (const double *d = boost::get<double>(&vecval->value)) dstv.push_back(ValuePtr(*d / num));
+      else dstv.push_back(ValuePtr(*vecval / v));
     }
-    return {dstv};
+    return {std::move(dstv)};
   }
   else if (this->type() == ValueType::NUMBER && v.type() == ValueType::VECTOR) {
     const auto &vec = v.toVector();
@@ -880,10 +904,12 @@ Value Value::operator-() const
   else if (this->type() == ValueType::VECTOR) {
     const auto &vec = this->toVector();
     VectorType dstv;
+    dstv.reserve(vec.size());
     for (const auto &vecval : vec) {
-      dstv.push_back(ValuePtr(-*vecval));
+      if (const double *d = boost::get<double>(&vecval->value)) dstv.push_back(ValuePtr(-*d));
+      else dstv.push_back(ValuePtr(-*vecval));
     }
-    return {dstv};
+    return {std::move(dstv)};
   }
   return Value::undefined;
 }
@@ -1056,53 +1082,63 @@ bool RangeType::iterator::operator!=(const self_type &other) const
 }
 
 ValuePtr::ValuePtr()
+	: shared_ptr<const Value>(make_shared<Value>())
 {
-	this->reset(new Value());
 }
 
 ValuePtr::ValuePtr(const Value &v)
+	: shared_ptr<const Value>(make_shared<Value>(v))
+{
+}
+
+ValuePtr::ValuePtr(Value &&v)
+	: shared_ptr<const Value>(make_shared<Value>(std::move(v)))
 {
-	this->reset(new Value(v));
 }
 
 ValuePtr::ValuePtr(bool v)
+	: shared_ptr<const Value>(make_shared<Value>(v))
 {
-	this->reset(new Value(v));
 }
 
 ValuePtr::ValuePtr(int v)
+	: shared_ptr<const Value>(make_shared<Value>(v))
 {
-	this->reset(new Value(v));
 }
 
 ValuePtr::ValuePtr(double v)
+	: shared_ptr<const Value>(make_shared<Value>(v))
 {
-	this->reset(new Value(v));
 }
 
 ValuePtr::ValuePtr(const std::string &v)
+	: shared_ptr<const Value>(make_shared<Value>(v))
 {
-	this->reset(new Value(v));
 }
 
 ValuePtr::ValuePtr(const char *v)
+	: shared_ptr<const Value>(make_shared<Value>(v))
 {
-	this->reset(new Value(v));
 }
 
 ValuePtr::ValuePtr(const char v)
+	: shared_ptr<const Value>(make_shared<Value>(v))
 {
-	this->reset(new Value(v));
 }
 
 ValuePtr::ValuePtr(const Value::VectorType &v)
+	: shared_ptr<const Value>(make_shared<Value>(v))
+{
+}
+
+ValuePtr::ValuePtr(Value::VectorType &&v)
+	: shared_ptr<const Value>(make_shared<Value>(std::move(v)))
 {
-	this->reset(new Value(v));
 }
 
 ValuePtr::ValuePtr(const RangeType &v)
+	: shared_ptr<const Value>(make_shared<Value>(v))
 {
-	this->reset(new Value(v));
 }
 
 bool ValuePtr::operator==(const ValuePtr &v) const
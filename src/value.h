@@ -4,6 +4,7 @@
 #include <string>
 #include <algorithm>
 #include <limits>
+#include <atomic>
 
 // Workaround for https://bugreports.qt-project.org/browse/QTBUG-22829
 #ifndef Q_MOC_RUN
@@ -108,6 +109,7 @@ public:
 
 	ValuePtr();
 	explicit ValuePtr(const Value &v);
+	explicit ValuePtr(Value &&v);
   ValuePtr(bool v);
   ValuePtr(int v);
   ValuePtr(double v);
@@ -115,6 +117,7 @@ public:
   ValuePtr(const char *v);
   ValuePtr(const char v);
   ValuePtr(const class std::vector<ValuePtr> &v);
+  ValuePtr(class std::vector<ValuePtr> &&v);
   ValuePtr(const class RangeType &v);
 
 	operator bool() const;
@@ -146,16 +149,27 @@ public:
 	str_utf8_wrapper() : std::string(), cached_len(-1) { }
 	str_utf8_wrapper( const std::string& s ) : std::string( s ), cached_len(-1) { }
 	str_utf8_wrapper( size_t n, char c ) : std::string(n, c), cached_len(-1) { }
+	str_utf8_wrapper( const str_utf8_wrapper& s ) : std::string( s ), cached_len(s.cached_len.load()) { }
+	str_utf8_wrapper( str_utf8_wrapper&& s ) : std::string( std::move(s) ), cached_len(s.cached_len.load()) { }
 	~str_utf8_wrapper() {}
+
+	str_utf8_wrapper &operator=( const str_utf8_wrapper& s ) {
+		std::string::operator=(s);
+		cached_len = s.cached_len.load();
+		return *this;
+	}
 	
 	glong get_utf8_strlen() const {
-		if (cached_len < 0) {
-			cached_len = g_utf8_strlen(this->c_str(), this->size());
+		glong len = cached_len.load(std::memory_order_relaxed);
+		if (len < 0) {
+			len = g_utf8_strlen(this->c_str(), this->size());
+			cached_len.store(len, std::memory_order_relaxed);
 		}
-		return cached_len;
+		return len;
 	};
 private:
-	mutable glong cached_len;
+	// Atomic, as strings can be shared by threads evaluating in parallel
+	mutable std::atomic<glong> cached_len;
 };
 
 
@@ -182,7 +196,10 @@ public:
   Value(const char *v);
   Value(const char v);
   Value(const VectorType &v);
+  Value(VectorType &&v);
   Value(const RangeType &v);
+  Value(const Value &v) = default;
+  Value(Value &&v) = default;
   ~Value() {}
 
   ValueType type() const;
@@ -233,6 +250,9 @@ public:
   typedef boost::variant< boost::blank, bool, double, str_utf8_wrapper, VectorType, RangeType > Variant;
 
 private:
+  friend class plus_visitor;
+  friend class minus_visitor;
+
   static Value multvecnum(const Value &vecval, const Value &numval);
   static Value multmatvec(const VectorType &matrixvec, const VectorType &vectorvec);
   static Value multvecmat(const VectorType &vectorvec, const VectorType &matrixvec);
@@ -0,0 +1,75 @@
+#!/usr/bin/env python
+
+# Animation export test
+#
+#
+# Usage: <script> <inputfile> --openscad=<executable-path> --frames=<n> [<openscad args>] file.<suffix>
+#
+#
+# step 1. Run OpenSCAD with --animate=<n>, exporting the frames to file00000.<suffix>,
+#         file00001.<suffix> etc.
+# step 2. Check that exactly n frames were written, and concatenate them in order
+#         into the given output file.
+# step 3. (done in CTest) - compare the output file to the expected output
+#
+# All the optional openscad args are passed on to OpenSCAD.
+#
+# This script should return 0 on success, not-0 on error.
+#
+
+from __future__ import print_function
+
+import sys, os, glob, subprocess, argparse
+
+def failquit(*args):
+    if len(args)!=0: print(args)
+    print('animationtest args:',str(sys.argv))
+    print('exiting animationtest.py with failure')
+    sys.exit(1)
+
+#
+# Parse arguments
+#
+parser = argparse.ArgumentParser()
+parser.add_argument('--openscad', required=True, help='Specify OpenSCAD executable')
+parser.add_argument('--frames', required=True, type=int, help='Number of animation frames')
+args,remaining_args = parser.parse_known_args()
+
+inputfile = remaining_args[0]
+outputfile = remaining_args[-1]
+remaining_args = remaining_args[1:-1] # Passed on to the OpenSCAD executable
+
+if not os.path.exists(inputfile):
+    failquit('cant find input file named: ' + inputfile)
+if not os.path.exists(args.openscad):
+    failquit('cant find openscad executable named: ' + args.openscad)
+
+outputdir = os.path.dirname(outputfile)
+outputbasename, outputsuffix = os.path.splitext(os.path.basename(outputfile))
+framebase = os.path.join(outputdir, outputbasename + '-frame')
+for oldframe in glob.glob(framebase + '[0-9]*' + outputsuffix):
+    os.remove(oldframe)
+
+#
+# Export the frames
+#
+export_cmd = [args.openscad, inputfile, '--animate=' + str(args.frames)] + remaining_args + ['-o', framebase + outputsuffix]
+print('Running OpenSCAD:', file=sys.stderr)
+print(' '.join(export_cmd), file=sys.stderr)
+result = subprocess.call(export_cmd)
+if result != 0:
+    failquit('OpenSCAD failed with return code ' + str(result))
+
+#
+# Concatenate them in order
+#
+framefiles = sorted(glob.glob(framebase + '[0-9]*' + outputsuffix))
+expectedfiles = [framebase + ('%05d' % frame) + outputsuffix for frame in range(args.frames)]
+if framefiles != expectedfiles:
+    failquit('expected frames ' + str(expectedfiles) + ', got ' + str(framefiles))
+
+with open(outputfile, 'w') as output:
+    for framefile in framefiles:
+        with open(framefile) as frame:
+            output.write(frame.read().rstrip('\r\n') + '\n')
+        os.remove(framefile)
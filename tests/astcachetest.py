@@ -0,0 +1,94 @@
+#!/usr/bin/env python
+
+# On-disk AST cache test
+#
+#
+# Usage: <script> <inputfile> --openscad=<executable-path> --replace=<file>,<replacement> [<openscad args>] file.<suffix>
+#
+#
+# step 1. Copy the input file, and all files next to it whose names start with its base name,
+#         to a working directory.
+# step 2. Run OpenSCAD twice with --ast-cache, once filling the cache and once reading from it.
+# step 3. Replace <file> by <replacement>, both relative to the input file, and run OpenSCAD
+#         once more, giving <replacement> an older modification time than <file>. Cache
+#         entries using <file> must not be used anymore.
+# step 4. Concatenate the outputs of the three runs into the given output file.
+# step 5. (done in CTest) - compare the output file to the expected output
+#
+# All the optional openscad args are passed on to OpenSCAD.
+#
+# This script should return 0 on success, not-0 on error.
+#
+
+from __future__ import print_function
+
+import sys, os, glob, shutil, subprocess, argparse
+
+def failquit(*args):
+    if len(args)!=0: print(args)
+    print('astcachetest args:',str(sys.argv))
+    print('exiting astcachetest.py with failure')
+    sys.exit(1)
+
+#
+# Parse arguments
+#
+parser = argparse.ArgumentParser()
+parser.add_argument('--openscad', required=True, help='Specify OpenSCAD executable')
+parser.add_argument('--replace', required=True, help='Specify <file>,<replacement> to replace between runs')
+args,remaining_args = parser.parse_known_args()
+
+inputfile = remaining_args[0]
+outputfile = remaining_args[-1]
+remaining_args = remaining_args[1:-1] # Passed on to the OpenSCAD executable
+
+if not os.path.exists(inputfile):
+    failquit('cant find input file named: ' + inputfile)
+if not os.path.exists(args.openscad):
+    failquit('cant find openscad executable named: ' + args.openscad)
+replacedfile, replacement = args.replace.split(',')
+
+inputpath, inputfilename = os.path.split(inputfile)
+inputbasename, inputsuffix = os.path.splitext(inputfilename)
+outputdir = os.path.dirname(outputfile)
+outputbasename, outputsuffix = os.path.splitext(os.path.basename(outputfile))
+
+#
+# Set up the working directory
+#
+workdir = os.path.join(outputdir, inputbasename + '-work')
+cachedir = os.path.join(workdir, 'cache')
+shutil.rmtree(workdir, ignore_errors=True)
+os.makedirs(cachedir)
+for f in glob.glob(os.path.join(inputpath, inputbasename + '*')):
+    shutil.copy(f, workdir)
+
+def run_openscad(run):
+    runoutput = os.path.join(outputdir, outputbasename + '-run' + str(run) + outputsuffix)
+    cmd = [args.openscad, os.path.join(workdir, inputfilename), '--ast-cache=' + cachedir] + remaining_args + ['-o', runoutput]
+    print('Running OpenSCAD #' + str(run) + ':', file=sys.stderr)
+    print(' '.join(cmd), file=sys.stderr)
+    result = subprocess.call(cmd)
+    if result != 0:
+        failquit('OpenSCAD #' + str(run) + ' failed with return code ' + str(result))
+    with open(runoutput) as f:
+        text = f.read()
+    os.remove(runoutput)
+    return text.rstrip('\r\n') + '\n'
+
+outputs = [run_openscad(1)]
+if not os.listdir(cachedir):
+    failquit('OpenSCAD #1 did not write to the AST cache')
+outputs.append(run_openscad(2))
+
+# Cache entries are invalidated by any other version of the files they
+# include, so make the replacement look like an older copy of the file
+replacedpath = os.path.join(workdir, replacedfile)
+modified = os.stat(replacedpath).st_mtime - 3600
+shutil.copy(os.path.join(inputpath, replacement), replacedpath)
+os.utime(replacedpath, (modified, modified))
+outputs.append(run_openscad(3))
+
+with open(outputfile, 'w') as output:
+    output.write(''.join(outputs))
+shutil.rmtree(workdir, ignore_errors=True)
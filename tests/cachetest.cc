@@ -0,0 +1,238 @@
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+// Unit tests of the eviction order and compaction of Cache<Key,T>
+
+#include "unittest.h"
+#include "cache.h"
+
+#include <string>
+
+typedef Cache<std::string, int> TestCache;
+
+static void insert(TestCache &cache, const std::string &key, size_t cost, double benefit = 0)
+{
+	CHECK(cache.insert(key, new int(0), cost, benefit));
+}
+
+// Without benefits, the least recently used object is evicted first
+static void test_lru()
+{
+	TestCache cache(3);
+	insert(cache, "a", 1);
+	insert(cache, "b", 1);
+	insert(cache, "c", 1);
+	CHECK(cache.object("a"));
+	insert(cache, "d", 1);
+	CHECK(cache.contains("a"));
+	CHECK(!cache.contains("b"));
+	CHECK(cache.contains("c"));
+	CHECK(cache.contains("d"));
+	CHECK(cache.evictionCount() == 1);
+
+	// peek() doesn't change the order
+	CHECK(cache.peek("c"));
+	insert(cache, "e", 1);
+	CHECK(!cache.contains("c"));
+	CHECK(cache.contains("a"));
+}
+
+// The object with the lowest benefit per cost is evicted first
+static void test_benefit()
+{
+	TestCache cache(3);
+	insert(cache, "x", 1, 10);
+	insert(cache, "y", 1, 1);
+	insert(cache, "z", 1, 5);
+	insert(cache, "w", 1, 2);
+	CHECK(!cache.contains("y"));
+	CHECK(cache.contains("x") && cache.contains("z") && cache.contains("w"));
+
+	// w has priority 1 + 2, as priorities are relative to the last evicted one
+	insert(cache, "v", 1, 0);
+	CHECK(!cache.contains("w"));
+	CHECK(cache.contains("x") && cache.contains("z") && cache.contains("v"));
+	CHECK(cache.totalBenefit() == 15);
+}
+
+// A large object is evicted before a small one taking as long to compute
+static void test_cost()
+{
+	TestCache cache(3);
+	insert(cache, "large", 2, 2);
+	insert(cache, "small", 1, 2);
+	insert(cache, "new", 1, 10);
+	CHECK(!cache.contains("large"));
+	CHECK(cache.contains("small"));
+	CHECK(cache.contains("new"));
+	CHECK(cache.totalCost() == 2);
+
+	// Objects larger than the cache are not inserted, and evict nothing
+	CHECK(!cache.insert("huge", new int(0), 4, 100));
+	CHECK(cache.size() == 2);
+}
+
+// Objects which are not used anymore are eventually evicted, however
+// expensive they were to compute
+static void test_aging()
+{
+	TestCache cache(2);
+	insert(cache, "old", 1, 3);
+	insert(cache, "a", 1, 1);
+	insert(cache, "b", 1, 1);
+	CHECK(!cache.contains("a"));
+	insert(cache, "c", 1, 1);
+	CHECK(!cache.contains("b"));
+	CHECK(cache.contains("old"));
+	// c and old now have the same priority, and old was used longer ago
+	insert(cache, "d", 1, 1);
+	CHECK(!cache.contains("old"));
+	CHECK(cache.contains("c") && cache.contains("d"));
+
+	// Using an object refreshes its priority
+	CHECK(cache.object("c"));
+	insert(cache, "e", 1, 1);
+	CHECK(cache.contains("c"));
+	CHECK(!cache.contains("d"));
+	CHECK(cache.hitCount() == 1);
+}
+
+// Shrinking the cache evicts objects in the same order
+static void test_shrink()
+{
+	TestCache cache(4);
+	insert(cache, "a", 1, 4);
+	insert(cache, "b", 1, 1);
+	insert(cache, "c", 1, 3);
+	insert(cache, "d", 1, 2);
+	cache.setMaxCost(2);
+	CHECK(cache.contains("a") && cache.contains("c"));
+	CHECK(!cache.contains("b") && !cache.contains("d"));
+	CHECK(cache.evictionCount() == 2);
+}
+
+/*
+	Object which can be compacted, like the entries of CGALCache: the
+	compactor shrinks it to a fourth of its size, and it needs to be
+	restored to its full size by the user of the cache.
+*/
+struct Compactable {
+	size_t size;
+	bool compacted;
+	Compactable(size_t size) : size(size), compacted(false) { }
+};
+
+static size_t compact(Compactable &obj)
+{
+	if (obj.compacted) return obj.size / 4;
+	obj.compacted = true;
+	return obj.size / 4;
+}
+
+typedef Cache<std::string, Compactable> CompactingCache;
+
+static void insert(CompactingCache &cache, const std::string &key, size_t size, double benefit = 0)
+{
+	CHECK(cache.insert(key, new Compactable(size), size, benefit));
+}
+
+// Restores a compacted object on a hit, like CGALCache::restore()
+static bool restore(CompactingCache &cache, const std::string &key)
+{
+	auto obj = cache.peek(key);
+	if (!obj) return false;
+	if (!obj->compacted) return true;
+	obj->compacted = false;
+	return cache.setCost(key, obj->size) && !cache.peek(key)->compacted;
+}
+
+// Objects are compacted instead of evicted, once
+static void test_compact()
+{
+	CompactingCache cache(10);
+	cache.setCompactor(compact);
+	insert(cache, "a", 8);
+	insert(cache, "b", 8);
+	CHECK(cache.contains("a") && cache.contains("b"));
+	CHECK(cache.peek("a")->compacted && !cache.peek("b")->compacted);
+	CHECK(cache.totalCost() == 10);
+
+	// Restoring one makes room by compacting the other one
+	CHECK(restore(cache, "a"));
+	CHECK(!cache.peek("a")->compacted && cache.peek("b")->compacted);
+	CHECK(cache.totalCost() == 10);
+	CHECK(restore(cache, "b"));
+	CHECK(cache.peek("a")->compacted && !cache.peek("b")->compacted);
+	CHECK(cache.evictionCount() == 0);
+
+	// Compacted objects are evicted when they are next in line
+	insert(cache, "c", 8);
+	CHECK(!cache.contains("a"));
+	CHECK(cache.peek("b")->compacted && !cache.peek("c")->compacted);
+	CHECK(cache.evictionCount() == 1);
+}
+
+// Restoring an object after shrinking the cache may evict it, or compact it
+// again, both of which must be a miss
+static void test_restore_after_shrink()
+{
+	CompactingCache cache(10);
+	cache.setCompactor(compact);
+	insert(cache, "a", 8, 100);
+	insert(cache, "b", 8, 0);
+	cache.setMaxCost(6);
+	CHECK(cache.peek("a")->compacted && cache.peek("b")->compacted);
+	CHECK(cache.totalCost() == 4);
+	CHECK(!restore(cache, "a"));
+	CHECK(!cache.contains("a"));
+	CHECK(cache.contains("b"));
+	CHECK(cache.totalCost() == 2);
+
+	// The object being restored has the lowest priority, so it is compacted
+	// again to make room for it
+	CompactingCache cache2(10);
+	cache2.setCompactor(compact);
+	insert(cache2, "cheap", 8, 0);
+	insert(cache2, "expensive", 4, 100);
+	CHECK(cache2.peek("cheap")->compacted);
+	cache2.setMaxCost(9);
+	CHECK(!restore(cache2, "cheap"));
+	CHECK(cache2.contains("cheap") && cache2.peek("cheap")->compacted);
+	CHECK(cache2.contains("expensive"));
+	CHECK(cache2.totalCost() == 6);
+}
+
+int main()
+{
+	test_lru();
+	test_benefit();
+	test_cost();
+	test_aging();
+	test_shrink();
+	test_compact();
+	test_restore_after_shrink();
+	return unittest_result("cachetest");
+}
@@ -0,0 +1,65 @@
+#!/usr/bin/env python
+
+# Debug output test
+#
+#
+# Usage: <script> <inputfile> --openscad=<executable-path> --debug=<name> [<openscad args>] file.<suffix>
+#
+#
+# step 1. Run OpenSCAD with --debug=<name>, exporting to the given output file.
+# step 2. Prepend the debug output of the source file <name>, printed to stderr, to the
+#         output file.
+# step 3. (done in CTest) - compare the output file to the expected output
+#
+# All the optional openscad args are passed on to OpenSCAD.
+#
+# This script should return 0 on success, not-0 on error.
+#
+
+from __future__ import print_function
+
+import sys, os, subprocess, argparse
+
+def failquit(*args):
+    if len(args)!=0: print(args)
+    print('debugtest args:',str(sys.argv))
+    print('exiting debugtest.py with failure')
+    sys.exit(1)
+
+#
+# Parse arguments
+#
+parser = argparse.ArgumentParser()
+parser.add_argument('--openscad', required=True, help='Specify OpenSCAD executable')
+parser.add_argument('--debug', required=True, help='Name of the source file to print debug output of')
+args,remaining_args = parser.parse_known_args()
+
+inputfile = remaining_args[0]
+outputfile = remaining_args[-1]
+remaining_args = remaining_args[1:-1] # Passed on to the OpenSCAD executable
+
+if not os.path.exists(inputfile):
+    failquit('cant find input file named: ' + inputfile)
+if not os.path.exists(args.openscad):
+    failquit('cant find openscad executable named: ' + args.openscad)
+
+#
+# Export, keeping the debug output
+#
+export_cmd = [args.openscad, inputfile, '--debug=' + args.debug] + remaining_args + ['-o', outputfile]
+print('Running OpenSCAD:', file=sys.stderr)
+print(' '.join(export_cmd), file=sys.stderr)
+proc = subprocess.Popen(export_cmd, stderr=subprocess.PIPE, universal_newlines=True)
+errtext = proc.communicate()[1]
+if proc.returncode != 0:
+    failquit('OpenSCAD failed with return code ' + str(proc.returncode) + ':\n' + errtext)
+
+prefix = args.debug + ': '
+debuglines = [line for line in errtext.splitlines() if line.startswith(prefix)]
+
+with open(outputfile) as f:
+    text = f.read()
+with open(outputfile, 'w') as output:
+    for line in debuglines:
+        output.write(line + '\n')
+    output.write(text)
@@ -0,0 +1,73 @@
+#!/usr/bin/env python
+
+# Dependency file test
+#
+#
+# Usage: <script> <inputfile> --openscad=<executable-path> [<openscad args>] file.<suffix>
+#
+#
+# step 1. Run OpenSCAD with -d, writing the dependencies next to the given output file.
+# step 2. Append the dependencies, sorted and relative to the input file, to the output
+#         file as "DEPENDENCY: <file>" lines.
+# step 3. (done in CTest) - compare the output file to the expected output
+#
+# All the optional openscad args are passed on to OpenSCAD.
+#
+# This script should return 0 on success, not-0 on error.
+#
+
+from __future__ import print_function
+
+import sys, os, subprocess, argparse
+
+def failquit(*args):
+    if len(args)!=0: print(args)
+    print('depstest args:',str(sys.argv))
+    print('exiting depstest.py with failure')
+    sys.exit(1)
+
+#
+# Parse arguments
+#
+parser = argparse.ArgumentParser()
+parser.add_argument('--openscad', required=True, help='Specify OpenSCAD executable')
+args,remaining_args = parser.parse_known_args()
+
+inputfile = remaining_args[0]
+outputfile = remaining_args[-1]
+remaining_args = remaining_args[1:-1] # Passed on to the OpenSCAD executable
+
+if not os.path.exists(inputfile):
+    failquit('cant find input file named: ' + inputfile)
+if not os.path.exists(args.openscad):
+    failquit('cant find openscad executable named: ' + args.openscad)
+
+inputpath = os.path.dirname(os.path.abspath(inputfile))
+depsfile = outputfile + '.deps'
+
+#
+# Export with dependencies
+#
+export_cmd = [args.openscad, inputfile, '-d', depsfile] + remaining_args + ['-o', outputfile]
+print('Running OpenSCAD:', file=sys.stderr)
+print(' '.join(export_cmd), file=sys.stderr)
+result = subprocess.call(export_cmd)
+if result != 0:
+    failquit('OpenSCAD failed with return code ' + str(result))
+
+#
+# Read the dependencies, in make syntax: "<output>: \<newline><tab><file> \..."
+#
+with open(depsfile) as f:
+    entries = [entry.strip() for entry in f.read().split('\\\n')]
+os.remove(depsfile)
+if not entries[0].endswith(':'):
+    failquit('unexpected dependencies file contents: ' + str(entries))
+dependencies = sorted(os.path.relpath(entry.replace('\\ ', ' '), inputpath) for entry in entries[1:] if entry)
+
+with open(outputfile) as f:
+    text = f.read().rstrip('\r\n') + '\n'
+with open(outputfile, 'w') as output:
+    output.write(text)
+    for dependency in dependencies:
+        output.write('DEPENDENCY: ' + dependency + '\n')
@@ -0,0 +1,105 @@
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+// Unit tests of GeometryCache, used by a background render while the GUI flushes or resizes it
+
+#include "unittest.h"
+#include "GeometryCache.h"
+#include "polyset.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+// PolySet with the given number of triangles
+static shared_ptr<const Geometry> make_geometry(int triangles)
+{
+	auto ps = new PolySet(3);
+	for (int i = 0; i < triangles; i++) {
+		ps->append_poly();
+		ps->append_vertex(i, 0, 0);
+		ps->append_vertex(i + 1, 0, 0);
+		ps->append_vertex(i, 1, 0);
+	}
+	return shared_ptr<const Geometry>(ps);
+}
+
+static size_t triangles(const shared_ptr<const Geometry> &geom)
+{
+	auto ps = dynamic_cast<const PolySet *>(geom.get());
+	return ps ? ps->polygons.size() : 0;
+}
+
+static void test_get()
+{
+	GeometryCache cache;
+	CHECK(cache.insert("a", make_geometry(1)));
+	CHECK(cache.contains("a"));
+	CHECK(triangles(cache.get("a")) == 1);
+	// An entry evicted after contains() returned true is a miss
+	CHECK(!cache.get("b"));
+	cache.clear();
+	CHECK(!cache.contains("a"));
+	CHECK(!cache.get("a"));
+}
+
+/*
+	Inserts and looks up geometries in a background thread, like a background
+	render, while this thread flushes and resizes the cache. Lookups must
+	return the geometry inserted for the key, or nothing.
+*/
+static void test_background()
+{
+	GeometryCache cache(1024*1024);
+	std::atomic<bool> done(false);
+	std::atomic<int> wrong(0);
+
+	std::thread background([&]() {
+		for (int i = 0; i < 20000; i++) {
+			const int n = i % 50 + 1;
+			const auto key = std::to_string(n);
+			if (!cache.contains(key)) cache.insert(key, make_geometry(n), 0.001 * n);
+			auto geom = cache.get(key);
+			if (geom && triangles(geom) != size_t(n)) wrong++;
+		}
+		done = true;
+	});
+	for (int i = 0; !done; i++) {
+		if (i % 3 == 0) cache.clear();
+		else cache.setMaxSizeMB(i % 3 - 1);
+		CHECK(cache.maxSizeMB() <= 1);
+		std::this_thread::yield();
+	}
+	background.join();
+	CHECK(wrong == 0);
+}
+
+int main()
+{
+	test_get();
+	test_background();
+	return unittest_result("geometrycachetest");
+}
@@ -0,0 +1,145 @@
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+// Unit tests of looking up and aligning vertices in Grid3d, in particular
+// next to the blocks of cells it uses to skip probing the neighbours
+
+#include "unittest.h"
+#include "grid.h"
+
+#include <cstdlib>
+#include <vector>
+
+// With a resolution of 1, vertices in the middle of a cell are easy to write
+static Vector3d cell(int64_t x, int64_t y, int64_t z)
+{
+	// Grid3d truncates towards zero, so cells below zero are one further away
+	return Vector3d(x < 0 ? x - 0.5 : x + 0.5, y < 0 ? y - 0.5 : y + 0.5, z < 0 ? z - 0.5 : z + 0.5);
+}
+
+// Whether the given cell or one of its neighbours holds one of the vertices
+static bool near(const std::vector<Vector3l> &cells, const Vector3l &key)
+{
+	for (const auto &c : cells) {
+		if (std::abs(c[0] - key[0]) <= 1 && std::abs(c[1] - key[1]) <= 1 && std::abs(c[2] - key[2]) <= 1) return true;
+	}
+	return false;
+}
+
+static void test_has()
+{
+	Grid3d<int> grid(1.0);
+	Vector3d v = cell(3, 4, 5);
+	CHECK(grid.align(v) == 0);
+	CHECK(!grid.has(cell(3, 4, 7)));
+	CHECK(grid.has(cell(3, 4, 5)));
+
+	// Neighbouring cells find the vertex, and give its index
+	int data = -1;
+	CHECK(grid.has(cell(4, 5, 6), &data));
+	CHECK(data == 0);
+	v = cell(10, 10, 10);
+	CHECK(grid.align(v) == 1);
+	data = -1;
+	CHECK(grid.has(cell(9, 11, 10), &data));
+	CHECK(data == 1);
+	CHECK(!grid.has(cell(8, 10, 10), &data));
+	CHECK(data == 1);
+}
+
+// Cells next to each other may lie in different blocks, also around zero
+static void test_block_boundaries()
+{
+	Grid3d<int> grid(1.0);
+	Vector3d v = cell(15, 0, 0);
+	CHECK(grid.align(v) == 0);
+	CHECK(grid.has(cell(16, 0, 0)));
+	CHECK(grid.has(cell(16, -1, 1)));
+	CHECK(!grid.has(cell(17, 0, 0)));
+
+	v = cell(-1, 40, -16);
+	CHECK(grid.align(v) == 1);
+	CHECK(grid.has(cell(0, 40, -16)));
+	CHECK(grid.has(cell(0, 39, -15)));
+	CHECK(grid.has(cell(-2, 41, -17)));
+	CHECK(!grid.has(cell(1, 40, -16)));
+	CHECK(!grid.has(cell(-1, 40, -14)));
+}
+
+// Vertices in neighbouring cells are aligned to the existing vertex
+static void test_align()
+{
+	Grid3d<int> grid(1.0);
+	Vector3d v = cell(15, 15, 15);
+	CHECK(grid.align(v) == 0);
+	CHECK(v == Vector3d(15, 15, 15));
+	v = cell(16, 16, 16);
+	CHECK(grid.align(v) == 0);
+	CHECK(v == Vector3d(15, 15, 15));
+	v = cell(17, 16, 16);
+	CHECK(grid.align(v) == 1);
+	CHECK(v == Vector3d(17, 16, 16));
+
+	// The closest one wins
+	v = cell(16, 15, 15);
+	CHECK(grid.align(v) == 0);
+	v = cell(16, 16, 16);
+	CHECK(grid.align(v) == 1);
+	CHECK(v == Vector3d(17, 16, 16));
+	CHECK(grid.db.size() == 2);
+}
+
+// Compares has() to probing all neighbours, for vertices scattered around
+// the blocks next to zero
+static void test_scattered()
+{
+	Grid3d<int> grid(1.0);
+	std::vector<Vector3l> cells;
+	srand(1);
+	for (int i = 0; i < 200; i++) {
+		Vector3l key(rand() % 80 - 40, rand() % 80 - 40, rand() % 80 - 40);
+		if (near(cells, key)) continue;
+		Vector3d v = cell(key[0], key[1], key[2]);
+		CHECK(grid.align(v) == int(cells.size()));
+		cells.push_back(key);
+	}
+	for (int64_t x = -41; x <= 41; x++) {
+		for (int64_t y = -41; y <= 41; y += 3) {
+			for (int64_t z = -41; z <= 41; z += 5) {
+				CHECK(grid.has(cell(x, y, z)) == near(cells, Vector3l(x, y, z)));
+			}
+		}
+	}
+}
+
+int main()
+{
+	test_has();
+	test_block_boundaries();
+	test_align();
+	test_scattered();
+	return unittest_result("gridtest");
+}
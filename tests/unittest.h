@@ -0,0 +1,25 @@
+#pragma once
+
+#include <iostream>
+
+/*
+	Minimal support for the unit tests of classes which only need headers
+	(and a few sources without dependencies) from ../src. Failed checks are
+	printed and counted, and the test returns the number of failures.
+*/
+
+static int unittest_failures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n"; \
+		unittest_failures++; \
+	} \
+} while (0)
+
+inline int unittest_result(const char *name)
+{
+	if (unittest_failures) std::cerr << name << ": " << unittest_failures << " checks failed\n";
+	else std::cout << name << ": all checks passed\n";
+	return unittest_failures ? 1 : 0;
+}